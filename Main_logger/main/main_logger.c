@@ -19,10 +19,18 @@ FILE *myFile;
 
 #define BUF_SIZE 4096
 #define DISPLAY_BUFFER_SIZE 4096
+#define STAGE_PAGES 2
+#define READAHEAD_PAGES 2
 
 char display_buffer[DISPLAY_BUFFER_SIZE];
 size_t buffer_offset = 0;
 
+// Full pages are gathered here and written to SPIFFS together
+byte stage_buf[STAGE_PAGES * BUF_SIZE];
+
+// Pages read ahead of the scan in readRecordsFromFile
+byte ra_buf[READAHEAD_PAGES * BUF_SIZE];
+
 
 // Implement file read logic suitable for ESP-IDF
 int32_t read_fn_wctx(struct dblog_write_context *ctx, void *buf, uint32_t pos, size_t len) {
@@ -48,14 +56,15 @@ int32_t write_fn(struct dblog_write_context *ctx, void *buf, uint32_t pos, size_
     size_t ret = fwrite(buf, 1, len, myFile);
     if (ret != len)
         return DBLOG_RES_ERR;
-    if (fflush(myFile))
-        return DBLOG_RES_FLUSH_ERR;
 
     return ret;
 }
 
 // Implement file flush logic suitable for ESP-IDF
+// Called by dblog_flush, so pages are not flushed one by one
 int flush_fn(struct dblog_write_context *ctx) {
+    if (fflush(myFile))
+        return DBLOG_RES_FLUSH_ERR;
     return DBLOG_RES_OK;
 }
 
@@ -173,6 +182,7 @@ void log_random_data() {
     if (myFile) {
         byte ctx_buf[BUF_SIZE]; // Use a stack-allocated buffer
         struct dblog_write_context ctx;
+        memset(&ctx, 0, sizeof(ctx)); // optional fields not used
         ctx.buf = ctx_buf;
         ctx.col_count = 2; // For ID and Value columns
         ctx.page_resv_bytes = 0;
@@ -181,28 +191,24 @@ void log_random_data() {
         ctx.read_fn = read_fn_wctx;
         ctx.flush_fn = flush_fn;
         ctx.write_fn = write_fn;
+        ctx.stage_buf = stage_buf;
+        ctx.stage_pages = STAGE_PAGES;
 
         int res = dblog_write_init(&ctx);
         if (!res) {
-            for (int i = 1; i <= num_recs; i++) {
-                int value = rand() % 1000;
-                res = dblog_set_col_val(&ctx, 0, DBLOG_TYPE_INT, &i, sizeof(int));
-                if (!res) {
-                    res = dblog_set_col_val(&ctx, 1, DBLOG_TYPE_INT, &value, sizeof(int));
-                    if (!res) {
-                        res = dblog_append_empty_row(&ctx);
-                        if (res) {
-                            ESP_LOGI(TAG, "Error appending row: %d", res);
-                            break;
-                        }
-                    } else {
-                        ESP_LOGI(TAG, "Error setting value column: %d", res);
-                        break;
-                    }
-                } else {
-                    ESP_LOGI(TAG, "Error setting ID column: %d", res);
-                    break;
-                }
+            int ids[num_recs];
+            int values[num_recs];
+            for (int i = 0; i < num_recs; i++) {
+                ids[i] = i + 1;
+                values[i] = rand() % 1000;
+            }
+            uint8_t types[] = {DBLOG_TYPE_INT, DBLOG_TYPE_INT};
+            const void *cols[] = {ids, values};
+            uint16_t lengths[] = {sizeof(int), sizeof(int)};
+            uint32_t rows_appended;
+            res = dblog_append_rows_columnar(&ctx, num_recs, types, cols, lengths, NULL, &rows_appended);
+            if (res) {
+                ESP_LOGI(TAG, "Error appending rows: %d after %u rows", res, (unsigned) rows_appended);
             }
             if (!res) {
                 res = dblog_finalize(&ctx);
@@ -232,8 +238,11 @@ void readRecordsFromFile(const char *filename) {
 
     byte ctx_buf[BUF_SIZE];
     struct dblog_read_context ctx;
+    memset(&ctx, 0, sizeof(ctx)); // optional fields not used
     ctx.buf = ctx_buf;
     ctx.read_fn = read_fn_rctx;
+    ctx.ra_buf = ra_buf;
+    ctx.ra_pages = READAHEAD_PAGES;
     ctx.page_size_exp = 9;
 
     int res = dblog_read_init(&ctx);
@@ -0,0 +1,210 @@
+/*
+  Sqlite Micro Logger - multi-producer ingest queue
+
+  See ulog_ingest.h for description
+
+  The ring is a bounded queue where each slot carries a sequence no.
+  A slot at position pos is free for the producer when its sequence
+  is pos and holds a record for the consumer when it is pos + 1.
+  Producers and the consumer claim positions with compare and swap,
+  so producers that drop the oldest record can take slots the same
+  way as the writer.  Slot layout: sequence (4), length (2), unused (2)
+  and record data.
+*/
+
+#include "ulog_ingest.h"
+
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#else
+#include <sched.h>
+#endif
+
+#define SLOT_HDR_LEN 8
+
+// Lets the writer run while waiting for a free slot
+void ingest_yield() {
+#ifdef ESP_PLATFORM
+  vTaskDelay(1);
+#else
+  sched_yield();
+#endif
+}
+
+byte *ingest_slot_at(struct dblog_ingest *ing, uint32_t pos) {
+  return ing->buf + (pos & (ing->slot_count - 1))
+          * DBLOG_INGEST_SLOT_LEN(ing->slot_size);
+}
+
+uint32_t *ingest_slot_seq(byte *slot) {
+  return (uint32_t *) slot;
+}
+
+uint16_t *ingest_slot_len(byte *slot) {
+  return (uint16_t *) (slot + 4);
+}
+
+// Takes the oldest queued record, if any, for reading
+// Returns NULL if queue is empty or the oldest record
+// is not yet completely placed by its producer
+byte *ingest_take_slot(struct dblog_ingest *ing, uint32_t *out_pos) {
+  uint32_t pos = __atomic_load_n(&ing->deq_pos, __ATOMIC_RELAXED);
+  for (;;) {
+    byte *slot = ingest_slot_at(ing, pos);
+    uint32_t seq = __atomic_load_n(ingest_slot_seq(slot), __ATOMIC_ACQUIRE);
+    int32_t diff = (int32_t) (seq - (pos + 1));
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&ing->deq_pos, &pos, pos + 1, 1,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        *out_pos = pos;
+        return slot;
+      }
+    } else
+    if (diff < 0)
+      return NULL;
+    else
+      pos = __atomic_load_n(&ing->deq_pos, __ATOMIC_RELAXED);
+  }
+}
+
+// Makes slot taken by ingest_take_slot() available to producers
+void ingest_release_slot(struct dblog_ingest *ing, byte *slot, uint32_t pos) {
+  __atomic_store_n(ingest_slot_seq(slot), pos + ing->slot_count, __ATOMIC_RELEASE);
+}
+
+// Claims a free slot for writing, applying mode if there is none
+// Returns NULL if the record is to be dropped
+byte *ingest_reserve_slot(struct dblog_ingest *ing, uint32_t *out_pos) {
+  uint32_t pos = __atomic_load_n(&ing->enq_pos, __ATOMIC_RELAXED);
+  for (;;) {
+    byte *slot = ingest_slot_at(ing, pos);
+    uint32_t seq = __atomic_load_n(ingest_slot_seq(slot), __ATOMIC_ACQUIRE);
+    int32_t diff = (int32_t) (seq - pos);
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&ing->enq_pos, &pos, pos + 1, 1,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        *out_pos = pos;
+        return slot;
+      }
+      continue;
+    }
+    if (diff < 0) {
+      uint32_t old_pos;
+      byte *old_slot;
+      switch (ing->mode) {
+        case DBLOG_INGEST_DROP_NEWEST:
+          __atomic_add_fetch(&ing->drop_count, 1, __ATOMIC_RELAXED);
+          return NULL;
+        case DBLOG_INGEST_DROP_OLDEST:
+          old_slot = ingest_take_slot(ing, &old_pos);
+          if (old_slot) {
+            ingest_release_slot(ing, old_slot, old_pos);
+            __atomic_add_fetch(&ing->drop_count, 1, __ATOMIC_RELAXED);
+            break;
+          }
+          // oldest slot is still being filled
+          ingest_yield();
+          break;
+        default:
+          ingest_yield();
+      }
+    }
+    pos = __atomic_load_n(&ing->enq_pos, __ATOMIC_RELAXED);
+  }
+}
+
+// Hands over filled slot to the consumer and updates counters
+void ingest_publish_slot(struct dblog_ingest *ing, byte *slot, uint32_t pos) {
+  __atomic_store_n(ingest_slot_seq(slot), pos + 1, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&ing->put_count, 1, __ATOMIC_RELAXED);
+  uint32_t depth = dblog_ingest_depth(ing);
+  uint32_t max_depth = __atomic_load_n(&ing->max_depth, __ATOMIC_RELAXED);
+  while (depth > max_depth && !__atomic_compare_exchange_n(&ing->max_depth,
+          &max_depth, depth, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+// See .h file for API description
+int dblog_ingest_init(struct dblog_ingest *ing) {
+  if (ing->slot_count < 2 || (ing->slot_count & (ing->slot_count - 1)))
+    return DBLOG_RES_ERR;
+  if ((uintptr_t) ing->buf & 3)
+    return DBLOG_RES_ERR;
+  for (uint32_t i = 0; i < ing->slot_count; i++) {
+    byte *slot = ingest_slot_at(ing, i);
+    *ingest_slot_seq(slot) = i;
+    *ingest_slot_len(slot) = 0;
+  }
+  ing->enq_pos = 0;
+  ing->deq_pos = 0;
+  ing->put_count = 0;
+  ing->drop_count = 0;
+  ing->max_depth = 0;
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  return DBLOG_RES_OK;
+}
+
+// See .h file for API description
+int dblog_ingest_put(struct dblog_ingest *ing, const void *rec, uint16_t rec_len) {
+  if (rec_len > ing->slot_size || rec_len < 2)
+    return DBLOG_RES_TOO_LONG;
+  uint32_t pos;
+  byte *slot = ingest_reserve_slot(ing, &pos);
+  if (!slot)
+    return DBLOG_RES_DROPPED;
+  memcpy(slot + SLOT_HDR_LEN, rec, rec_len);
+  *ingest_slot_len(slot) = rec_len;
+  ingest_publish_slot(ing, slot, pos);
+  return DBLOG_RES_OK;
+}
+
+// See .h file for API description
+int dblog_ingest_put_row(struct dblog_ingest *ing, int col_count,
+      const uint8_t types[], const void *values[], const uint16_t lengths[]) {
+  // checked before claiming a slot, as a claimed slot cannot be
+  // given back and may have dropped the oldest record
+  int rec_len = dblog_encode_row(col_count, types, values, lengths,
+                      NULL, ing->slot_size);
+  if (rec_len < 0)
+    return rec_len;
+  uint32_t pos;
+  byte *slot = ingest_reserve_slot(ing, &pos);
+  if (!slot)
+    return DBLOG_RES_DROPPED;
+  dblog_encode_row(col_count, types, values, lengths,
+      slot + SLOT_HDR_LEN, ing->slot_size);
+  *ingest_slot_len(slot) = rec_len;
+  ingest_publish_slot(ing, slot, pos);
+  return DBLOG_RES_OK;
+}
+
+// See .h file for API description
+int dblog_ingest_drain(struct dblog_ingest *ing, uint32_t max_rows) {
+  int count = 0;
+  while ((uint32_t) count < max_rows) {
+    uint32_t pos;
+    byte *slot = ingest_take_slot(ing, &pos);
+    if (!slot)
+      break;
+    uint16_t rec_len = *ingest_slot_len(slot);
+    int res = DBLOG_RES_OK;
+    if (rec_len) {
+      res = dblog_append_encoded_row(ing->wctx, slot + SLOT_HDR_LEN, rec_len);
+      count++;
+    }
+    ingest_release_slot(ing, slot, pos);
+    if (res)
+      return res;
+  }
+  return count;
+}
+
+// See .h file for API description
+uint32_t dblog_ingest_depth(struct dblog_ingest *ing) {
+  uint32_t deq_pos = __atomic_load_n(&ing->deq_pos, __ATOMIC_RELAXED);
+  uint32_t enq_pos = __atomic_load_n(&ing->enq_pos, __ATOMIC_RELAXED);
+  return enq_pos - deq_pos;
+}
@@ -0,0 +1,98 @@
+/*
+  Sqlite Micro Logger - multi-producer ingest queue
+
+  Lets several tasks log into one database without sharing the write
+  context.  Producers place records encoded by dblog_encode_row() (or
+  by ulog_sqlite.hpp) into a lock-free ring of fixed size slots and a
+  single writer task appends them to pages using
+  dblog_append_encoded_row(), for example:
+
+    static byte ring[64 * DBLOG_INGEST_SLOT_LEN(48)] __attribute__((aligned(4)));
+    struct dblog_ingest ing;
+    memset(&ing, '\0', sizeof(ing));
+    ing.wctx = &wctx;   // after dblog_write_init()
+    ing.buf = ring;
+    ing.slot_count = 64;
+    ing.slot_size = 48;
+    ing.mode = DBLOG_INGEST_DROP_OLDEST;
+    dblog_ingest_init(&ing);
+
+    // any producer task
+    dblog_ingest_put_row(&ing, 2, types, values, lengths);
+
+    // writer task
+    while (dblog_ingest_drain(&ing, 32) > 0)
+      ;
+    dblog_flush(&wctx);
+
+  Row IDs are assigned by the writer in the order records were queued.
+  Producers never wait for page writes, only for a free slot and only
+  in DBLOG_INGEST_BLOCK mode.
+*/
+
+#ifndef __ULOG_INGEST__
+#define __ULOG_INGEST__
+
+#include "ulog_sqlite.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// What producers do when all slots are taken
+enum {
+  DBLOG_INGEST_BLOCK = 0,     // wait for the writer to free a slot
+  DBLOG_INGEST_DROP_OLDEST,   // discard the oldest record not yet written
+  DBLOG_INGEST_DROP_NEWEST    // discard the record being put
+};
+
+// Bytes of ring buffer used by each slot for records upto slot_size bytes
+#define DBLOG_INGEST_SLOT_LEN(slot_size) (8 + (((slot_size) + 3) & ~3))
+
+struct dblog_ingest {
+  struct dblog_write_context *wctx; // Used only by dblog_ingest_drain()
+  byte *buf;           // slot_count * DBLOG_INGEST_SLOT_LEN(slot_size) bytes,
+                       // 4 byte aligned
+  uint32_t slot_count; // Power of 2
+  uint16_t slot_size;  // Maximum length of record
+  byte mode;           // DBLOG_INGEST_BLOCK, _DROP_OLDEST or _DROP_NEWEST
+  // following are running values used internally
+  // and may be read at any time as counters
+  uint32_t enq_pos;    // No. of slots taken by producers so far
+  uint32_t deq_pos;    // No. of slots released so far
+  uint32_t put_count;  // Records queued
+  uint32_t drop_count; // Records discarded due to mode
+  uint32_t max_depth;  // Highest no. of records waiting seen
+};
+
+// Prepares the slots. Returns DBLOG_RES_ERR if slot_count
+// is not a power of 2 or buf is not aligned
+int dblog_ingest_init(struct dblog_ingest *ing);
+
+// Queues given record body (as taken by dblog_append_encoded_row())
+// Can be called from any number of tasks at the same time
+// Returns DBLOG_RES_OK, DBLOG_RES_TOO_LONG if rec_len is more than
+// slot_size or DBLOG_RES_DROPPED if queue was full in DBLOG_INGEST_DROP_NEWEST mode
+int dblog_ingest_put(struct dblog_ingest *ing, const void *rec, uint16_t rec_len);
+
+// Same as dblog_ingest_put() but encodes given values
+// (as in dblog_append_row_with_values()) directly into the slot
+// Returns DBLOG_RES_TOO_LONG without taking a slot if the record
+// would be more than slot_size
+int dblog_ingest_put_row(struct dblog_ingest *ing, int col_count,
+      const uint8_t types[], const void *values[], const uint16_t lengths[]);
+
+// Appends upto max_rows queued records to the database
+// Should be called only from one task, which is the only one using wctx
+// Returns no. of rows appended or error from dblog_append_encoded_row(),
+// in which case the record that failed is lost
+int dblog_ingest_drain(struct dblog_ingest *ing, uint32_t max_rows);
+
+// Returns no. of records waiting to be written
+uint32_t dblog_ingest_depth(struct dblog_ingest *ing);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
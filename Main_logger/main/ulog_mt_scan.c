@@ -0,0 +1,302 @@
+/*
+  Sqlite Micro Logger - multi-threaded scanner
+
+  See ulog_mt_scan.h for description
+*/
+
+#include "ulog_mt_scan.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define DBLOG_MT_MAX_PAGE_SIZE 65536
+
+// State of each worker thread
+// rctx is first so that read_fn can find the worker from it
+struct dblog_mt_worker {
+  struct dblog_read_context rctx;
+  struct dblog_mt_scan *mt;
+  int idx;
+  int fd;
+  byte *buf;
+  uint32_t from_rowid;
+  uint32_t to_rowid;
+  struct dblog_pred *preds; // own copy as running values are updated
+  int col_idx;              // column to aggregate, -2 to call row_fn
+  struct dblog_agg agg;
+  uint32_t *rowids;         // used by dblog_mt_find_rowids()
+  uint32_t rowid_count;
+  uint32_t rowid_alloc;
+  int res;
+  pthread_t thread;
+};
+
+// Reads using pread() so that workers can share the file descriptor
+int32_t mt_read_fn(struct dblog_read_context *ctx, void *buf, uint32_t pos, size_t len) {
+  struct dblog_mt_worker *w = (struct dblog_mt_worker *) ctx;
+  if (pread(w->fd, buf, len, pos) != (ssize_t) len)
+    return DBLOG_RES_READ_ERR;
+  return len;
+}
+
+// Opens own read context of the worker
+int mt_open_worker(struct dblog_mt_worker *w, const char *path) {
+  memset(&w->rctx, '\0', sizeof(w->rctx));
+  w->fd = -1;
+  w->buf = NULL;
+#if DBLOG_CFG_MMAP_READ
+  return dblog_read_map_file(&w->rctx, path);
+#else
+  w->fd = open(path, O_RDONLY);
+  if (w->fd < 0)
+    return DBLOG_RES_READ_ERR;
+  w->buf = (byte *) malloc(DBLOG_MT_MAX_PAGE_SIZE);
+  if (!w->buf)
+    return DBLOG_RES_ERR;
+  w->rctx.buf = w->buf;
+  w->rctx.read_fn = mt_read_fn;
+  return dblog_read_init(&w->rctx);
+#endif
+}
+
+void mt_close_worker(struct dblog_mt_worker *w) {
+#if DBLOG_CFG_MMAP_READ
+  dblog_read_unmap(&w->rctx);
+#endif
+  if (w->fd >= 0)
+    close(w->fd);
+  free(w->buf);
+  free(w->preds);
+  free(w->rowids);
+  w->fd = -1;
+  w->buf = NULL;
+  w->preds = NULL;
+  w->rowids = NULL;
+}
+
+// Returns Row ID at current position
+uint32_t mt_read_cur_rowid(struct dblog_read_context *rctx) {
+  int col_idx = -1;
+  uint8_t type = DBLOG_TYPE_INT;
+  uint32_t rowid = 0;
+  void *vals[] = {&rowid};
+  uint8_t len = 4;
+  if (dblog_read_cols_batch(rctx, 1, 1, &col_idx, &type, vals, &len, NULL) != 1)
+    return 0;
+  return rowid;
+}
+
+// Finds Row IDs of the oldest and latest rows
+int mt_find_rowid_range(struct dblog_mt_scan *mt) {
+  struct dblog_mt_worker w;
+  memset(&w, '\0', sizeof(w));
+  int res = mt_open_worker(&w, mt->path);
+  if (!res)
+    res = dblog_read_first_row(&w.rctx);
+  if (!res) {
+    mt->first_rowid = mt_read_cur_rowid(&w.rctx);
+    res = dblog_read_last_row(&w.rctx);
+  }
+  if (!res)
+    mt->last_rowid = mt_read_cur_rowid(&w.rctx);
+  mt_close_worker(&w);
+  return res;
+}
+
+// Scans the Row ID range of the worker
+void *mt_run_worker(void *arg) {
+  struct dblog_mt_worker *w = (struct dblog_mt_worker *) arg;
+  struct dblog_mt_scan *mt = w->mt;
+  struct dblog_scan scan;
+  memset(&scan, '\0', sizeof(scan));
+  scan.key_col_idx = -1;
+  scan.key_type = DBLOG_TYPE_INT;
+  // First and last workers are left open ended so that
+  // pages can be taken from their summary alone
+  if (w->idx > 0) {
+    scan.key_from = &w->from_rowid;
+    scan.key_from_len = 4;
+  }
+  if (w->idx < mt->thread_count - 1) {
+    scan.key_to = &w->to_rowid;
+    scan.key_to_len = 4;
+  }
+  scan.preds = w->preds;
+  scan.pred_count = mt->pred_count;
+  if (w->col_idx != -2) {
+    w->res = dblog_agg_range(&w->rctx, &scan, w->col_idx, &w->agg);
+    return NULL;
+  }
+  int res = dblog_scan_first(&w->rctx, &scan);
+  while (res == DBLOG_RES_OK && !mt->stop) {
+    mt->rows_matched[w->idx]++;
+    int ret = mt->row_fn(mt, w->idx, &w->rctx);
+    if (ret) {
+      w->res = ret;
+      mt->stop = 1;
+      return NULL;
+    }
+    res = dblog_scan_next(&w->rctx, &scan);
+  }
+  w->res = (res == DBLOG_RES_NOT_FOUND ? DBLOG_RES_OK : res);
+  return NULL;
+}
+
+// Splits Row IDs among workers and runs them, returning the
+// first error.  col_idx is the column to aggregate or -2 for row_fn
+int mt_run_workers(struct dblog_mt_scan *mt, int col_idx,
+      struct dblog_mt_worker **out_workers) {
+  *out_workers = NULL;
+  if (mt->thread_count < 1 || mt->thread_count > DBLOG_MT_MAX_THREADS)
+    return DBLOG_RES_ERR;
+  int res = mt_find_rowid_range(mt);
+  if (res)
+    return res;
+  uint32_t row_count = mt->last_rowid - mt->first_rowid + 1;
+  if ((uint32_t) mt->thread_count > row_count)
+    mt->thread_count = row_count;
+  mt->stop = 0;
+  memset(mt->rows_matched, '\0', sizeof(mt->rows_matched));
+  struct dblog_mt_worker *workers = (struct dblog_mt_worker *)
+          calloc(mt->thread_count, sizeof(struct dblog_mt_worker));
+  if (!workers)
+    return DBLOG_RES_ERR;
+  *out_workers = workers;
+  int started = 0;
+  for (int i = 0; i < mt->thread_count; i++) {
+    struct dblog_mt_worker *w = &workers[i];
+    w->mt = mt;
+    w->idx = i;
+    w->col_idx = col_idx;
+    w->from_rowid = mt->first_rowid + (uint32_t) ((uint64_t) row_count * i / mt->thread_count);
+    w->to_rowid = mt->first_rowid + (uint32_t) ((uint64_t) row_count * (i + 1) / mt->thread_count) - 1;
+    res = mt_open_worker(w, mt->path);
+    if (res)
+      break;
+    if (mt->pred_count) {
+      w->preds = (struct dblog_pred *) malloc(mt->pred_count * sizeof(struct dblog_pred));
+      if (!w->preds) {
+        res = DBLOG_RES_ERR;
+        break;
+      }
+      memcpy(w->preds, mt->preds, mt->pred_count * sizeof(struct dblog_pred));
+    }
+    if (pthread_create(&w->thread, NULL, mt_run_worker, w)) {
+      res = DBLOG_RES_ERR;
+      break;
+    }
+    started++;
+  }
+  if (res)
+    mt->stop = 1;
+  for (int i = 0; i < started; i++) {
+    pthread_join(workers[i].thread, NULL);
+    if (!res)
+      res = workers[i].res;
+  }
+  return res;
+}
+
+void mt_free_workers(struct dblog_mt_scan *mt, struct dblog_mt_worker *workers) {
+  if (!workers)
+    return;
+  for (int i = 0; i < mt->thread_count; i++)
+    mt_close_worker(&workers[i]);
+  free(workers);
+}
+
+// See .h file for API description
+int dblog_mt_scan_rows(struct dblog_mt_scan *mt) {
+  struct dblog_mt_worker *workers;
+  int res = mt_run_workers(mt, -2, &workers);
+  mt_free_workers(mt, workers);
+  return res;
+}
+
+// Combines aggregate of a worker into the total
+void mt_merge_agg(struct dblog_agg *agg, struct dblog_agg *from) {
+  agg->pages_summarized += from->pages_summarized;
+  agg->rows_decoded += from->rows_decoded;
+  if (!from->count)
+    return;
+  if (!agg->count) {
+    uint32_t pages_summarized = agg->pages_summarized;
+    uint32_t rows_decoded = agg->rows_decoded;
+    *agg = *from;
+    agg->pages_summarized = pages_summarized;
+    agg->rows_decoded = rows_decoded;
+    return;
+  }
+  if (!agg->is_real && !from->is_real) {
+    agg->sum += from->sum;
+    if (from->min < agg->min)
+      agg->min = from->min;
+    if (from->max > agg->max)
+      agg->max = from->max;
+  }
+  agg->sum_dbl += from->sum_dbl;
+  if (from->min_dbl < agg->min_dbl)
+    agg->min_dbl = from->min_dbl;
+  if (from->max_dbl > agg->max_dbl)
+    agg->max_dbl = from->max_dbl;
+  agg->count += from->count;
+  agg->is_real |= from->is_real;
+}
+
+// See .h file for API description
+int dblog_mt_agg(struct dblog_mt_scan *mt, int col_idx, struct dblog_agg *agg) {
+  memset(agg, '\0', sizeof(struct dblog_agg));
+  struct dblog_mt_worker *workers;
+  int res = mt_run_workers(mt, col_idx, &workers);
+  if (!res) {
+    for (int i = 0; i < mt->thread_count; i++)
+      mt_merge_agg(agg, &workers[i].agg);
+  }
+  mt_free_workers(mt, workers);
+  return res;
+}
+
+// Keeps Row ID of matching row in the list of the worker
+int mt_collect_rowid(struct dblog_mt_scan *mt, int worker, struct dblog_read_context *rctx) {
+  (void) mt;
+  (void) worker; // list is kept in the worker, which rctx is part of
+  struct dblog_mt_worker *w = ((struct dblog_mt_worker *) rctx);
+  if (w->rowid_count == w->rowid_alloc) {
+    uint32_t alloc = w->rowid_alloc ? w->rowid_alloc * 2 : 1024;
+    uint32_t *rowids = (uint32_t *) realloc(w->rowids, alloc * sizeof(uint32_t));
+    if (!rowids)
+      return DBLOG_RES_ERR;
+    w->rowids = rowids;
+    w->rowid_alloc = alloc;
+  }
+  w->rowids[w->rowid_count++] = mt_read_cur_rowid(rctx);
+  return DBLOG_RES_OK;
+}
+
+// See .h file for API description
+int dblog_mt_find_rowids(struct dblog_mt_scan *mt, uint32_t *rowids,
+      uint32_t max_count, uint32_t *out_count) {
+  dblog_mt_row_fn row_fn = mt->row_fn;
+  mt->row_fn = mt_collect_rowid;
+  struct dblog_mt_worker *workers;
+  int res = mt_run_workers(mt, -2, &workers);
+  mt->row_fn = row_fn;
+  *out_count = 0;
+  // Workers have consecutive Row ID ranges, so joining
+  // their lists in order keeps the Row ID order
+  for (int i = 0; !res && i < mt->thread_count; i++) {
+    struct dblog_mt_worker *w = &workers[i];
+    uint32_t count = w->rowid_count;
+    if (*out_count + count > max_count) {
+      count = max_count - *out_count;
+      res = DBLOG_RES_TOO_LONG;
+    }
+    memcpy(rowids + *out_count, w->rowids, count * sizeof(uint32_t));
+    *out_count += count;
+  }
+  mt_free_workers(mt, workers);
+  return res;
+}
@@ -0,0 +1,77 @@
+/*
+  Sqlite Micro Logger - multi-threaded scanner
+
+  Host side (POSIX threads) scanning of a finalized database using
+  a pool of worker threads, for processing many device logs, for example:
+
+    struct dblog_mt_scan mt;
+    memset(&mt, '\0', sizeof(mt));
+    mt.path = "device1.db";
+    mt.thread_count = 8;
+    struct dblog_agg agg;
+    dblog_mt_agg(&mt, 2, &agg);
+
+  Rows from the oldest to the latest are split by Row ID into
+  thread_count consecutive ranges and each worker scans its range
+  using its own dblog_read_context, with dblog_scan_first() /
+  dblog_scan_next() or dblog_agg_range(), so that conditions, zone maps,
+  Bloom filters and page aggregates are used as in single threaded scans.
+  The file is mapped if DBLOG_CFG_MMAP_READ is 1, else read using pread().
+  Not part of the ESP-IDF component.
+*/
+
+#ifndef __ULOG_MT_SCAN__
+#define __ULOG_MT_SCAN__
+
+#include "ulog_sqlite.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Maximum no. of worker threads
+#define DBLOG_MT_MAX_THREADS 64
+
+struct dblog_mt_scan;
+
+// Called by worker threads for each row matching preds, with rctx
+// positioned at the row.  Rows given to a worker are in Row ID order
+// and worker 0 has the oldest rows, worker 1 the ones after and so on,
+// so results kept per worker can be joined in worker order to have
+// them in Row ID order.  Should return 0 to continue, else the scan
+// of all workers is stopped and the value is returned
+typedef int (*dblog_mt_row_fn)(struct dblog_mt_scan *mt, int worker,
+              struct dblog_read_context *rctx);
+
+struct dblog_mt_scan {
+  const char *path;    // Finalized database file
+  int thread_count;    // No. of worker threads, 1 to DBLOG_MT_MAX_THREADS
+  struct dblog_pred *preds; // Optional conditions as in struct dblog_scan
+  byte pred_count;
+  dblog_mt_row_fn row_fn; // For dblog_mt_scan_rows()
+  void *arg;           // For use by row_fn
+  // following are running values used internally
+  uint32_t first_rowid;
+  uint32_t last_rowid;
+  volatile int stop;
+  uint32_t rows_matched[DBLOG_MT_MAX_THREADS]; // per worker, after scan
+};
+
+// Calls row_fn from worker threads for every row matching preds
+// Returns DBLOG_RES_OK or first error / non zero value of row_fn
+int dblog_mt_scan_rows(struct dblog_mt_scan *mt);
+
+// Finds count, sum, min and max of given column for rows matching
+// preds by combining dblog_agg_range() of each worker
+int dblog_mt_agg(struct dblog_mt_scan *mt, int col_idx, struct dblog_agg *agg);
+
+// Gives Row IDs of rows matching preds in Row ID order, upto max_count
+// Returns DBLOG_RES_TOO_LONG if more rows matched
+int dblog_mt_find_rowids(struct dblog_mt_scan *mt, uint32_t *rowids,
+      uint32_t max_count, uint32_t *out_count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
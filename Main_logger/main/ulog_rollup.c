@@ -0,0 +1,412 @@
+/*
+  Sqlite Micro Logger - rollup levels
+
+  See ulog_rollup.h for description
+
+  Columns of each level: window start (INT), count (INT) and for each
+  rolled up column min, max, avg and last (REAL).  Level -1 is used
+  below for the rows as logged.
+
+  Each level has all windows before its window being formed (or before
+  next_start if there is none), so a range is read from the coarsest
+  level for the windows it wholly covers and written, and from the
+  finer levels for the rest.
+*/
+
+#include "ulog_rollup.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// Returns start of window of given level having given time
+int64_t rollup_window_of(struct dblog_rollup_level *lv, int64_t ts) {
+  int64_t rem = ts % (int64_t) lv->window_secs;
+  if (rem < 0)
+    rem += lv->window_secs;
+  return ts - rem;
+}
+
+// Returns time upto which windows of given level are written
+int64_t rollup_written_end(struct dblog_rollup_level *lv) {
+  return lv->cur.count ? lv->cur.start : lv->next_start;
+}
+
+// Returns numeric value as given to append
+double rollup_native_num(uint8_t type, const void *val, uint16_t len) {
+  if (!val)
+    return 0;
+  if (type == DBLOG_TYPE_REAL)
+    return len == 4 ? *((float *) val) : *((double *) val);
+  switch (len) {
+    case 1:
+      return *((int8_t *) val);
+    case 2:
+      return *((int16_t *) val);
+    case 4:
+      return *((int32_t *) val);
+  }
+  return (double) *((int64_t *) val);
+}
+
+// Adds given window (or row) to acc, which is in time order after acc
+void rollup_merge(struct dblog_rollup *ru, struct dblog_rollup_window *acc,
+      struct dblog_rollup_window *win) {
+  if (!win->count)
+    return;
+  if (!acc->count) {
+    int64_t start = acc->start;
+    *acc = *win;
+    acc->start = start;
+    return;
+  }
+  for (int i = 0; i < ru->col_count; i++) {
+    if (win->min[i] < acc->min[i])
+      acc->min[i] = win->min[i];
+    if (win->max[i] > acc->max[i])
+      acc->max[i] = win->max[i];
+    acc->sum[i] += win->sum[i];
+    acc->last[i] = win->last[i];
+  }
+  acc->count += win->count;
+}
+
+// Positions rctx for reading the database being written by wctx
+// upto the point published by the writer on flush, as the first page
+// may be as last finalized (such as if state_write_fn is used)
+// Returns DBLOG_RES_NOT_FOUND if no row is written yet
+int rollup_open_reader(struct dblog_write_context *wctx,
+      struct dblog_read_context *rctx) {
+  int res = dblog_flush(wctx);
+  if (res)
+    return res;
+  return dblog_read_snapshot(rctx, wctx->snapshot);
+}
+
+// Decodes the current row of given level (or row as logged if level < 0)
+int rollup_read_window(struct dblog_rollup *ru, int level,
+      struct dblog_read_context *rctx, struct dblog_rollup_window *win) {
+  int col_idxs[DBLOG_ROLLUP_COL_COUNT(DBLOG_ROLLUP_MAX_COLS)];
+  uint8_t types[DBLOG_ROLLUP_COL_COUNT(DBLOG_ROLLUP_MAX_COLS)];
+  uint8_t lengths[DBLOG_ROLLUP_COL_COUNT(DBLOG_ROLLUP_MAX_COLS)];
+  void *values[DBLOG_ROLLUP_COL_COUNT(DBLOG_ROLLUP_MAX_COLS)];
+  int n = 0;
+  col_idxs[n] = (level < 0 ? ru->ts_col_idx : 0);
+  types[n] = DBLOG_TYPE_INT;
+  lengths[n] = 8;
+  values[n++] = &win->start;
+  if (level >= 0) {
+    col_idxs[n] = 1;
+    types[n] = DBLOG_TYPE_INT;
+    lengths[n] = 4;
+    values[n++] = &win->count;
+  }
+  for (int i = 0; i < ru->col_count; i++) {
+    double *dest[] = {&win->min[i], &win->max[i], &win->sum[i], &win->last[i]};
+    for (int j = 0; j < (level < 0 ? 1 : 4); j++) {
+      col_idxs[n] = (level < 0 ? ru->cols[i] : 2 + i * 4 + j);
+      types[n] = DBLOG_TYPE_REAL;
+      lengths[n] = 8;
+      values[n++] = dest[j];
+    }
+  }
+  int res = dblog_read_cols_batch(rctx, 1, n, col_idxs, types, values, lengths, NULL);
+  if (res < 0)
+    return res;
+  ru->rows_read++;
+  if (level < 0) {
+    win->count = 1;
+    for (int i = 0; i < ru->col_count; i++)
+      win->max[i] = win->sum[i] = win->last[i] = win->min[i];
+  } else {
+    for (int i = 0; i < ru->col_count; i++)
+      win->sum[i] *= win->count; // avg is stored
+  }
+  return DBLOG_RES_OK;
+}
+
+// Calls window_fn for rows of given level (or rows as logged if
+// level < 0) with time (window start) from from_ts to to_ts
+int rollup_scan(struct dblog_rollup *ru, int level, int64_t from_ts, int64_t to_ts,
+      dblog_rollup_window_fn window_fn, void *arg) {
+  if (from_ts > to_ts)
+    return DBLOG_RES_OK;
+  struct dblog_write_context *wctx = (level < 0 ? ru->wctx : ru->levels[level].wctx);
+  struct dblog_read_context *rctx = (level < 0 ? ru->rctx : ru->levels[level].rctx);
+  uint32_t window_secs = (level < 0 ? 0 : ru->levels[level].window_secs);
+  int res = rollup_open_reader(wctx, rctx);
+  if (res)
+    return res == DBLOG_RES_NOT_FOUND ? DBLOG_RES_OK : res;
+  struct dblog_scan scan;
+  memset(&scan, '\0', sizeof(scan));
+  scan.key_col_idx = (level < 0 ? ru->ts_col_idx : 0);
+  scan.key_type = DBLOG_TYPE_INT;
+  if (from_ts != INT64_MIN) {
+    scan.key_from = &from_ts;
+    scan.key_from_len = 8;
+  }
+  scan.key_to = &to_ts;
+  scan.key_to_len = 8;
+  struct dblog_rollup_window win;
+  res = dblog_scan_first(rctx, &scan);
+  while (res == DBLOG_RES_OK) {
+    res = rollup_read_window(ru, level, rctx, &win);
+    if (res)
+      return res;
+    res = window_fn(ru, &win, window_secs, arg);
+    if (res)
+      return res;
+    res = dblog_scan_next(rctx, &scan);
+  }
+  return res == DBLOG_RES_NOT_FOUND ? DBLOG_RES_OK : res;
+}
+
+int rollup_add(struct dblog_rollup *ru, int level, struct dblog_rollup_window *win);
+
+// Writes the window being formed at given level
+// and adds it to the level above
+int rollup_write_window(struct dblog_rollup *ru, int level) {
+  struct dblog_rollup_level *lv = &ru->levels[level];
+  struct dblog_rollup_window *win = &lv->cur;
+  uint8_t types[DBLOG_ROLLUP_COL_COUNT(DBLOG_ROLLUP_MAX_COLS)];
+  const void *values[DBLOG_ROLLUP_COL_COUNT(DBLOG_ROLLUP_MAX_COLS)];
+  uint16_t lengths[DBLOG_ROLLUP_COL_COUNT(DBLOG_ROLLUP_MAX_COLS)];
+  double avg[DBLOG_ROLLUP_MAX_COLS];
+  int n = 0;
+  types[n] = DBLOG_TYPE_INT;
+  lengths[n] = 8;
+  values[n++] = &win->start;
+  types[n] = DBLOG_TYPE_INT;
+  lengths[n] = 4;
+  values[n++] = &win->count;
+  for (int i = 0; i < ru->col_count; i++) {
+    avg[i] = win->sum[i] / win->count;
+    const double *src[] = {&win->min[i], &win->max[i], &avg[i], &win->last[i]};
+    for (int j = 0; j < 4; j++) {
+      types[n] = DBLOG_TYPE_REAL;
+      lengths[n] = 8;
+      values[n++] = src[j];
+    }
+  }
+  int res = dblog_append_row_with_values(lv->wctx, types, values, lengths);
+  if (res)
+    return res;
+  lv->next_start = win->start + lv->window_secs;
+  if (level + 1 < ru->level_count) {
+    res = rollup_add(ru, level + 1, win);
+    if (res)
+      return res;
+  }
+  win->count = 0;
+  return DBLOG_RES_OK;
+}
+
+// Adds given row or window of level below to the window being formed
+// at given level, first writing it if win is of a later window
+int rollup_add(struct dblog_rollup *ru, int level, struct dblog_rollup_window *win) {
+  struct dblog_rollup_level *lv = &ru->levels[level];
+  int64_t start = rollup_window_of(lv, win->start);
+  if (lv->cur.count && start > lv->cur.start) {
+    int res = rollup_write_window(ru, level);
+    if (res)
+      return res;
+  }
+  if (!lv->cur.count)
+    lv->cur.start = start;
+  rollup_merge(ru, &lv->cur, win);
+  return DBLOG_RES_OK;
+}
+
+// Adds windows read from level below during dblog_rollup_open()
+int rollup_replay_fn(struct dblog_rollup *ru, struct dblog_rollup_window *win,
+      uint32_t window_secs, void *arg) {
+  (void) window_secs;
+  return rollup_add(ru, *((int *) arg), win);
+}
+
+// See .h file for API description
+int dblog_rollup_open(struct dblog_rollup *ru) {
+  if (!ru->level_count || ru->level_count > DBLOG_ROLLUP_MAX_LEVELS
+        || ru->col_count > DBLOG_ROLLUP_MAX_COLS)
+    return DBLOG_RES_ERR;
+  if (!ru->wctx->snapshot)
+    ru->wctx->snapshot = &ru->snap;
+  for (int i = 0; i < ru->level_count; i++) {
+    struct dblog_rollup_level *lv = &ru->levels[i];
+    if (!lv->wctx->snapshot)
+      lv->wctx->snapshot = &lv->snap;
+    if (!lv->window_secs || lv->wctx->col_count != DBLOG_ROLLUP_COL_COUNT(ru->col_count))
+      return DBLOG_RES_ERR;
+    if (i && lv->window_secs % ru->levels[i - 1].window_secs)
+      return DBLOG_RES_ERR;
+    lv->cur.count = 0;
+    lv->next_start = INT64_MIN;
+    int res = rollup_open_reader(lv->wctx, lv->rctx);
+    if (res && res != DBLOG_RES_NOT_FOUND)
+      return res;
+    if (!res && dblog_read_last_row(lv->rctx) == DBLOG_RES_OK) {
+      struct dblog_rollup_window win;
+      res = rollup_read_window(ru, i, lv->rctx, &win);
+      if (res)
+        return res;
+      lv->next_start = win.start + lv->window_secs;
+    }
+  }
+  // Windows being formed are made again from the top, so that windows
+  // written to a level while forming the one below are not added twice
+  for (int level = ru->level_count - 1; level >= 0; level--) {
+    int res = rollup_scan(ru, level - 1, ru->levels[level].next_start, INT64_MAX,
+                rollup_replay_fn, &level);
+    if (res)
+      return res;
+  }
+  return DBLOG_RES_OK;
+}
+
+// See .h file for API description
+int dblog_rollup_append(struct dblog_rollup *ru, uint8_t types[],
+      const void *values[], uint16_t lengths[]) {
+  int col = ru->ts_col_idx;
+  if (types[col] != DBLOG_TYPE_INT || !values[col])
+    return DBLOG_RES_TYPE_MISMATCH;
+  int res = dblog_append_row_with_values(ru->wctx, types, values, lengths);
+  if (res)
+    return res;
+  struct dblog_rollup_window win;
+  win.start = (int64_t) rollup_native_num(types[col], values[col], lengths[col]);
+  win.count = 1;
+  for (int i = 0; i < ru->col_count; i++) {
+    col = ru->cols[i];
+    win.min[i] = win.max[i] = win.sum[i] = win.last[i]
+               = rollup_native_num(types[col], values[col], lengths[col]);
+  }
+  return rollup_add(ru, 0, &win);
+}
+
+// See .h file for API description
+int dblog_rollup_flush(struct dblog_rollup *ru) {
+  int res = dblog_flush(ru->wctx);
+  for (int i = 0; !res && i < ru->level_count; i++)
+    res = dblog_flush(ru->levels[i].wctx);
+  return res;
+}
+
+// Adds windows read to the window given as arg
+int rollup_acc_fn(struct dblog_rollup *ru, struct dblog_rollup_window *win,
+      uint32_t window_secs, void *arg) {
+  (void) window_secs;
+  rollup_merge(ru, (struct dblog_rollup_window *) arg, win);
+  return DBLOG_RES_OK;
+}
+
+// Adds rows from from_ts to to_ts to acc, taking windows wholly
+// within the range from given level if written and the rest from
+// the level below
+int rollup_agg_range(struct dblog_rollup *ru, int level, int64_t from_ts,
+      int64_t to_ts, struct dblog_rollup_window *acc) {
+  if (from_ts > to_ts)
+    return DBLOG_RES_OK;
+  if (level < 0)
+    return rollup_scan(ru, -1, from_ts, to_ts, rollup_acc_fn, acc);
+  struct dblog_rollup_level *lv = &ru->levels[level];
+  int64_t first = rollup_window_of(lv, from_ts);
+  if (first < from_ts)
+    first += lv->window_secs;
+  int64_t end = rollup_window_of(lv, to_ts);
+  if (to_ts - end == lv->window_secs - 1)
+    end += lv->window_secs;
+  int64_t written_end = rollup_written_end(lv);
+  if (end > written_end)
+    end = written_end;
+  if (first >= end)
+    return rollup_agg_range(ru, level - 1, from_ts, to_ts, acc);
+  int res = rollup_agg_range(ru, level - 1, from_ts, first - 1, acc);
+  if (!res)
+    res = rollup_scan(ru, level, first, end - lv->window_secs, rollup_acc_fn, acc);
+  if (!res)
+    res = rollup_agg_range(ru, level - 1, end, to_ts, acc);
+  return res;
+}
+
+// See .h file for API description
+int dblog_rollup_agg(struct dblog_rollup *ru, int col, int64_t from_ts,
+      int64_t to_ts, struct dblog_rollup_agg *agg) {
+  memset(agg, '\0', sizeof(struct dblog_rollup_agg));
+  if (col < 0 || col >= ru->col_count)
+    return DBLOG_RES_ERR;
+  ru->rows_read = 0;
+  struct dblog_rollup_window acc;
+  acc.count = 0;
+  int res = rollup_agg_range(ru, ru->level_count - 1, from_ts, to_ts, &acc);
+  if (res || !acc.count)
+    return res;
+  agg->count = acc.count;
+  agg->min = acc.min[col];
+  agg->max = acc.max[col];
+  agg->sum = acc.sum[col];
+  agg->last = acc.last[col];
+  return DBLOG_RES_OK;
+}
+
+// Groups windows of level below into windows of a level for
+// those not yet written to the level
+struct rollup_group {
+  struct dblog_rollup_level *lv;
+  struct dblog_rollup_window acc;
+  dblog_rollup_window_fn window_fn;
+  void *arg;
+};
+
+int rollup_group_fn(struct dblog_rollup *ru, struct dblog_rollup_window *win,
+      uint32_t window_secs, void *arg) {
+  (void) window_secs;
+  struct rollup_group *grp = (struct rollup_group *) arg;
+  int64_t start = rollup_window_of(grp->lv, win->start);
+  if (grp->acc.count && start != grp->acc.start) {
+    int res = grp->window_fn(ru, &grp->acc, grp->lv->window_secs, grp->arg);
+    if (res)
+      return res;
+    grp->acc.count = 0;
+  }
+  grp->acc.start = start;
+  rollup_merge(ru, &grp->acc, win);
+  return DBLOG_RES_OK;
+}
+
+// Calls window_fn for windows of given level starting from from_ts
+// to to_ts, forming those not yet written from the level below
+int rollup_windows(struct dblog_rollup *ru, int level, int64_t from_ts,
+      int64_t to_ts, dblog_rollup_window_fn window_fn, void *arg) {
+  if (level < 0)
+    return rollup_scan(ru, -1, from_ts, to_ts, window_fn, arg);
+  struct dblog_rollup_level *lv = &ru->levels[level];
+  int64_t written_end = rollup_written_end(lv);
+  if (written_end != INT64_MIN) {
+    int res = rollup_scan(ru, level, from_ts,
+                to_ts < written_end ? to_ts : written_end - 1, window_fn, arg);
+    if (res || to_ts < written_end)
+      return res;
+  }
+  struct rollup_group grp;
+  grp.lv = lv;
+  grp.acc.count = 0;
+  grp.window_fn = window_fn;
+  grp.arg = arg;
+  int64_t first = rollup_window_of(lv, from_ts);
+  if (first < from_ts)
+    first += lv->window_secs;
+  int res = rollup_windows(ru, level - 1, first > written_end ? first : written_end,
+          rollup_window_of(lv, to_ts) + lv->window_secs - 1, rollup_group_fn, &grp);
+  if (!res && grp.acc.count)
+    res = window_fn(ru, &grp.acc, lv->window_secs, arg);
+  return res;
+}
+
+// See .h file for API description
+int dblog_rollup_series(struct dblog_rollup *ru, int64_t from_ts, int64_t to_ts,
+      uint32_t resolution_secs, dblog_rollup_window_fn window_fn, void *arg) {
+  int level = ru->level_count - 1;
+  while (level >= 0 && ru->levels[level].window_secs > resolution_secs)
+    level--;
+  ru->rows_read = 0;
+  return rollup_windows(ru, level, from_ts, to_ts, window_fn, arg);
+}
@@ -0,0 +1,150 @@
+/*
+  Sqlite Micro Logger - rollup levels
+
+  Keeps downsampled companion databases of a time series as rows
+  are appended, such as one row per minute and one per hour for data
+  logged every second.  Each level is a separate database of the same
+  format, written by its own write context, having one row per window:
+
+    window start, row count, and for each rolled up column
+    min, max, avg and last value
+
+  Level 0 is formed from the rows appended and each level above from
+  the windows of the level below, so that only the last window of
+  each level is held in memory, for example:
+
+    int cols[] = {1, 2};
+    struct dblog_rollup_level levels[2];
+    memset(levels, '\0', sizeof(levels));
+    levels[0].wctx = &min_wctx;   // col_count DBLOG_ROLLUP_COL_COUNT(2)
+    levels[0].rctx = &min_rctx;   // buf and read_fn for the same file
+    levels[0].window_secs = 60;
+    levels[1].wctx = &hour_wctx;
+    levels[1].rctx = &hour_rctx;
+    levels[1].window_secs = 3600;
+    struct dblog_rollup ru;
+    memset(&ru, '\0', sizeof(ru));
+    ru.wctx = &wctx;    // rows as logged
+    ru.rctx = &rctx;
+    ru.ts_col_idx = 0;
+    ru.cols = cols;
+    ru.col_count = 2;
+    ru.levels = levels;
+    ru.level_count = 2;
+    dblog_rollup_open(&ru);   // after write contexts are initialized or resumed
+    ...
+    dblog_rollup_append(&ru, types, values, lengths);
+
+  Queries read the coarsest level having windows wholly within the
+  range and only go to finer levels and the rows as logged at the edges
+  of the range, so the no. of rows read does not grow with the length
+  of the range.  Rows are expected in time order, with time in seconds.
+*/
+
+#ifndef __ULOG_ROLLUP__
+#define __ULOG_ROLLUP__
+
+#include "ulog_sqlite.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Maximum no. of rolled up columns and levels
+#define DBLOG_ROLLUP_MAX_COLS 8
+#define DBLOG_ROLLUP_MAX_LEVELS 4
+
+// No. of columns in database of each level for given no. of rolled up columns
+#define DBLOG_ROLLUP_COL_COUNT(col_count) (2 + 4 * (col_count))
+
+// Window of a level, as held in memory or read from its database
+struct dblog_rollup_window {
+  int64_t start;
+  uint32_t count;     // rows as logged in the window
+  double min[DBLOG_ROLLUP_MAX_COLS];
+  double max[DBLOG_ROLLUP_MAX_COLS];
+  double sum[DBLOG_ROLLUP_MAX_COLS]; // avg * count when read from database
+  double last[DBLOG_ROLLUP_MAX_COLS];
+};
+
+struct dblog_rollup_level {
+  struct dblog_write_context *wctx; // Initialized with col_count of
+                      //   DBLOG_ROLLUP_COL_COUNT(col_count) and own buf
+  struct dblog_read_context *rctx; // buf and read_fn for the same database
+  uint32_t window_secs; // Multiple of window_secs of level below
+  // following are running values used internally
+  struct dblog_rollup_window cur; // window being formed, if cur.count
+  int64_t next_start; // end of last window written, INT64_MIN if none
+  struct dblog_snapshot snap; // for wctx if its snapshot is not given
+};
+
+struct dblog_rollup {
+  struct dblog_write_context *wctx; // Rows as logged
+  struct dblog_read_context *rctx; // buf and read_fn for the same database
+  int ts_col_idx;     // INT column having time in seconds
+  const int *cols;    // Numeric columns to roll up
+  byte col_count;
+  struct dblog_rollup_level *levels; // Finest first
+  byte level_count;
+  // following are running values used internally
+  uint32_t rows_read; // by last query, from all levels
+  struct dblog_snapshot snap; // for wctx if its snapshot is not given
+};
+
+// Aggregate of a column found by dblog_rollup_agg()
+struct dblog_rollup_agg {
+  uint32_t count;
+  double min;
+  double max;
+  double sum;
+  double last;
+};
+
+// Checks the levels and forms the last window of each level again
+// from the level below (or the rows as logged for level 0), as they
+// are held only in memory.  Windows missing in a level due to power
+// loss are also written again.  The write contexts should have been
+// initialized using dblog_write_init(), dblog_init_for_append()
+// or dblog_resume() and are flushed.  The databases are read using
+// dblog_read_snapshot(), so the snapshot of each write context, if not
+// given, is set to one kept in ru or its level
+int dblog_rollup_open(struct dblog_rollup *ru);
+
+// Appends row with given values (as in dblog_append_row_with_values())
+// and adds it to the window of level 0.  Once a row of a later window
+// is appended, the window is written to level 0 and added to the
+// window of level 1 and so on.  Null values are taken as 0
+int dblog_rollup_append(struct dblog_rollup *ru, uint8_t types[],
+      const void *values[], uint16_t lengths[]);
+
+// Flushes rows as logged and all levels
+// Windows being formed are not written
+int dblog_rollup_flush(struct dblog_rollup *ru);
+
+// Finds count, min, max, sum and last value of column cols[col]
+// for rows with time from from_ts to to_ts.  Windows wholly within
+// the range are taken from the coarsest level having them and the
+// rest from finer levels, so the result is same as reading all rows
+// except for rounding of avg.  Databases are flushed first, so this
+// should be called from the task appending rows
+int dblog_rollup_agg(struct dblog_rollup *ru, int col, int64_t from_ts,
+      int64_t to_ts, struct dblog_rollup_agg *agg);
+
+// Called for each window of dblog_rollup_series()
+// Should return 0 to continue, else series stops and value is returned
+typedef int (*dblog_rollup_window_fn)(struct dblog_rollup *ru,
+              struct dblog_rollup_window *win, uint32_t window_secs, void *arg);
+
+// Calls window_fn for windows starting from from_ts to to_ts of the
+// coarsest level having window_secs not more than resolution_secs,
+// followed by its window being formed, if any.  If resolution_secs
+// is less than that of level 0, rows as logged are given as windows
+// of 0 seconds having count 1
+int dblog_rollup_series(struct dblog_rollup *ru, int64_t from_ts, int64_t to_ts,
+      uint32_t resolution_secs, dblog_rollup_window_fn window_fn, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,567 @@
+/*
+  Sqlite Micro Logger - time partitioned shards
+
+  See ulog_shards.h for description
+
+  Manifest file: signature (8), no. of shards (2), unused (2),
+  window_secs (4), sequence no. (4), unused (4), followed by a record
+  of DBLOG_SHARD_REC_LEN bytes for each shard: window_start (8),
+  min_ts (8), max_ts (8), row_count (4), state (1), unused (3)
+  and a checksum (4) of all the bytes before.  Numbers are big endian.
+  Two copies are kept and written alternately, so that the other one
+  is still valid if reset while writing.  The newest valid one is loaded.
+*/
+
+#include "ulog_shards.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define MANIFEST_HDR_LEN 24
+
+const char shard_manifest_sig[] = "ULOGSHRD";
+
+// Read context along with the file it reads from
+struct shard_reader {
+  struct dblog_read_context rctx;
+  FILE *file;
+};
+
+void shard_put_uint16(byte *ptr, uint16_t val) {
+  ptr[0] = val >> 8;
+  ptr[1] = val & 0xFF;
+}
+
+void shard_put_uint32(byte *ptr, uint32_t val) {
+  for (int i = 3; i >= 0; i--, val >>= 8)
+    ptr[i] = val & 0xFF;
+}
+
+void shard_put_int64(byte *ptr, int64_t val) {
+  uint64_t u64 = (uint64_t) val;
+  for (int i = 7; i >= 0; i--, u64 >>= 8)
+    ptr[i] = u64 & 0xFF;
+}
+
+uint16_t shard_get_uint16(const byte *ptr) {
+  return (ptr[0] << 8) | ptr[1];
+}
+
+uint32_t shard_get_uint32(const byte *ptr) {
+  uint32_t ret = 0;
+  for (int i = 0; i < 4; i++)
+    ret = (ret << 8) | ptr[i];
+  return ret;
+}
+
+int64_t shard_get_int64(const byte *ptr) {
+  uint64_t ret = 0;
+  for (int i = 0; i < 8; i++)
+    ret = (ret << 8) | ptr[i];
+  return (int64_t) ret;
+}
+
+int32_t shard_read_fn(struct dblog_write_context *ctx, void *buf, uint32_t pos, size_t len) {
+  FILE *file = ((struct dblog_shard_file *) ctx)->file;
+  if (fseek(file, pos, SEEK_SET))
+    return DBLOG_RES_SEEK_ERR;
+  size_t ret = fread(buf, 1, len, file);
+  if (ret != len)
+    return DBLOG_RES_READ_ERR;
+  return ret;
+}
+
+int32_t shard_write_fn(struct dblog_write_context *ctx, void *buf, uint32_t pos, size_t len) {
+  FILE *file = ((struct dblog_shard_file *) ctx)->file;
+  if (fseek(file, pos, SEEK_SET))
+    return DBLOG_RES_SEEK_ERR;
+  size_t ret = fwrite(buf, 1, len, file);
+  if (ret != len)
+    return DBLOG_RES_WRITE_ERR;
+  return ret;
+}
+
+int shard_flush_fn(struct dblog_write_context *ctx) {
+  if (fflush(((struct dblog_shard_file *) ctx)->file))
+    return DBLOG_RES_FLUSH_ERR;
+  return DBLOG_RES_OK;
+}
+
+int32_t shard_reader_read_fn(struct dblog_read_context *ctx, void *buf, uint32_t pos, size_t len) {
+  FILE *file = ((struct shard_reader *) ctx)->file;
+  if (fseek(file, pos, SEEK_SET))
+    return DBLOG_RES_SEEK_ERR;
+  size_t ret = fread(buf, 1, len, file);
+  if (ret != len)
+    return DBLOG_RES_READ_ERR;
+  return ret;
+}
+
+void shard_set_file_fns(struct dblog_shard_file *sf) {
+  sf->wctx.read_fn = shard_read_fn;
+  sf->wctx.write_fn = shard_write_fn;
+  sf->wctx.flush_fn = shard_flush_fn;
+}
+
+void shard_path(struct dblog_shards *sh, int64_t window_start, char *path) {
+  snprintf(path, DBLOG_SHARD_PATH_MAX, "%s_%lld.db", sh->prefix, (long long) window_start);
+}
+
+void shard_manifest_path(struct dblog_shards *sh, byte copy, char *path) {
+  snprintf(path, DBLOG_SHARD_PATH_MAX, "%s.man%d", sh->prefix, copy);
+}
+
+// Returns start of window having given time, also for negative times
+int64_t shard_window_of(struct dblog_shards *sh, int64_t ts) {
+  int64_t rem = ts % (int64_t) sh->window_secs;
+  if (rem < 0)
+    rem += sh->window_secs;
+  return ts - rem;
+}
+
+// Returns value of INT column as given to append
+int64_t shard_native_int(const void *val, uint16_t len) {
+  switch (len) {
+    case 1:
+      return *((int8_t *) val);
+    case 2:
+      return *((int16_t *) val);
+    case 4:
+      return *((int32_t *) val);
+  }
+  return *((int64_t *) val);
+}
+
+// Returns value of INT column as stored by Sqlite (big endian)
+int64_t shard_stored_int(const byte *val, uint32_t col_type) {
+  if (col_type == 8 || col_type == 9)
+    return col_type - 8;
+  int len = (col_type == 5 ? 6 : (col_type == 6 ? 8 : col_type));
+  int64_t ret = (int8_t) val[0];
+  for (int i = 1; i < len; i++)
+    ret = (ret << 8) | val[i];
+  return ret;
+}
+
+// Updates FNV-1a checksum of manifest with given bytes
+uint32_t shard_chk_sum(uint32_t chk_sum, const byte *buf, int len) {
+  while (len--)
+    chk_sum = (chk_sum ^ *buf++) * 16777619u;
+  return chk_sum;
+}
+
+// Writes all shard records into the older copy of manifest file
+int shard_write_manifest(struct dblog_shards *sh) {
+  char path[DBLOG_SHARD_PATH_MAX];
+  uint32_t seq = sh->manifest_seq + 1;
+  shard_manifest_path(sh, seq % 2, path);
+  FILE *file = fopen(path, "wb");
+  if (!file)
+    return DBLOG_RES_WRITE_ERR;
+  byte rec[DBLOG_SHARD_REC_LEN];
+  memset(rec, '\0', sizeof(rec));
+  memcpy(rec, shard_manifest_sig, 8);
+  shard_put_uint16(rec + 8, sh->shard_count);
+  shard_put_uint32(rec + 12, sh->window_secs);
+  shard_put_uint32(rec + 16, seq);
+  uint32_t chk_sum = shard_chk_sum(2166136261u, rec, MANIFEST_HDR_LEN);
+  int res = DBLOG_RES_OK;
+  if (fwrite(rec, 1, MANIFEST_HDR_LEN, file) != MANIFEST_HDR_LEN)
+    res = DBLOG_RES_WRITE_ERR;
+  for (uint16_t i = 0; i < sh->shard_count && !res; i++) {
+    struct dblog_shard_info *si = &sh->shards[i];
+    memset(rec, '\0', sizeof(rec));
+    shard_put_int64(rec, si->window_start);
+    shard_put_int64(rec + 8, si->min_ts);
+    shard_put_int64(rec + 16, si->max_ts);
+    shard_put_uint32(rec + 24, si->row_count);
+    rec[28] = __atomic_load_n(&si->state, __ATOMIC_ACQUIRE);
+    if (rec[28] == DBLOG_SHARD_FINALIZING)
+      rec[28] = DBLOG_SHARD_CLOSED; // to be finalized again after reset
+    chk_sum = shard_chk_sum(chk_sum, rec, DBLOG_SHARD_REC_LEN);
+    if (fwrite(rec, 1, DBLOG_SHARD_REC_LEN, file) != DBLOG_SHARD_REC_LEN)
+      res = DBLOG_RES_WRITE_ERR;
+  }
+  shard_put_uint32(rec, chk_sum);
+  if (!res && fwrite(rec, 1, 4, file) != 4)
+    res = DBLOG_RES_WRITE_ERR;
+  if (fclose(file) && !res)
+    res = DBLOG_RES_FLUSH_ERR;
+  if (!res)
+    sh->manifest_seq = seq;
+  return res;
+}
+
+// Checks given copy of manifest file and returns its sequence no.
+// in out_seq, loading shard records if load is set
+// Returns DBLOG_RES_NOT_FOUND if the copy does not exist
+int shard_read_manifest_copy(struct dblog_shards *sh, byte copy, byte load,
+      uint32_t *out_seq) {
+  char path[DBLOG_SHARD_PATH_MAX];
+  shard_manifest_path(sh, copy, path);
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return DBLOG_RES_NOT_FOUND;
+  byte rec[DBLOG_SHARD_REC_LEN];
+  int res = DBLOG_RES_OK;
+  if (fread(rec, 1, MANIFEST_HDR_LEN, file) != MANIFEST_HDR_LEN)
+    res = DBLOG_RES_READ_ERR;
+  else if (memcmp(rec, shard_manifest_sig, 8) || shard_get_uint32(rec + 12) != sh->window_secs)
+    res = DBLOG_RES_INVALID_SIG;
+  else if (shard_get_uint16(rec + 8) > sh->max_shards)
+    res = DBLOG_RES_TOO_LONG;
+  uint16_t count = res ? 0 : shard_get_uint16(rec + 8);
+  *out_seq = shard_get_uint32(rec + 16);
+  uint32_t chk_sum = shard_chk_sum(2166136261u, rec, MANIFEST_HDR_LEN);
+  for (uint16_t i = 0; i < count && !res; i++) {
+    if (fread(rec, 1, DBLOG_SHARD_REC_LEN, file) != DBLOG_SHARD_REC_LEN) {
+      res = DBLOG_RES_MALFORMED;
+      break;
+    }
+    chk_sum = shard_chk_sum(chk_sum, rec, DBLOG_SHARD_REC_LEN);
+    if (!load)
+      continue;
+    struct dblog_shard_info *si = &sh->shards[i];
+    si->window_start = shard_get_int64(rec);
+    si->min_ts = shard_get_int64(rec + 8);
+    si->max_ts = shard_get_int64(rec + 16);
+    si->row_count = shard_get_uint32(rec + 24);
+    si->state = rec[28];
+  }
+  if (!res && (fread(rec, 1, 4, file) != 4 || shard_get_uint32(rec) != chk_sum))
+    res = DBLOG_RES_INV_CHKSUM;
+  fclose(file);
+  if (!res && load)
+    sh->shard_count = count;
+  return res;
+}
+
+// Loads shard records from the newest valid copy of manifest file,
+// if any exists
+int shard_read_manifest(struct dblog_shards *sh) {
+  sh->shard_count = 0;
+  sh->manifest_seq = 0;
+  uint32_t seq[2];
+  int res0 = shard_read_manifest_copy(sh, 0, 0, &seq[0]);
+  int res1 = shard_read_manifest_copy(sh, 1, 0, &seq[1]);
+  if (res0 && res1) {
+    // If only one copy exists and is not valid, the first write of
+    // manifest was cut short, before any shard was noted
+    if (res0 == DBLOG_RES_NOT_FOUND || res1 == DBLOG_RES_NOT_FOUND)
+      return DBLOG_RES_OK;
+    return res0;
+  }
+  byte copy = (res0 || (!res1 && seq[1] > seq[0])) ? 1 : 0;
+  int res = shard_read_manifest_copy(sh, copy, 1, &sh->manifest_seq);
+  if (res)
+    sh->shard_count = 0;
+  return res;
+}
+
+// Flushes and closes the current shard, if any
+int shard_close_cur(struct dblog_shards *sh) {
+  if (!sh->cur.file)
+    return DBLOG_RES_OK;
+  int res = dblog_flush(&sh->cur.wctx);
+  if (fclose(sh->cur.file) && !res)
+    res = DBLOG_RES_FLUSH_ERR;
+  sh->cur.file = NULL;
+  __atomic_store_n(&sh->shards[sh->shard_count - 1].state,
+                   DBLOG_SHARD_CLOSED, __ATOMIC_RELEASE);
+  return res;
+}
+
+// Opens shard file of given window as current shard, continuing
+// with it using dblog_resume() if it exists, so that rows written
+// to it are never lost by creating it again
+int shard_open_file(struct dblog_shards *sh, int64_t window_start) {
+  char path[DBLOG_SHARD_PATH_MAX];
+  shard_path(sh, window_start, path);
+  sh->cur.file = fopen(path, "r+b");
+  byte exists = (sh->cur.file != NULL);
+  if (!exists)
+    sh->cur.file = fopen(path, "w+b");
+  if (!sh->cur.file)
+    return DBLOG_RES_WRITE_ERR;
+  shard_set_file_fns(&sh->cur);
+  int res = exists ? dblog_resume(&sh->cur.wctx) : dblog_write_init(&sh->cur.wctx);
+  if (res) {
+    fclose(sh->cur.file);
+    sh->cur.file = NULL;
+  }
+  return res;
+}
+
+// Takes row count and time of the last row from the shard opened and
+// if it has rows, widens the time range to the whole window as rows
+// written after the last manifest write are not in the range noted
+void shard_set_resumed_range(struct dblog_shards *sh, struct dblog_shard_info *si) {
+  si->row_count = sh->cur.wctx.cur_write_rowid;
+  sh->last_ts = INT64_MIN;
+  uint32_t col_type;
+  const byte *val = (const byte *) dblog_get_col_val(&sh->cur.wctx, sh->ts_col_idx, &col_type);
+  if (si->row_count && val && col_type >= 1 && col_type <= 9 && col_type != 7)
+    sh->last_ts = shard_stored_int(val, col_type);
+  if (si->row_count) {
+    if (si->min_ts > si->window_start)
+      si->min_ts = si->window_start;
+    if (si->max_ts < si->window_start + sh->window_secs - 1)
+      si->max_ts = si->window_start + sh->window_secs - 1;
+  }
+}
+
+// Creates shard for given window and makes it current
+// A file left without manifest entry (such as on reset before
+// the manifest was written) is continued and not created again
+int shard_new(struct dblog_shards *sh, int64_t window_start) {
+  if (sh->shard_count >= sh->max_shards)
+    return DBLOG_RES_TOO_LONG;
+  int res = shard_open_file(sh, window_start);
+  if (res)
+    return res;
+  struct dblog_shard_info *si = &sh->shards[sh->shard_count];
+  si->window_start = window_start;
+  si->min_ts = INT64_MAX;
+  si->max_ts = INT64_MIN;
+  si->state = DBLOG_SHARD_OPEN;
+  shard_set_resumed_range(sh, si);
+  sh->shard_count++;
+  return shard_write_manifest(sh);
+}
+
+// Makes the last shard current again after it was closed, such as
+// by dblog_shards_close() before reset, for rows of its window
+// Returns DBLOG_RES_ERR if it is finalized or being finalized
+int shard_reopen_last(struct dblog_shards *sh) {
+  struct dblog_shard_info *si = &sh->shards[sh->shard_count - 1];
+  byte state = DBLOG_SHARD_CLOSED;
+  if (!__atomic_compare_exchange_n(&si->state, &state, DBLOG_SHARD_OPEN, 0,
+        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    return DBLOG_RES_ERR;
+  int res = shard_open_file(sh, si->window_start);
+  if (res) {
+    __atomic_store_n(&si->state, DBLOG_SHARD_CLOSED, __ATOMIC_RELEASE);
+    return res;
+  }
+  shard_set_resumed_range(sh, si);
+  return shard_write_manifest(sh);
+}
+
+// See .h file for API description
+int dblog_shards_open(struct dblog_shards *sh) {
+  if (!sh->window_secs || !sh->max_shards)
+    return DBLOG_RES_ERR;
+  sh->cur.file = NULL;
+  int res = shard_read_manifest(sh);
+  if (res || !sh->shard_count)
+    return res;
+  struct dblog_shard_info *si = &sh->shards[sh->shard_count - 1];
+  if (si->state != DBLOG_SHARD_OPEN)
+    return DBLOG_RES_OK;
+  res = shard_open_file(sh, si->window_start);
+  if (res)
+    return res;
+  shard_set_resumed_range(sh, si);
+  return DBLOG_RES_OK;
+}
+
+// See .h file for API description
+int dblog_shards_append(struct dblog_shards *sh, uint8_t types[],
+      const void *values[], uint16_t lengths[]) {
+  int col = sh->ts_col_idx;
+  if (types[col] != DBLOG_TYPE_INT || !values[col])
+    return DBLOG_RES_TYPE_MISMATCH;
+  int64_t ts = shard_native_int(values[col], lengths[col]);
+  int64_t window_start = shard_window_of(sh, ts);
+  int res;
+  if (sh->shard_count && window_start < sh->shards[sh->shard_count - 1].window_start)
+    return DBLOG_RES_ERR;
+  if (!sh->cur.file && sh->shard_count
+        && window_start == sh->shards[sh->shard_count - 1].window_start) {
+    res = shard_reopen_last(sh);
+    if (res)
+      return res;
+  } else
+  if (!sh->cur.file || window_start > sh->shards[sh->shard_count - 1].window_start) {
+    res = shard_close_cur(sh);
+    if (res)
+      return res;
+    res = shard_new(sh, window_start);
+    if (res)
+      return res;
+  }
+  // Time is the scan key, so a row older than the last one
+  // could not be found by dblog_shards_scan()
+  if (ts < sh->last_ts)
+    return DBLOG_RES_ERR;
+  res = dblog_append_row_with_values(&sh->cur.wctx, types, values, lengths);
+  if (res)
+    return res;
+  sh->last_ts = ts;
+  struct dblog_shard_info *si = &sh->shards[sh->shard_count - 1];
+  si->row_count++;
+  if (ts < si->min_ts)
+    si->min_ts = ts;
+  if (ts > si->max_ts)
+    si->max_ts = ts;
+  return DBLOG_RES_OK;
+}
+
+// See .h file for API description
+int dblog_shards_flush(struct dblog_shards *sh) {
+  if (sh->cur.file) {
+    int res = dblog_flush(&sh->cur.wctx);
+    if (res)
+      return res;
+  }
+  return shard_write_manifest(sh);
+}
+
+// See .h file for API description
+int dblog_shards_close(struct dblog_shards *sh) {
+  int res = shard_close_cur(sh);
+  if (res)
+    return res;
+  return shard_write_manifest(sh);
+}
+
+// See .h file for API description
+int dblog_shards_finalize_closed(struct dblog_shards *sh) {
+  int count = 0;
+  struct dblog_write_context *cfg = &sh->cur.wctx;
+  for (uint16_t i = 0; i < sh->shard_count; i++) {
+    struct dblog_shard_info *si = &sh->shards[i];
+    // claimed so that it is not reopened for appending meanwhile
+    byte state = DBLOG_SHARD_CLOSED;
+    if (!__atomic_compare_exchange_n(&si->state, &state, DBLOG_SHARD_FINALIZING,
+          0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      continue;
+    char path[DBLOG_SHARD_PATH_MAX];
+    shard_path(sh, si->window_start, path);
+    struct dblog_shard_file *sf = &sh->fin;
+    sf->file = fopen(path, "r+b");
+    if (!sf->file) {
+      __atomic_store_n(&si->state, DBLOG_SHARD_CLOSED, __ATOMIC_RELEASE);
+      return DBLOG_RES_READ_ERR;
+    }
+    // Only config is taken from the writer of the current shard
+    memset(&sf->wctx, '\0', sizeof(sf->wctx));
+    sf->wctx.buf = sh->fin_buf;
+    sf->wctx.col_count = cfg->col_count;
+    sf->wctx.page_size_exp = cfg->page_size_exp;
+    sf->wctx.max_pages_exp = cfg->max_pages_exp;
+    sf->wctx.page_resv_bytes = cfg->page_resv_bytes;
+    sf->wctx.erase_block_exp = cfg->erase_block_exp;
+    sf->wctx.zone_cols = cfg->zone_cols;
+    sf->wctx.zone_col_count = cfg->zone_col_count;
+    sf->wctx.bloom_cols = cfg->bloom_cols;
+    sf->wctx.bloom_col_count = cfg->bloom_col_count;
+    sf->wctx.bloom_bytes = cfg->bloom_bytes;
+    sf->wctx.agg_cols = cfg->agg_cols;
+    sf->wctx.agg_col_count = cfg->agg_col_count;
+    shard_set_file_fns(sf);
+    int res = dblog_recover(&sf->wctx);
+    if (fclose(sf->file) && !res)
+      res = DBLOG_RES_FLUSH_ERR;
+    sf->file = NULL;
+    __atomic_store_n(&si->state, res ? DBLOG_SHARD_CLOSED : DBLOG_SHARD_FINALIZED,
+                     __ATOMIC_RELEASE);
+    if (res)
+      return res;
+    count++;
+  }
+  return count;
+}
+
+// See .h file for API description
+int dblog_shards_remove_oldest(struct dblog_shards *sh) {
+  if (!sh->shard_count || (sh->shard_count == 1 && sh->cur.file))
+    return DBLOG_RES_NOT_FOUND;
+  char path[DBLOG_SHARD_PATH_MAX];
+  shard_path(sh, sh->shards[0].window_start, path);
+  if (remove(path))
+    return DBLOG_RES_WRITE_ERR;
+  sh->shard_count--;
+  memmove(sh->shards, sh->shards + 1, sh->shard_count * sizeof(struct dblog_shard_info));
+  return shard_write_manifest(sh);
+}
+
+// Scans rows of given shard in the time range
+int shard_scan(struct dblog_shards *sh, struct dblog_shard_info *si,
+      int64_t from_ts, int64_t to_ts, struct dblog_pred *preds, byte pred_count,
+      byte *buf, dblog_shard_row_fn row_fn, void *arg) {
+  char path[DBLOG_SHARD_PATH_MAX];
+  shard_path(sh, si->window_start, path);
+  struct shard_reader sr;
+  memset(&sr, '\0', sizeof(sr));
+  sr.file = fopen(path, "rb");
+  if (!sr.file)
+    return DBLOG_RES_READ_ERR;
+  sr.rctx.buf = buf;
+  sr.rctx.read_fn = shard_reader_read_fn;
+  int res = dblog_read_init(&sr.rctx);
+  if (res) {
+    fclose(sr.file);
+    return res;
+  }
+  struct dblog_scan scan;
+  memset(&scan, '\0', sizeof(scan));
+  scan.key_col_idx = sh->ts_col_idx;
+  scan.key_type = DBLOG_TYPE_INT;
+  scan.key_to = &to_ts;
+  scan.key_to_len = 8;
+  scan.preds = preds;
+  scan.pred_count = pred_count;
+  // Shards not yet finalized cannot be searched for the start,
+  // so they are read from the beginning with time as condition
+  struct dblog_pred all_preds[pred_count + 1];
+  if (si->state == DBLOG_SHARD_FINALIZED || si->min_ts >= from_ts) {
+    if (si->state == DBLOG_SHARD_FINALIZED) {
+      scan.key_from = &from_ts;
+      scan.key_from_len = 8;
+    }
+  } else {
+    memcpy(all_preds, preds, pred_count * sizeof(struct dblog_pred));
+    struct dblog_pred *ts_pred = &all_preds[pred_count];
+    memset(ts_pred, '\0', sizeof(struct dblog_pred));
+    ts_pred->col_idx = sh->ts_col_idx;
+    ts_pred->op = DBLOG_OP_GE;
+    ts_pred->val_type = DBLOG_TYPE_INT;
+    ts_pred->val = &from_ts;
+    ts_pred->len = 8;
+    scan.preds = all_preds;
+    scan.pred_count = pred_count + 1;
+  }
+  res = dblog_scan_first(&sr.rctx, &scan);
+  while (res == DBLOG_RES_OK) {
+    res = row_fn(sh, &sr.rctx, arg);
+    if (res)
+      break;
+    res = dblog_scan_next(&sr.rctx, &scan);
+  }
+  fclose(sr.file);
+  return res == DBLOG_RES_NOT_FOUND ? DBLOG_RES_OK : res;
+}
+
+// See .h file for API description
+int dblog_shards_scan(struct dblog_shards *sh, int64_t from_ts, int64_t to_ts,
+      struct dblog_pred *preds, byte pred_count, byte *buf,
+      dblog_shard_row_fn row_fn, void *arg) {
+  sh->shards_scanned = 0;
+  if (sh->cur.file) {
+    int res = dblog_flush(&sh->cur.wctx);
+    if (res)
+      return res;
+  }
+  for (uint16_t i = 0; i < sh->shard_count; i++) {
+    struct dblog_shard_info *si = &sh->shards[i];
+    if (!si->row_count || si->max_ts < from_ts || si->min_ts > to_ts)
+      continue;
+    sh->shards_scanned++;
+    int res = shard_scan(sh, si, from_ts, to_ts, preds, pred_count,
+                buf, row_fn, arg);
+    if (res)
+      return res;
+  }
+  return DBLOG_RES_OK;
+}
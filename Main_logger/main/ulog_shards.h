@@ -0,0 +1,147 @@
+/*
+  Sqlite Micro Logger - time partitioned shards
+
+  Rows are written to a new database file for every time window
+  (such as an hour or a day) so that finalize, recovery and removal
+  of old data work on one small file instead of the whole history.
+  Each file (shard) is named <prefix>_<window start>.db and a small
+  manifest file keeps the time range, row count and state of each shard
+  so that range queries only open the shards overlapping the range.
+  Two copies of the manifest (<prefix>.man0 and <prefix>.man1) are
+  written alternately so that one is intact if reset while writing.
+  For example:
+
+    struct dblog_shards sh;
+    memset(&sh, '\0', sizeof(sh));
+    sh.prefix = "/spiffs/temp";
+    sh.window_secs = 3600;
+    sh.ts_col_idx = 0;
+    sh.shards = shard_infos;   // array of 48 struct dblog_shard_info
+    sh.max_shards = 48;
+    sh.cur.wctx.buf = page_buf;
+    sh.cur.wctx.col_count = 3;
+    sh.cur.wctx.page_size_exp = 12;
+    dblog_shards_open(&sh);
+    ...
+    dblog_shards_append(&sh, types, values, lengths);
+
+  When a row falls in a new window, the current shard is only flushed
+  and closed.  Closed shards are finalized by dblog_shards_finalize_closed(),
+  which can be called from a low priority task with its own buffer so
+  that appending does not wait for interior pages to be formed.
+  Only the current shard, the manifest and a shard being finalized
+  or read are open at a time.
+*/
+
+#ifndef __ULOG_SHARDS__
+#define __ULOG_SHARDS__
+
+#include <stdio.h>
+#include "ulog_sqlite.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Maximum length of shard file name including prefix
+#define DBLOG_SHARD_PATH_MAX 64
+
+// Length of each shard record in manifest file
+#define DBLOG_SHARD_REC_LEN 32
+
+// DBLOG_SHARD_FINALIZING is held only in memory while
+// dblog_shards_finalize_closed() works on the shard
+enum {DBLOG_SHARD_OPEN = 0, DBLOG_SHARD_CLOSED, DBLOG_SHARD_FINALIZED,
+  DBLOG_SHARD_FINALIZING};
+
+// Manifest entry of a shard
+struct dblog_shard_info {
+  int64_t window_start; // Start of time window, multiple of window_secs
+  int64_t min_ts;     // Lowest and highest time of rows in shard
+  int64_t max_ts;
+  uint32_t row_count;
+  byte state;         // DBLOG_SHARD_OPEN, _CLOSED, _FINALIZED or _FINALIZING
+};
+
+// Write context along with the file it writes to
+struct dblog_shard_file {
+  struct dblog_write_context wctx;
+  FILE *file;
+};
+
+struct dblog_shards {
+  const char *prefix; // Path and name prefix of shard and manifest files
+  uint32_t window_secs; // Time window of each shard, say 3600 or 86400
+  int ts_col_idx;     // INT column having time in seconds
+  struct dblog_shard_file cur; // Config fields of cur.wctx (buf, col_count,
+                      //   page_size_exp, page_resv_bytes, summary columns)
+                      //   are used for every shard.  Callbacks are set here
+  struct dblog_shard_info *shards; // Array for manifest, oldest first
+  uint16_t max_shards; // Size of shards array
+  byte *fin_buf;      // Page size buffer for dblog_shards_finalize_closed()
+  // following are running values used internally
+  uint16_t shard_count;
+  uint16_t shards_scanned; // by last dblog_shards_scan()
+  int64_t last_ts;    // time of last row in current shard
+  uint32_t manifest_seq; // sequence no. of manifest last read or written
+  struct dblog_shard_file fin;
+};
+
+// Loads manifest, if present, and continues with the latest shard if
+// still open (such as after reset), using dblog_resume()
+int dblog_shards_open(struct dblog_shards *sh);
+
+// Appends row with given values (as in dblog_append_row_with_values())
+// to the shard of the time in column ts_col_idx, first closing
+// the current shard and creating a new one if the time is of a later window.
+// If the last shard was closed (such as by dblog_shards_close() before
+// reset), it is opened again for rows of its window
+// Rows should be appended in time order, as time is used as scan key.
+// Returns DBLOG_RES_ERR, without storing the row, if its time is before
+// that of the last row appended (or before the window of the last shard),
+// or if the last shard is to be opened again but is already finalized
+// or being finalized
+// Returns DBLOG_RES_TOO_LONG if a new shard is needed and the manifest
+// is full, in which case dblog_shards_remove_oldest() can be used
+int dblog_shards_append(struct dblog_shards *sh, uint8_t types[],
+      const void *values[], uint16_t lengths[]);
+
+// Flushes current shard and writes manifest
+int dblog_shards_flush(struct dblog_shards *sh);
+
+// Flushes and closes current shard and writes manifest
+// Closed shards still need dblog_shards_finalize_closed()
+int dblog_shards_close(struct dblog_shards *sh);
+
+// Finalizes all closed shards using fin_buf and marks them finalized
+// May be called from a task other than the one appending,
+// but not along with dblog_shards_remove_oldest().  The new
+// state is written to the manifest with the next flush or new shard
+// Returns no. of shards finalized or error
+int dblog_shards_finalize_closed(struct dblog_shards *sh);
+
+// Deletes the file of the oldest shard and removes it from manifest
+// The current shard is not removed
+int dblog_shards_remove_oldest(struct dblog_shards *sh);
+
+// Called for each row of dblog_shards_scan() with rctx at the row
+// Should return 0 to continue, else scan stops and value is returned
+typedef int (*dblog_shard_row_fn)(struct dblog_shards *sh,
+              struct dblog_read_context *rctx, void *arg);
+
+// Calls row_fn for rows with time from from_ts to to_ts matching
+// preds (as in struct dblog_scan), opening only shards overlapping
+// the range, oldest first.  buf should be of page size
+// Time is used as scan key, so rows within a shard
+// are expected in time order
+// The current shard is flushed first, so this should be called
+// from the task appending rows
+int dblog_shards_scan(struct dblog_shards *sh, int64_t from_ts, int64_t to_ts,
+      struct dblog_pred *preds, byte pred_count, byte *buf,
+      dblog_shard_row_fn row_fn, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
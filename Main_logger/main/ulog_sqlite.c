@@ -27,9 +27,28 @@
 #include "ulog_sqlite.h"
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <math.h>
 #include <string.h>
 #include <stdio.h>
 
+#if DBLOG_CFG_ASYNC_WRITE
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#else
+#include <pthread.h>
+#endif
+#endif
+
+#if DBLOG_CFG_MMAP_READ
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #define LEN_OF_REC_LEN 3
 #define LEN_OF_HDR_LEN 2
 #define CHKSUM_LEN 3
@@ -37,6 +56,48 @@
 enum {DBLOG_ST_WRITE_NOT_PENDING = 0xA4, DBLOG_ST_WRITE_PENDING, 
         DBLOG_ST_TO_RECOVER, DBLOG_ST_FINAL};
 
+// Flags stored in first page at offset 70 (part of App ID)
+#define DBLOG_PG1_FLAGS_POS 70
+#define DBLOG_PG1_SPINE 0x01 // Finalized using spine_buf
+#define DBLOG_PG1_REUSE 0x02 // Ring formed by dblog_drop_oldest()
+
+// spine_height when spine_buf cannot be used in this session
+#define DBLOG_SPINE_OFF 0xFF
+
+// Tail marker stored in the reserved space of first page
+// 4 byte page no., 4 byte last rowid in the page and checksum
+#define DBLOG_PG1_TAIL_POS 80
+#define DBLOG_TAIL_MARK_LEN 9
+
+// Oldest leaf page when max_pages_exp is used and
+// writing has wrapped around, or oldest pages were dropped, 0 otherwise
+#define DBLOG_PG1_FIRST_LEAF_POS 72
+
+// erase_block_exp used for writing, which decides first leaf page
+#define DBLOG_PG1_ERASE_BLOCK_POS 76
+
+// State record kept using state_write_fn, DBLOG_STATE_REC_LEN bytes
+// flags, page_size_exp, max_pages_exp, erase_block_exp,
+// 4 byte page no. and 4 byte last rowid in it (tail marker if open,
+// else last leaf page), 4 byte first_leaf_page and checksum
+#define DBLOG_STATE_OPEN 0x01
+#define DBLOG_STATE_REUSE 0x02 // same as DBLOG_PG1_REUSE
+
+// Page no. + 1 (0 if empty) and last use of each slot in cache_buf
+#define DBLOG_CACHE_SLOT_HDR 8
+
+// Summary of leaf page kept in its reserved bytes
+// Signature, length of sections and checksum of sections
+// followed by sections of kind, column index, length and data
+#define DBLOG_SUMM_SIG 0xA7
+#define DBLOG_SUMM_HDR_LEN 4
+#define DBLOG_SUMM_ZONE 1 // serial type, min and max
+#define DBLOG_ZONE_DATA_LEN 17
+#define DBLOG_SUMM_BLOOM 2 // bloom_bytes of bits
+#define DBLOG_BLOOM_HASHES 3
+#define DBLOG_SUMM_AGG 3 // same as zone followed by count and sum
+#define DBLOG_AGG_DATA_LEN 27
+
 // Returns how many bytes the given integer will
 // occupy if stored as a variable integer
 int8_t get_vlen_of_uint16(uint16_t vint) {
@@ -228,6 +289,51 @@ byte *locate_column(byte *rec_ptr, int col_idx, byte **pdata_ptr,
   return hdr_ptr;
 }
 
+// Returns integer value stored with given serial type, sign extended
+int64_t read_int_val(byte *ptr, uint32_t col_type) {
+  if (col_type == 9)
+    return 1;
+  if (col_type < 1 || col_type > 6)
+    return 0;
+  int len = col_type < 5 ? col_type : (col_type == 5 ? 6 : 8);
+  int64_t ret = (int8_t) *ptr++; // sign from the first byte
+  while (--len)
+    ret = (ret << 8) | *ptr++;
+  return ret;
+}
+
+// Reads Row ID into col_types[0] and serial type and data position
+// of columns 0 to max_col of the record at given position of the leaf
+// page in buf into col_types[1..] and col_ptrs[1..], walking the
+// record header once.  Columns not in the record are taken as null
+int read_rec_cols(byte *buf, uint16_t rec_idx, int32_t limit, int max_col,
+      uint32_t col_types[], byte *col_ptrs[]) {
+  int8_t vlen;
+  uint16_t rec_pos = read_uint16(buf + 8 + rec_idx * 2);
+  if (rec_pos < 8 || rec_pos >= limit)
+    return DBLOG_RES_MALFORMED;
+  byte *hdr_ptr = buf + rec_pos + LEN_OF_REC_LEN;
+  col_types[0] = read_vint32(hdr_ptr, &vlen);
+  hdr_ptr += vlen;
+  byte *data_ptr = hdr_ptr + read_vint16(hdr_ptr, &vlen);
+  byte *hdr_end = data_ptr;
+  hdr_ptr += vlen;
+  for (int c = 0; c <= max_col; c++) {
+    if (hdr_ptr < hdr_end && *hdr_ptr < 0x80)
+      col_types[c + 1] = *hdr_ptr++; // usual single byte type
+    else if (hdr_ptr < hdr_end) {
+      col_types[c + 1] = read_vint32(hdr_ptr, &vlen);
+      hdr_ptr += vlen;
+    } else
+      col_types[c + 1] = 0; // null if not in record
+    col_ptrs[c + 1] = data_ptr;
+    data_ptr += dblog_derive_data_len(col_types[c + 1]);
+    if (data_ptr - buf > limit)
+      return DBLOG_RES_MALFORMED;
+  }
+  return DBLOG_RES_OK;
+}
+
 // Returns type of column based on given value and length
 // See https://www.sqlite.org/fileformat.html#record_format
 uint32_t derive_col_type_or_len(int type, const void *val, int len) {
@@ -409,6 +515,424 @@ int write_page(struct dblog_write_context *wctx, uint32_t page_no, int32_t page_
   return DBLOG_RES_OK;
 }
 
+// Checksum of tail marker or state record,
+// never 0 for a marker that was not written
+uint8_t tail_mark_chk_sum(byte *mark, int len) {
+  uint8_t chk_sum = 0xA5;
+  for (int i = 0; i < len; i++)
+    chk_sum += mark[i];
+  return chk_sum;
+}
+
+// Writes the state record with given flags, page no. and its last rowid
+int write_state_rec(struct dblog_write_context *wctx, byte flags,
+      uint32_t page_no, uint32_t rowid) {
+  byte rec[DBLOG_STATE_REC_LEN];
+  rec[0] = flags | (wctx->ring_reuse ? DBLOG_STATE_REUSE : 0);
+  rec[1] = wctx->page_size_exp;
+  rec[2] = wctx->max_pages_exp;
+  rec[3] = wctx->erase_block_exp;
+  write_uint32(rec + 4, page_no);
+  write_uint32(rec + 8, rowid);
+  write_uint32(rec + 12, wctx->first_leaf_page);
+  rec[16] = tail_mark_chk_sum(rec, 16);
+  if ((wctx->state_write_fn)(wctx, rec, DBLOG_STATE_REC_LEN) != DBLOG_STATE_REC_LEN)
+    return DBLOG_RES_WRITE_ERR;
+  return DBLOG_RES_OK;
+}
+
+// Reads the state record into rec, returns DBLOG_RES_NOT_FOUND
+// if state_read_fn is not given or the record is not valid
+int read_state_rec(struct dblog_write_context *wctx, byte *rec) {
+  if (!wctx->state_read_fn
+        || (wctx->state_read_fn)(wctx, rec, DBLOG_STATE_REC_LEN) != DBLOG_STATE_REC_LEN
+        || rec[16] != tail_mark_chk_sum(rec, 16))
+    return DBLOG_RES_NOT_FOUND;
+  return DBLOG_RES_OK;
+}
+
+// Notes given page and its last rowid in wctx->snapshot, if given,
+// for readers in other tasks.  seq is odd while the values change
+void publish_snapshot(struct dblog_write_context *wctx, uint32_t page_no, uint32_t rowid) {
+  struct dblog_snapshot *snap = wctx->snapshot;
+  if (!snap)
+    return;
+  uint32_t seq = __atomic_load_n(&snap->seq, __ATOMIC_RELAXED);
+  __atomic_store_n(&snap->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&snap->last_page, page_no, __ATOMIC_RELAXED);
+  __atomic_store_n(&snap->last_rowid, rowid, __ATOMIC_RELAXED);
+  __atomic_store_n(&snap->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+// Returns no. of leaf pages in the ring for given max_pages_exp, 0 if no max
+uint32_t get_ring_pages(byte max_pages_exp) {
+  return max_pages_exp ? (uint32_t) 1 << max_pages_exp : 0;
+}
+
+// Called after given pages are written to disk
+// Once DBLOG_CFG_TAIL_MARK_INTERVAL pages are written after the page
+// last noted, flushes them and notes the last leaf page among them
+// in the first page (or the state record if state_write_fn is given),
+// so that recovery need not look at pages before it
+// The marker itself is flushed along with the pages that follow
+int mark_tail(struct dblog_write_context *wctx, byte *pages,
+      uint32_t first_page, byte count, int32_t page_size) {
+#if DBLOG_CFG_TAIL_MARK_INTERVAL
+  byte *buf = pages + count * page_size;
+  uint32_t page_no = first_page + count;
+  do {
+    if (!count--)
+      return DBLOG_RES_OK; // no leaf page
+    buf -= page_size;
+    page_no--;
+  } while (*buf != 13);
+  // Distance is counted around the ring if max_pages_exp is used,
+  // as page_no wraps around to the first leaf page
+  uint32_t ring_pages = get_ring_pages(wctx->max_pages_exp);
+  uint32_t interval = DBLOG_CFG_TAIL_MARK_INTERVAL;
+  if (ring_pages && interval >= ring_pages)
+    interval = ring_pages / 2;
+  if (ring_pages ? (page_no + ring_pages - wctx->tail_mark_page % ring_pages)
+                      % ring_pages < interval
+        : page_no < wctx->tail_mark_page + interval)
+    return DBLOG_RES_OK;
+  if (wctx->flush_fn(wctx))
+    return DBLOG_RES_FLUSH_ERR;
+  byte mark[DBLOG_TAIL_MARK_LEN];
+  int8_t vlen;
+  write_uint32(mark, page_no);
+  write_uint32(mark + 4, read_vint32(buf + read_uint16(buf + 5) + LEN_OF_REC_LEN, &vlen));
+  wctx->tail_mark_page = page_no;
+  publish_snapshot(wctx, page_no, read_uint32(mark + 4));
+  if (wctx->state_write_fn)
+    return write_state_rec(wctx, DBLOG_STATE_OPEN, page_no, read_uint32(mark + 4));
+  mark[8] = tail_mark_chk_sum(mark, 8);
+  if ((wctx->write_fn)(wctx, mark, DBLOG_PG1_TAIL_POS, DBLOG_TAIL_MARK_LEN)
+        != DBLOG_TAIL_MARK_LEN)
+    return DBLOG_RES_WRITE_ERR;
+#endif
+  return DBLOG_RES_OK;
+}
+
+// Writes pages gathered in the staging area, if any,
+// using a single call to the given callback function
+int flush_staged_pages(struct dblog_write_context *wctx) {
+  if (!wctx->stage_count)
+    return DBLOG_RES_OK;
+  int32_t page_size = get_pagesize(wctx->page_size_exp);
+  byte count = wctx->stage_count;
+  int32_t len = count * page_size;
+  wctx->stage_count = 0;
+  if ((wctx->write_fn)(wctx, wctx->stage_buf,
+         wctx->stage_first_page * page_size, len) != len)
+    return DBLOG_RES_WRITE_ERR;
+  return mark_tail(wctx, wctx->stage_buf, wctx->stage_first_page, count, page_size);
+}
+
+// Writes a full page to disk, or if staging area is available,
+// copies it there to be written along with the pages that follow
+int store_page(struct dblog_write_context *wctx, byte *page_buf,
+      uint32_t page_no, int32_t page_size) {
+  if (!wctx->stage_pages) {
+    check_sums(page_buf, page_size, 0);
+    if ((wctx->write_fn)(wctx, page_buf, page_no * page_size, page_size) != page_size)
+      return DBLOG_RES_WRITE_ERR;
+    return mark_tail(wctx, page_buf, page_no, 1, page_size);
+  }
+  int res;
+  if (wctx->stage_count && page_no != wctx->stage_first_page + wctx->stage_count) {
+    res = flush_staged_pages(wctx);
+    if (res)
+      return res;
+  }
+  if (!wctx->stage_count)
+    wctx->stage_first_page = page_no;
+  check_sums(page_buf, page_size, 0);
+  memcpy(wctx->stage_buf + wctx->stage_count * page_size, page_buf, page_size);
+  wctx->stage_count++;
+  if (wctx->stage_count == wctx->stage_pages)
+    return flush_staged_pages(wctx);
+  return DBLOG_RES_OK;
+}
+
+#if DBLOG_CFG_ASYNC_WRITE
+
+#ifndef DBLOG_CFG_ASYNC_STACK_SIZE
+#define DBLOG_CFG_ASYNC_STACK_SIZE 4096
+#endif
+#ifndef DBLOG_CFG_ASYNC_PRIORITY
+#define DBLOG_CFG_ASYNC_PRIORITY 5
+#endif
+
+// State shared between appending task and writer task
+// busy is set while page_buf is being written
+struct dblog_async_writer {
+  struct dblog_write_context *wctx;
+  byte *page_buf;
+  uint32_t page_no;
+  byte busy;
+  byte stop;
+  int res; // first error from writer task
+#ifdef ESP_PLATFORM
+  TaskHandle_t task;
+  SemaphoreHandle_t idle;
+  SemaphoreHandle_t work;
+#else
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+#endif
+};
+
+#ifdef ESP_PLATFORM
+
+// Waits till page_buf is free and returns error from writer task, if any
+// page_buf stays owned by the caller till async_post() or async_release()
+int async_acquire(struct dblog_async_writer *aw) {
+  xSemaphoreTake(aw->idle, portMAX_DELAY);
+  return aw->res;
+}
+
+void async_release(struct dblog_async_writer *aw) {
+  xSemaphoreGive(aw->idle);
+}
+
+// Hands over page_buf to writer task
+void async_post(struct dblog_async_writer *aw) {
+  aw->busy = 1;
+  xSemaphoreGive(aw->work);
+}
+
+// Waits in the writer task for a page or request to stop
+// Returns 0 if writer task should stop
+int async_wait_for_work(struct dblog_async_writer *aw) {
+  xSemaphoreTake(aw->work, portMAX_DELAY);
+  return aw->busy;
+}
+
+void async_work_done(struct dblog_async_writer *aw) {
+  aw->busy = 0;
+  xSemaphoreGive(aw->idle);
+}
+
+#else
+
+int async_acquire(struct dblog_async_writer *aw) {
+  pthread_mutex_lock(&aw->lock);
+  while (aw->busy)
+    pthread_cond_wait(&aw->cond, &aw->lock);
+  int res = aw->res;
+  pthread_mutex_unlock(&aw->lock);
+  return res;
+}
+
+void async_release(struct dblog_async_writer *aw) {
+  (void) aw; // lock is held only inside async_acquire()
+}
+
+void async_post(struct dblog_async_writer *aw) {
+  pthread_mutex_lock(&aw->lock);
+  aw->busy = 1;
+  pthread_cond_broadcast(&aw->cond);
+  pthread_mutex_unlock(&aw->lock);
+}
+
+int async_wait_for_work(struct dblog_async_writer *aw) {
+  pthread_mutex_lock(&aw->lock);
+  while (!aw->busy && !aw->stop)
+    pthread_cond_wait(&aw->cond, &aw->lock);
+  int busy = aw->busy;
+  pthread_mutex_unlock(&aw->lock);
+  return busy;
+}
+
+void async_work_done(struct dblog_async_writer *aw) {
+  pthread_mutex_lock(&aw->lock);
+  aw->busy = 0;
+  pthread_cond_broadcast(&aw->cond);
+  pthread_mutex_unlock(&aw->lock);
+}
+
+#endif
+
+// Writer task - writes pages handed over by write_full_page()
+#ifdef ESP_PLATFORM
+void async_writer_task(void *arg) {
+#else
+void *async_writer_task(void *arg) {
+#endif
+  struct dblog_async_writer *aw = (struct dblog_async_writer *) arg;
+  int32_t page_size = get_pagesize(aw->wctx->page_size_exp);
+  while (async_wait_for_work(aw)) {
+    int res = store_page(aw->wctx, aw->page_buf, aw->page_no, page_size);
+    if (res && !aw->res)
+      aw->res = res;
+    async_work_done(aw);
+  }
+#ifdef ESP_PLATFORM
+  xSemaphoreGive(aw->idle);
+  vTaskDelete(NULL);
+#else
+  return NULL;
+#endif
+}
+
+// See .h file for API description
+int dblog_async_start(struct dblog_write_context *wctx, byte *page_buf) {
+  if (wctx->async_writer)
+    return DBLOG_RES_ERR;
+  struct dblog_async_writer *aw = calloc(1, sizeof(struct dblog_async_writer));
+  if (!aw)
+    return DBLOG_RES_ERR;
+  aw->wctx = wctx;
+  aw->page_buf = page_buf;
+#ifdef ESP_PLATFORM
+  aw->idle = xSemaphoreCreateBinary();
+  aw->work = xSemaphoreCreateBinary();
+  if (aw->idle && aw->work) {
+    xSemaphoreGive(aw->idle);
+    if (xTaskCreate(async_writer_task, "dblog_writer", DBLOG_CFG_ASYNC_STACK_SIZE,
+          aw, DBLOG_CFG_ASYNC_PRIORITY, &aw->task) == pdPASS) {
+      wctx->async_writer = aw;
+      return DBLOG_RES_OK;
+    }
+  }
+  if (aw->idle)
+    vSemaphoreDelete(aw->idle);
+  if (aw->work)
+    vSemaphoreDelete(aw->work);
+#else
+  pthread_mutex_init(&aw->lock, NULL);
+  pthread_cond_init(&aw->cond, NULL);
+  if (!pthread_create(&aw->thread, NULL, async_writer_task, aw)) {
+    wctx->async_writer = aw;
+    return DBLOG_RES_OK;
+  }
+  pthread_cond_destroy(&aw->cond);
+  pthread_mutex_destroy(&aw->lock);
+#endif
+  free(aw);
+  return DBLOG_RES_ERR;
+}
+
+// See .h file for API description
+int dblog_async_stop(struct dblog_write_context *wctx) {
+  struct dblog_async_writer *aw = wctx->async_writer;
+  if (!aw)
+    return DBLOG_RES_OK;
+  int res = async_acquire(aw);
+#ifdef ESP_PLATFORM
+  aw->stop = 1;
+  xSemaphoreGive(aw->work);
+  xSemaphoreTake(aw->idle, portMAX_DELAY); // given by task before exiting
+  vSemaphoreDelete(aw->idle);
+  vSemaphoreDelete(aw->work);
+#else
+  pthread_mutex_lock(&aw->lock);
+  aw->stop = 1;
+  pthread_cond_broadcast(&aw->cond);
+  pthread_mutex_unlock(&aw->lock);
+  pthread_join(aw->thread, NULL);
+  pthread_cond_destroy(&aw->cond);
+  pthread_mutex_destroy(&aw->lock);
+#endif
+  free(aw);
+  wctx->async_writer = NULL;
+  return res;
+}
+
+#endif
+
+// Writes a full page, handing it over to writer task if started
+// The page is copied so that caller can continue with page_buf
+int write_full_page(struct dblog_write_context *wctx, byte *page_buf,
+      uint32_t page_no, int32_t page_size) {
+#if DBLOG_CFG_ASYNC_WRITE
+  struct dblog_async_writer *aw = wctx->async_writer;
+  if (aw) {
+    int res = async_acquire(aw);
+    if (res) {
+      async_release(aw);
+      return res;
+    }
+    memcpy(aw->page_buf, page_buf, page_size);
+    aw->page_no = page_no;
+    async_post(aw);
+    return DBLOG_RES_OK;
+  }
+#endif
+  return store_page(wctx, page_buf, page_no, page_size);
+}
+
+// Waits for pages being written by writer task
+// and writes pages gathered in staging area
+int write_pending_pages(struct dblog_write_context *wctx) {
+#if DBLOG_CFG_ASYNC_WRITE
+  struct dblog_async_writer *aw = wctx->async_writer;
+  if (aw) {
+    int res = async_acquire(aw);
+    async_release(aw);
+    if (res)
+      return res;
+  }
+#endif
+  return flush_staged_pages(wctx);
+}
+
+// Returns the page from which leaf pages start, which is 1 unless
+// pages are aligned to erase blocks larger than a page
+// This is also the no. of pages erased together by erase_fn
+uint32_t get_leaf_base_page(byte erase_block_exp, byte page_size_exp) {
+  if (erase_block_exp <= page_size_exp)
+    return 1;
+  return (uint32_t) 1 << (erase_block_exp - page_size_exp);
+}
+
+// Returns page at given position (1 based) counting from the oldest
+// page first_leaf_page, wrapping around if max_pages_exp is used
+uint32_t get_ring_leaf_page(uint32_t first_leaf_page, uint32_t idx,
+      uint32_t leaf_base, uint32_t ring_pages) {
+  if (!ring_pages)
+    return first_leaf_page + idx - 1;
+  return (first_leaf_page - leaf_base + idx - 1) % ring_pages + leaf_base;
+}
+
+// Returns no. of leaf pages from the oldest to the latest page
+uint32_t get_leaf_count(uint32_t first_leaf_page, uint32_t last_leaf_page,
+      uint32_t ring_pages) {
+  if (!ring_pages)
+    return last_leaf_page - first_leaf_page + 1;
+  return (last_leaf_page + ring_pages - first_leaf_page) % ring_pages + 1;
+}
+
+// Erases count erase blocks using erase_fn, starting from_block blocks
+// after the block of the page being written, wrapping around if
+// max_pages_exp is used.  Once the erased blocks wrap around, the oldest
+// page is the first page of the block after the last one erased
+int erase_ahead(struct dblog_write_context *wctx, int32_t page_size,
+      uint32_t from_block, uint32_t count) {
+  if (!wctx->erase_fn || !wctx->erase_block_exp)
+    return DBLOG_RES_OK;
+  uint32_t block_pages = get_leaf_base_page(wctx->erase_block_exp, wctx->page_size_exp);
+  uint32_t ring_blocks = get_ring_pages(wctx->max_pages_exp) / block_pages;
+  uint32_t block = (wctx->cur_write_page - block_pages) / block_pages + from_block;
+  while (count--) {
+    if (ring_blocks && block >= ring_blocks) {
+      block -= ring_blocks;
+      if (!wctx->first_leaf_page)
+        wctx->first_leaf_page = block_pages; // wrapped around
+    }
+    if (wctx->erase_fn(wctx, (block + 1) * block_pages * page_size,
+                       block_pages * page_size))
+      return DBLOG_RES_WRITE_ERR;
+    block++;
+    if (ring_blocks && wctx->first_leaf_page)
+      wctx->first_leaf_page = (block % ring_blocks + 1) * block_pages;
+  }
+  return DBLOG_RES_OK;
+}
+
 // Reads specified number of bytes from disk using the given callback function
 // for Write context
 int read_bytes_wctx(struct dblog_write_context *wctx, byte *buf, long pos, int32_t size) {
@@ -417,9 +941,157 @@ int read_bytes_wctx(struct dblog_write_context *wctx, byte *buf, long pos, int32
   return DBLOG_RES_OK;
 }
 
+// Moves to the next page of a ring formed by dblog_drop_oldest(),
+// wrapping around over the pages dropped.  Once none is left, the ring
+// is doubled instead of overwriting the oldest page, copying the pages
+// that wrapped around to the new half so that they follow the rest.
+// The new ring size is noted along with the tail marker in the first
+// page (or the state record) once the copies are flushed.
+// wctx->buf is overwritten
+int next_reuse_page(struct dblog_write_context *wctx, int32_t page_size) {
+  uint32_t leaf_base = get_leaf_base_page(wctx->erase_block_exp, wctx->page_size_exp);
+  uint32_t ring_pages = get_ring_pages(wctx->max_pages_exp);
+  uint32_t page_no = get_ring_leaf_page(wctx->cur_write_page, 2, leaf_base, ring_pages);
+  if (page_no != wctx->first_leaf_page) {
+    wctx->cur_write_page = page_no;
+    return DBLOG_RES_OK;
+  }
+  if (wctx->max_pages_exp >= 31)
+    return DBLOG_RES_TOO_LONG;
+  int res = write_pending_pages(wctx);
+  if (res)
+    return res;
+  uint32_t rowid = read_vint32(wctx->buf + read_uint16(wctx->buf + 5)
+                                + LEN_OF_REC_LEN, NULL);
+  uint32_t wrapped = wctx->first_leaf_page - leaf_base;
+  for (uint32_t i = 0; i < wrapped; i++) {
+    res = read_bytes_wctx(wctx, wctx->buf, (leaf_base + i) * page_size, page_size);
+    if (res)
+      return res;
+    if ((wctx->write_fn)(wctx, wctx->buf, (leaf_base + ring_pages + i) * page_size,
+          page_size) != page_size)
+      return DBLOG_RES_WRITE_ERR;
+  }
+  if (wctx->flush_fn(wctx))
+    return DBLOG_RES_FLUSH_ERR;
+  wctx->max_pages_exp++;
+  wctx->cur_write_page = leaf_base + ring_pages + wrapped;
+  page_no = wctx->cur_write_page - 1;
+  wctx->tail_mark_page = page_no;
+  wctx->last_leaf_written = page_no;
+  if (wctx->state_write_fn)
+    res = write_state_rec(wctx, DBLOG_STATE_OPEN, page_no, rowid);
+  else {
+    // ring size, oldest page, erase_block_exp and tail marker
+    byte hdr[DBLOG_PG1_TAIL_POS + DBLOG_TAIL_MARK_LEN - 71];
+    memset(hdr, '\0', sizeof(hdr));
+    hdr[0] = wctx->max_pages_exp;
+    write_uint32(hdr + DBLOG_PG1_FIRST_LEAF_POS - 71, wctx->first_leaf_page);
+    hdr[DBLOG_PG1_ERASE_BLOCK_POS - 71] = wctx->erase_block_exp;
+    byte *mark = hdr + DBLOG_PG1_TAIL_POS - 71;
+    write_uint32(mark, page_no);
+    write_uint32(mark + 4, rowid);
+    mark[8] = tail_mark_chk_sum(mark, 8);
+    if ((wctx->write_fn)(wctx, hdr, 71, sizeof(hdr)) != sizeof(hdr))
+      res = DBLOG_RES_WRITE_ERR;
+  }
+  if (res)
+    return res;
+  if (wctx->flush_fn(wctx))
+    return DBLOG_RES_FLUSH_ERR;
+  publish_snapshot(wctx, page_no, rowid);
+  return DBLOG_RES_OK;
+}
+
+// Moves to the next page to be written, wrapping around to overwrite
+// the oldest page if max_pages_exp is used
+// Erases the block DBLOG_CFG_ERASE_AHEAD blocks ahead on entering a block
+int next_write_page(struct dblog_write_context *wctx, int32_t page_size) {
+  if (wctx->ring_reuse)
+    return next_reuse_page(wctx, page_size);
+  uint32_t leaf_base = get_leaf_base_page(wctx->erase_block_exp, wctx->page_size_exp);
+  uint32_t ring_pages = get_ring_pages(wctx->max_pages_exp);
+  if (ring_pages && wctx->cur_write_page >= leaf_base + ring_pages - 1) {
+    wctx->cur_write_page = leaf_base;
+    if (!wctx->first_leaf_page)
+      wctx->first_leaf_page = leaf_base; // wrapped around
+  } else
+    wctx->cur_write_page++;
+  if (wctx->erase_fn && wctx->erase_block_exp) {
+    if ((wctx->cur_write_page - leaf_base) % leaf_base == 0)
+      return erase_ahead(wctx, page_size, DBLOG_CFG_ERASE_AHEAD, 1);
+  } else if (ring_pages && wctx->first_leaf_page)
+    wctx->first_leaf_page = get_ring_leaf_page(wctx->cur_write_page, 2,
+                              leaf_base, ring_pages);
+  return DBLOG_RES_OK;
+}
+
 // Reads specified number of bytes from disk using the given callback function
 // for Read context
+// Returns given page from cache_buf, reading it using read_fn into
+// the least recently used slot if not found.  Slots having interior
+// pages are replaced only if all slots have interior pages
+// Returns NULL if the page could not be read
+byte *read_cached_page(struct dblog_read_context *rctx, uint32_t page_no, int32_t page_size) {
+  byte *pages = rctx->cache_buf + rctx->cache_pages * DBLOG_CACHE_SLOT_HDR;
+  int victim = 0;
+  int64_t victim_rank = INT64_MAX;
+  for (int i = 0; i < rctx->cache_pages; i++) {
+    byte *hdr = rctx->cache_buf + i * DBLOG_CACHE_SLOT_HDR;
+    uint32_t slot_page = read_uint32(hdr);
+    if (slot_page == page_no + 1) {
+      write_uint32(hdr + 4, ++rctx->cache_tick);
+      rctx->cache_hits++;
+      return pages + i * page_size;
+    }
+    int64_t rank = slot_page == 0 ? -1 : read_uint32(hdr + 4)
+                     + (pages[i * page_size] == 5 ? ((int64_t) 1 << 32) : 0);
+    if (rank < victim_rank) {
+      victim = i;
+      victim_rank = rank;
+    }
+  }
+  byte *hdr = rctx->cache_buf + victim * DBLOG_CACHE_SLOT_HDR;
+  byte *page = pages + victim * page_size;
+  rctx->cache_misses++;
+  if ((rctx->read_fn)(rctx, page, page_no * page_size, page_size) != page_size) {
+    write_uint32(hdr, 0);
+    return NULL;
+  }
+  write_uint32(hdr, page_no + 1);
+  write_uint32(hdr + 4, ++rctx->cache_tick);
+  return page;
+}
+
+// Removes given page from cache_buf, if present
+void uncache_page(struct dblog_read_context *rctx, uint32_t page_no) {
+  for (int i = 0; i < rctx->cache_pages; i++) {
+    byte *hdr = rctx->cache_buf + i * DBLOG_CACHE_SLOT_HDR;
+    if (read_uint32(hdr) == page_no + 1)
+      write_uint32(hdr, 0);
+  }
+}
+
+// Reads from the mapped file, or from cache_buf if used
+// and the range is within a page
 int read_bytes_rctx(struct dblog_read_context *rctx, byte *buf, long pos, int32_t size) {
+#if DBLOG_CFG_MMAP_READ
+  if (rctx->map) {
+    if ((size_t) pos + size > rctx->map_len)
+      return DBLOG_RES_READ_ERR;
+    memcpy(buf, rctx->map + pos, size);
+    return DBLOG_RES_OK;
+  }
+#endif
+  if (rctx->cache_pages && rctx->page_size_exp
+        && (pos >> rctx->page_size_exp) == ((pos + size - 1) >> rctx->page_size_exp)) {
+    int32_t page_size = get_pagesize(rctx->page_size_exp);
+    byte *page = read_cached_page(rctx, pos >> rctx->page_size_exp, page_size);
+    if (!page)
+      return DBLOG_RES_READ_ERR;
+    memcpy(buf, page + (pos & (page_size - 1)), size);
+    return DBLOG_RES_OK;
+  }
   if ((rctx->read_fn)(rctx, buf, pos, size) != size)
     return DBLOG_RES_READ_ERR;
   return DBLOG_RES_OK;
@@ -435,7 +1107,7 @@ int add_rec_to_inner_tbl(struct dblog_write_context *wctx, byte *parent_buf,
   byte rec_len = 4 + get_vlen_of_uint32(rowid);
 
   if (last_pos == 0)
-    last_pos = page_size - rec_len;
+    last_pos = page_size - wctx->page_resv_bytes - rec_len;
   else {
     // 3 is for checksum
     if (last_pos - rec_len < 12 + rec_count * 2 + get_vlen_of_uint32(rowid) + 3)
@@ -463,6 +1135,332 @@ int add_rec_to_inner_tbl(struct dblog_write_context *wctx, byte *parent_buf,
 
 }
 
+// Returns 1 if interior pages are formed as leaf pages are written
+int is_spine_active(struct dblog_write_context *wctx) {
+  return wctx->spine_levels && wctx->spine_height != DBLOG_SPINE_OFF;
+}
+
+// Removes last record of given interior page and
+// makes the page it points to as right most pointer
+// The Row ID is kept after the cell pointers as done by dblog_finalize()
+void close_inner_page(byte *buf) {
+  uint16_t rec_count = read_uint16(buf + 3) - 1;
+  uint16_t last_pos = read_uint16(buf + 12 + rec_count * 2);
+  write_uint32(buf + 8, read_uint32(buf + last_pos));
+  write_vint32(buf + 12 + rec_count * 2, read_vint32(buf + last_pos + 4, NULL));
+  write_uint16(buf + 3, rec_count);
+  write_uint16(buf + 5, rec_count ? read_uint16(buf + 12 + (rec_count - 1) * 2) : 0);
+}
+
+// Moves the right most child of the interior page prev_page_no,
+// written just before, to the last interior page of the same level
+// being formed in wctx->buf having only child_pos, as Sqlite does not
+// accept an interior page left without any cell once it is closed
+int move_child_to_last_inner_page(struct dblog_write_context *wctx,
+      int32_t page_size, uint32_t prev_page_no, uint32_t child_pos, uint32_t rowid) {
+  int res = read_bytes_wctx(wctx, wctx->buf, (long) prev_page_no * page_size, page_size);
+  if (res)
+    return res;
+  uint32_t moved_pos = read_uint32(wctx->buf + 8) - 1;
+  uint32_t moved_rowid = read_vint32(wctx->buf + 12
+                           + read_uint16(wctx->buf + 3) * 2, NULL);
+  close_inner_page(wctx->buf);
+  res = write_page(wctx, prev_page_no, page_size);
+  if (res)
+    return res;
+  init_bt_tbl_inner(wctx->buf);
+  add_rec_to_inner_tbl(wctx, wctx->buf, moved_rowid, moved_pos);
+  add_rec_to_inner_tbl(wctx, wctx->buf, rowid, child_pos);
+  return DBLOG_RES_OK;
+}
+
+// Adds given page to the right most interior page at given level
+// If the interior page becomes full, it is written as the next page
+// and added to the level above, and so on
+int spine_add(struct dblog_write_context *wctx, byte level,
+      uint32_t child_pos, uint32_t rowid, int32_t page_size) {
+  while (1) {
+    if (level >= wctx->spine_levels)
+      return DBLOG_RES_TOO_LONG;
+    byte *buf = wctx->spine_buf + level * page_size;
+    if (level == wctx->spine_height) {
+      init_bt_tbl_inner(buf);
+      wctx->spine_height++;
+    }
+    if (!add_rec_to_inner_tbl(wctx, buf, rowid, child_pos))
+      return DBLOG_RES_OK;
+    int res = next_write_page(wctx, page_size);
+    if (res)
+      return res;
+    res = write_full_page(wctx, buf, wctx->cur_write_page, page_size);
+    if (res)
+      return res;
+    init_bt_tbl_inner(buf);
+    child_pos = wctx->cur_write_page;
+    level++;
+  }
+}
+
+// Fletcher-16 checksum of page summary sections
+uint16_t summary_chk_sum(byte *buf, int len) {
+  uint16_t sum1 = 0;
+  uint16_t sum2 = 0;
+  while (len--) {
+    sum1 = (sum1 + *buf++) % 255;
+    sum2 = (sum2 + sum1) % 255;
+  }
+  return (sum2 << 8) | sum1;
+}
+
+// Stores given double as Sqlite's Big-endian double
+void write_double(byte *ptr, double dval) {
+  uint64_t bits;
+  memcpy(&bits, &dval, 8);
+  write_uint64(ptr, bits);
+}
+
+// Reads Sqlite's Big-endian double
+double read_double(byte *ptr) {
+  uint64_t bits = read_uint64(ptr);
+  double dval;
+  memcpy(&dval, &bits, 8);
+  return dval;
+}
+
+// Returns numeric value stored with given serial type as double
+// or Row ID if is_rowid
+double read_num_val(byte *val_at, uint32_t u32_at, byte is_rowid) {
+  if (is_rowid)
+    return u32_at;
+  if (u32_at == 7)
+    return read_double(val_at);
+  return (double) read_int_val(val_at, u32_at);
+}
+
+// FNV-1a hash of value for Bloom filter.  Numbers are hashed
+// as integer if they are whole, so that 5 and 5.0 are same,
+// as they are equal for dblog_scan_first()
+uint32_t bloom_hash(const byte *val, uint16_t len, byte is_num, double dval) {
+  byte num_buf[9];
+  if (is_num) {
+    num_buf[0] = 'n';
+    // conversion is undefined for NaN, Inf or out of range values
+    if (isfinite(dval) && fabs(dval) < 9.2e18 && dval == (double) (int64_t) dval)
+      write_uint64(num_buf + 1, (uint64_t) (int64_t) dval);
+    else
+      write_double(num_buf + 1, dval);
+    val = num_buf;
+    len = 9;
+  }
+  uint32_t hash = 2166136261U;
+  while (len--)
+    hash = (hash ^ *val++) * 16777619U;
+  return hash;
+}
+
+// Sets or checks bits of given hash in Bloom filter of given bytes
+// Returns 1 if all bits were set
+int bloom_bits(byte *bits, byte bloom_bytes, uint32_t hash, byte to_set) {
+  uint32_t nbits = bloom_bytes * 8;
+  uint32_t h2 = (hash >> 17) | (hash << 15) | 1;
+  int all_set = 1;
+  for (int i = 0; i < DBLOG_BLOOM_HASHES; i++) {
+    uint32_t bit = (hash + i * h2) % nbits;
+    if (!(bits[bit >> 3] & (1 << (bit & 7))))
+      all_set = 0;
+    if (to_set)
+      bits[bit >> 3] |= (1 << (bit & 7));
+  }
+  return all_set;
+}
+
+// Returns Bloom filter hash of the value stored with given serial type
+// Integers and whole reals are hashed as integers, text and blob
+// as bytes, with 1 bit set in is_any if the value is NaN
+uint32_t bloom_hash_at(byte *val_at, uint32_t col_type, byte *is_any) {
+  if (col_type >= 12)
+    return bloom_hash(val_at, dblog_derive_data_len(col_type), 0, 0);
+  double dval = read_num_val(val_at, col_type, 0);
+  if (dval != dval)
+    *is_any = 1;
+  return bloom_hash(NULL, 0, 1, dval);
+}
+
+// Returns no. of reserved bytes needed for page summary
+int summary_resv_len(struct dblog_write_context *wctx) {
+  if (!wctx->zone_col_count && !wctx->bloom_col_count && !wctx->agg_col_count)
+    return 0;
+  return DBLOG_SUMM_RESV_LEN(wctx->zone_col_count)
+           + DBLOG_BLOOM_RESV_LEN(wctx->bloom_col_count, wctx->bloom_bytes)
+           + DBLOG_AGG_RESV_LEN(wctx->agg_col_count);
+}
+
+// Forms summary of the leaf page in buf into its reserved bytes
+// A zone section is kept for each of zone_cols having serial type 6
+// if all numeric values are integers, 7 if any is real and 0 if none,
+// followed by min and max stored as that type.  If a real is NaN,
+// infinite min and max are kept so that the page is never skipped
+// A Bloom section is kept for each of bloom_cols having bits set
+// for the values of the column (all bits if any is NaN)
+// An aggregate section is kept for each of agg_cols, having the same
+// data as zone section followed by count of numeric values and their
+// sum, stored with the serial type
+void write_page_summary(struct dblog_write_context *wctx, byte *buf, int32_t page_size) {
+  byte zone_count = wctx->zone_col_count;
+  int count = zone_count + wctx->agg_col_count; // zone_cols then agg_cols
+  int resv_len = summary_resv_len(wctx);
+  if (!resv_len || wctx->page_resv_bytes < resv_len
+        || (wctx->bloom_col_count && !wctx->bloom_bytes))
+    return;
+  int32_t limit = page_size - wctx->page_resv_bytes;
+  byte *summ = buf + limit;
+  int max_col = 0;
+  byte num_cols[count + 1];
+  for (int i = 0; i < count; i++) {
+    num_cols[i] = i < zone_count ? wctx->zone_cols[i] : wctx->agg_cols[i - zone_count];
+    if (num_cols[i] > max_col)
+      max_col = num_cols[i];
+  }
+  for (int i = 0; i < wctx->bloom_col_count; i++) {
+    if (wctx->bloom_cols[i] > max_col)
+      max_col = wctx->bloom_cols[i];
+  }
+  byte *bloom = summ + DBLOG_SUMM_RESV_LEN(zone_count);
+  byte bloom_sec_len = 3 + wctx->bloom_bytes;
+  byte bloom_any[wctx->bloom_col_count + 1];
+  memset(bloom_any, '\0', wctx->bloom_col_count + 1);
+  for (int i = 0; i < wctx->bloom_col_count; i++)
+    memset(bloom + i * bloom_sec_len + 3, '\0', wctx->bloom_bytes);
+  uint32_t col_types[max_col + 2];
+  byte *col_ptrs[max_col + 2];
+  int64_t imin[count + 1], imax[count + 1], isum[count + 1];
+  double dmin[count + 1], dmax[count + 1], dsum[count + 1];
+  uint16_t num_count[count + 1];
+  byte seen[count + 1]; // 1 = integer, 2 = real, 4 = NaN
+  memset(seen, '\0', count + 1);
+  memset(num_count, '\0', (count + 1) * sizeof(uint16_t));
+  uint16_t rec_count = read_uint16(buf + 3);
+  for (uint16_t rec_idx = 0; rec_idx < rec_count; rec_idx++) {
+    if (read_rec_cols(buf, rec_idx, limit, max_col, col_types, col_ptrs)) {
+      summ[0] = 0; // page is not summarized
+      return;
+    }
+    for (int i = 0; i < count; i++) {
+      uint32_t col_type = col_types[num_cols[i] + 1];
+      byte *val_at = col_ptrs[num_cols[i] + 1];
+      if (col_type == 7) {
+        double dval = read_double(val_at);
+        if (dval != dval)
+          seen[i] |= 4;
+        if (!(seen[i] & 2) || dval < dmin[i])
+          dmin[i] = dval;
+        if (!(seen[i] & 2) || dval > dmax[i])
+          dmax[i] = dval;
+        dsum[i] = (seen[i] & 2) ? dsum[i] + dval : dval;
+        seen[i] |= 2;
+        num_count[i]++;
+      } else if (col_type >= 1 && col_type <= 9) {
+        int64_t ival = read_int_val(val_at, col_type);
+        if (!(seen[i] & 1) || ival < imin[i])
+          imin[i] = ival;
+        if (!(seen[i] & 1) || ival > imax[i])
+          imax[i] = ival;
+        isum[i] = (seen[i] & 1) ? isum[i] + ival : ival;
+        seen[i] |= 1;
+        num_count[i]++;
+      }
+    }
+    for (int i = 0; i < wctx->bloom_col_count; i++) {
+      uint32_t col_type = col_types[wctx->bloom_cols[i] + 1];
+      if (col_type == 0 || col_type == 10 || col_type == 11)
+        continue; // null never equals a value
+      uint32_t hash = bloom_hash_at(col_ptrs[wctx->bloom_cols[i] + 1], col_type, &bloom_any[i]);
+      bloom_bits(bloom + i * bloom_sec_len + 3, wctx->bloom_bytes, hash, 1);
+    }
+  }
+  byte *ptr = summ + DBLOG_SUMM_HDR_LEN;
+  byte *agg_ptr = bloom + wctx->bloom_col_count * bloom_sec_len;
+  for (int i = 0; i < count; i++) {
+    if (i == zone_count)
+      ptr = agg_ptr;
+    byte data_len = i < zone_count ? DBLOG_ZONE_DATA_LEN : DBLOG_AGG_DATA_LEN;
+    ptr[0] = i < zone_count ? DBLOG_SUMM_ZONE : DBLOG_SUMM_AGG;
+    ptr[1] = num_cols[i];
+    ptr[2] = data_len;
+    memset(ptr + 3, '\0', data_len);
+    if (seen[i] & 4) {
+      dmin[i] = -HUGE_VAL;
+      dmax[i] = HUGE_VAL;
+    }
+    if (seen[i] & 2) {
+      if ((seen[i] & 1) && imin[i] < dmin[i])
+        dmin[i] = imin[i];
+      if ((seen[i] & 1) && imax[i] > dmax[i])
+        dmax[i] = imax[i];
+      if (seen[i] & 1)
+        dsum[i] += isum[i];
+      ptr[3] = 7;
+      write_double(ptr + 4, dmin[i]);
+      write_double(ptr + 12, dmax[i]);
+      if (i >= zone_count)
+        write_double(ptr + 22, dsum[i]);
+    } else if (seen[i] & 1) {
+      ptr[3] = 6;
+      write_uint64(ptr + 4, (uint64_t) imin[i]);
+      write_uint64(ptr + 12, (uint64_t) imax[i]);
+      if (i >= zone_count)
+        write_uint64(ptr + 22, (uint64_t) isum[i]);
+    }
+    if (i >= zone_count)
+      write_uint16(ptr + 20, num_count[i]);
+    ptr += 3 + data_len;
+  }
+  if (count == zone_count)
+    ptr = agg_ptr;
+  for (int i = 0; i < wctx->bloom_col_count; i++) {
+    byte *sec = bloom + i * bloom_sec_len;
+    sec[0] = DBLOG_SUMM_BLOOM;
+    sec[1] = wctx->bloom_cols[i];
+    sec[2] = wctx->bloom_bytes;
+    if (bloom_any[i])
+      memset(sec + 3, '\xFF', wctx->bloom_bytes);
+  }
+  byte len = ptr - summ - DBLOG_SUMM_HDR_LEN;
+  summ[0] = DBLOG_SUMM_SIG;
+  summ[1] = len;
+  write_uint16(summ + 2, summary_chk_sum(summ + DBLOG_SUMM_HDR_LEN, len));
+}
+
+// Checks signature and checksum of page summary in given reserved bytes
+int check_page_summary(byte *summ, byte resv_bytes) {
+  if (resv_bytes < DBLOG_SUMM_HDR_LEN || summ[0] != DBLOG_SUMM_SIG
+        || summ[1] > resv_bytes - DBLOG_SUMM_HDR_LEN
+        || read_uint16(summ + 2) != summary_chk_sum(summ + DBLOG_SUMM_HDR_LEN, summ[1]))
+    return DBLOG_RES_NOT_FOUND;
+  return DBLOG_RES_OK;
+}
+
+// Writes current leaf page which is full and makes buffer ready for next page
+int finish_leaf_page(struct dblog_write_context *wctx, int32_t page_size) {
+  write_page_summary(wctx, wctx->buf, page_size);
+  int res = write_full_page(wctx, wctx->buf, wctx->cur_write_page, page_size);
+  if (res)
+    return res;
+  wctx->last_leaf_written = wctx->cur_write_page;
+  if (is_spine_active(wctx)) {
+    uint32_t rowid = read_vint32(wctx->buf + read_uint16(wctx->buf + 5)
+                                  + LEN_OF_REC_LEN, NULL);
+    res = spine_add(wctx, 0, wctx->cur_write_page, rowid, page_size);
+    if (res)
+      return res;
+  }
+  res = next_write_page(wctx, page_size);
+  if (res)
+    return res;
+  init_bt_tbl_leaf(wctx->buf);
+  return DBLOG_RES_OK;
+}
+
 const char sqlite_sig[] = "SQLite format 3";
 const char dblog_sig[]  = "SQLite3 uLogger";
 char default_table_name[] = "t1";
@@ -475,6 +1473,25 @@ int form_page1(struct dblog_write_context *wctx, char *table_name, char *table_s
   byte *buf = (byte *) wctx->buf;
   int32_t page_size = get_pagesize(wctx->page_size_exp);
   wctx->cur_write_rowid = 0;
+  wctx->stage_count = 0;
+  wctx->async_writer = NULL;
+  wctx->spine_height = wctx->max_pages_exp ? DBLOG_SPINE_OFF : 0;
+  wctx->tail_mark_page = 0;
+  wctx->first_leaf_page = 0;
+  wctx->last_leaf_written = 0;
+  wctx->ring_reuse = 0;
+  if (wctx->max_pages_exp > 31)
+    return DBLOG_RES_ERR;
+  if (wctx->page_resv_bytes < summary_resv_len(wctx)
+        || (wctx->bloom_col_count && !wctx->bloom_bytes))
+    return DBLOG_RES_ERR;
+  // Ring should be made of whole erase blocks, leaving enough
+  // blocks for those erased ahead of the page being written
+  uint32_t leaf_base = get_leaf_base_page(wctx->erase_block_exp, wctx->page_size_exp);
+  uint32_t ring_pages = get_ring_pages(wctx->max_pages_exp);
+  if (ring_pages && (ring_pages % leaf_base || (wctx->erase_fn
+        && ring_pages / leaf_base <= DBLOG_CFG_ERASE_AHEAD + 1)))
+    return DBLOG_RES_ERR;
 
   // 100 byte header - refer https://www.sqlite.org/fileformat.html
   memcpy(buf, dblog_sig, 16);
@@ -493,6 +1510,10 @@ int form_page1(struct dblog_write_context *wctx, char *table_name, char *table_s
   //write_uint32(buf + 40, 0);
   memset(buf + 24, '\0', 20); // Set to zero, above 5
   write_uint32(buf + 28, 2); // TODO: Update during finalize
+  if (leaf_base > 1) { // rest of first erase block is in freelist
+    write_uint32(buf + 32, 2);
+    write_uint32(buf + 36, leaf_base - 1);
+  }
   write_uint32(buf + 44, 4);
   //write_uint16(buf + 48, 0);
   //write_uint16(buf + 52, 0);
@@ -504,10 +1525,10 @@ int form_page1(struct dblog_write_context *wctx, char *table_name, char *table_s
   write_uint32(buf + 60, 0);
   write_uint32(buf + 64, 0);
   // App ID - set to 0xA5xxxxxx where A5 is signature
-  // last 5 bits = wctx->max_pages_exp - set to 0 currently
-  // till it is implemented
-  write_uint32(buf + 68, 0xA5000000);
+  // last 5 bits = wctx->max_pages_exp
+  write_uint32(buf + 68, 0xA5000000 | wctx->max_pages_exp);
   memset(buf + 72, '\0', 20); // reserved space
+  buf[DBLOG_PG1_ERASE_BLOCK_POS] = wctx->erase_block_exp;
   write_uint32(buf + 92, 105);
   write_uint32(buf + 96, 3016000);
   memset(buf + 100, '\0', page_size - 100); // Set remaing page to zero
@@ -557,9 +1578,27 @@ int form_page1(struct dblog_write_context *wctx, char *table_name, char *table_s
   int res = write_page(wctx, 0, page_size);
   if (res)
     return res;
+  if (leaf_base > 1) {
+    // Freelist trunk page with remaining pages as leaves
+    memset(buf, '\0', page_size);
+    write_uint32(buf + 4, leaf_base - 2);
+    for (uint32_t i = 2; i < leaf_base; i++)
+      write_uint32(buf + i * 4, i + 1);
+    res = write_page(wctx, 1, page_size);
+    if (res)
+      return res;
+  }
   wctx->col_count = orig_col_count;
-  wctx->cur_write_page = 1;
+  wctx->cur_write_page = leaf_base;
   wctx->cur_write_rowid = 0;
+  res = erase_ahead(wctx, page_size, 0, DBLOG_CFG_ERASE_AHEAD + 1);
+  if (res)
+    return res;
+  if (wctx->state_write_fn) {
+    res = write_state_rec(wctx, DBLOG_STATE_OPEN, 0, 0);
+    if (res)
+      return res;
+  }
   init_bt_tbl_leaf(wctx->buf);
   wctx->state = DBLOG_ST_WRITE_PENDING;
 
@@ -571,18 +1610,22 @@ int form_page1(struct dblog_write_context *wctx, char *table_name, char *table_s
 // Reads the buffer part by part to avoid reading entire buffer into memory
 // to support low memory systems (2kb ram)
 // The underlying callback function hopefully optimizes repeated IO
+// If leaf_only is set, returns DBLOG_RES_NOT_FOUND for interior pages
 int get_last_rowid(struct dblog_write_context *wctx, uint32_t pos,
-           int32_t page_size, uint32_t *out_rowid) {
+           int32_t page_size, uint32_t *out_rowid, byte leaf_only) {
   byte src_buf[12];
   int res = read_bytes_wctx(wctx, src_buf, pos * page_size, 12);
   if (res)
     return res;
+  if (leaf_only && *src_buf != 13)
+    return DBLOG_RES_NOT_FOUND;
   uint16_t last_pos = read_uint16(src_buf + 5);
   if (!last_pos && *src_buf == 5) {
     *out_rowid = 0;
     return DBLOG_RES_OK;
   }
-  if (last_pos > page_size - 12)
+  // last cell of an interior page can be a single child at the end
+  if (last_pos > page_size - (*src_buf == 5 ? 5 : 12))
     return DBLOG_RES_MALFORMED;
   uint8_t page_type = *src_buf;
   uint16_t remaining = page_size - wctx->page_resv_bytes - last_pos;
@@ -666,10 +1709,12 @@ int dblog_write_init(struct dblog_write_context *wctx) {
 // Checks space for appending new row
 // If space not available, writes current buffer to disk and
 // initializes buffer as new page
+// Returns 0 on error, with error code in wctx->err_no
 uint16_t make_space_for_new_row(struct dblog_write_context *wctx, int32_t page_size,
            uint16_t len_of_rec_len_rowid, uint16_t new_rec_len) {
   byte *ptr = wctx->buf + (wctx->buf[0] == 13 ? 0 : 100);
   uint16_t last_pos = read_uint16(ptr + 5);
+  wctx->err_no = DBLOG_RES_MALFORMED;
   if (last_pos && last_pos > page_size - wctx->page_resv_bytes - 7)
     return 0; // corruption
   int rec_count = read_uint16(ptr + 3) + 1;
@@ -679,11 +1724,11 @@ uint16_t make_space_for_new_row(struct dblog_write_context *wctx, int32_t page_s
     last_pos = page_size - wctx->page_resv_bytes;
   if (last_pos && last_pos < ((ptr - wctx->buf) + 9 + CHKSUM_LEN
        + (rec_count * 2) + new_rec_len + len_of_rec_len_rowid)) {
-    int res = write_page(wctx, wctx->cur_write_page, page_size);
-    if (res)
-      return res;
-    wctx->cur_write_page++;
-    init_bt_tbl_leaf(wctx->buf);
+    int res = finish_leaf_page(wctx, page_size);
+    if (res) {
+      wctx->err_no = res;
+      return 0;
+    }
     last_pos = page_size - wctx->page_resv_bytes - new_rec_len - len_of_rec_len_rowid;
   } else {
     last_pos -= new_rec_len;
@@ -747,7 +1792,7 @@ int dblog_append_row_with_values(struct dblog_write_context *wctx,
   uint16_t last_pos = make_space_for_new_row(wctx, page_size,
                         len_of_rec_len_rowid, new_rec_len);
   if (!last_pos)
-    return DBLOG_RES_MALFORMED;
+    return wctx->err_no;
   int rec_count = read_uint16(ptr + 3) + 1;
   if (rec_count * 2 + 8 >= last_pos)
     return DBLOG_RES_MALFORMED;
@@ -773,18 +1818,166 @@ int dblog_append_row_with_values(struct dblog_write_context *wctx,
 }
 
 // See .h file for API description
-int dblog_append_empty_row(struct dblog_write_context *wctx) {
+int dblog_append_rows_columnar(struct dblog_write_context *wctx, uint32_t row_count,
+      const uint8_t types[], const void *values[], const uint16_t lengths[],
+      const uint16_t *row_lengths[], uint32_t *out_rows_appended) {
 
-  wctx->cur_write_rowid++;
+  *out_rows_appended = 0;
   byte *ptr = wctx->buf + (wctx->buf[0] == 13 ? 0 : 100);
   int32_t page_size = get_pagesize(wctx->page_size_exp);
-  uint16_t len_of_rec_len_rowid = LEN_OF_REC_LEN + get_vlen_of_uint32(wctx->cur_write_rowid);
-  uint16_t new_rec_len = wctx->col_count;
-  new_rec_len += LEN_OF_HDR_LEN;
-  uint16_t last_pos = make_space_for_new_row(wctx, page_size,
-                        len_of_rec_len_rowid, new_rec_len);
+  uint32_t col_types[wctx->col_count];
+  // Header and data length of columns whose length does not vary by row
+  uint16_t fixed_hdr_len = LEN_OF_HDR_LEN;
+  uint16_t fixed_data_len = 0;
+  for (int i = 0; i < wctx->col_count; i++) {
+    if (row_lengths && row_lengths[i])
+      continue;
+    col_types[i] = derive_col_type_or_len(types[i], values[i], lengths[i]);
+    fixed_hdr_len += get_vlen_of_uint32(col_types[i]);
+    if (values[i] != NULL)
+      fixed_data_len += (types[i] == DBLOG_TYPE_REAL ? 8 : lengths[i]);
+  }
+
+  uint16_t last_pos = read_uint16(ptr + 5);
+  int rec_count = read_uint16(ptr + 3);
+  if (last_pos && last_pos > page_size - wctx->page_resv_bytes - 7)
+    return DBLOG_RES_MALFORMED;
+  if (last_pos && rec_count * 2 + 8 >= last_pos)
+    return DBLOG_RES_MALFORMED;
+  if (last_pos == 0)
+    last_pos = page_size - wctx->page_resv_bytes;
+
+  int res = DBLOG_RES_OK;
+  for (uint32_t row = 0; row < row_count; row++) {
+    uint16_t hdr_len = fixed_hdr_len;
+    uint16_t new_rec_len = fixed_data_len;
+    if (row_lengths) {
+      for (int i = 0; i < wctx->col_count; i++) {
+        if (!row_lengths[i])
+          continue;
+        col_types[i] = derive_col_type_or_len(types[i], values[i], row_lengths[i][row]);
+        hdr_len += get_vlen_of_uint32(col_types[i]);
+        if (values[i] != NULL)
+          new_rec_len += row_lengths[i][row];
+      }
+    }
+    new_rec_len += hdr_len;
+    uint16_t len_of_rec_len_rowid = LEN_OF_REC_LEN
+                    + get_vlen_of_uint32(wctx->cur_write_rowid + 1);
+    // refuse before finishing the page if it would not fit in an empty page
+    if (page_size - wctx->page_resv_bytes < 9 + CHKSUM_LEN + 2
+         + new_rec_len + len_of_rec_len_rowid) {
+      res = DBLOG_RES_TOO_LONG;
+      break;
+    }
+    if (last_pos < (ptr - wctx->buf) + 9 + CHKSUM_LEN
+         + ((rec_count + 1) * 2) + new_rec_len + len_of_rec_len_rowid) {
+      if (!rec_count) {
+        res = DBLOG_RES_TOO_LONG;
+        break;
+      }
+      write_uint16(ptr + 3, rec_count);
+      write_uint16(ptr + 5, last_pos);
+      res = finish_leaf_page(wctx, page_size);
+      if (res)
+        break;
+      ptr = wctx->buf;
+      rec_count = 0;
+      last_pos = page_size - wctx->page_resv_bytes;
+    }
+    wctx->cur_write_rowid++;
+    last_pos -= (new_rec_len + len_of_rec_len_rowid);
+    write_rec_len_rowid_hdr_len(wctx->buf + last_pos, new_rec_len,
+                      wctx->cur_write_rowid, hdr_len);
+    byte *rec_ptr = wctx->buf + last_pos + len_of_rec_len_rowid + LEN_OF_HDR_LEN;
+    for (int i = 0; i < wctx->col_count; i++)
+      rec_ptr += write_vint32(rec_ptr, col_types[i]);
+    for (int i = 0; i < wctx->col_count; i++) {
+      if (values[i] == NULL)
+        continue;
+      const byte *val = (const byte *) values[i] + row * lengths[i];
+      uint16_t len = (row_lengths && row_lengths[i] ? row_lengths[i][row] : lengths[i]);
+      rec_ptr += write_data(rec_ptr, types[i], val, len);
+    }
+    write_uint16(ptr + 8 + (rec_count * 2), last_pos);
+    rec_count++;
+    (*out_rows_appended)++;
+  }
+  write_uint16(ptr + 3, rec_count);
+  write_uint16(ptr + 5, rec_count ? last_pos : 0);
+  wctx->state = DBLOG_ST_WRITE_PENDING;
+
+  return res;
+}
+
+// See .h file for API description
+int dblog_append_encoded_row(struct dblog_write_context *wctx,
+      const void *rec, uint16_t rec_len) {
+
+  wctx->cur_write_rowid++;
+  byte *ptr = wctx->buf + (wctx->buf[0] == 13 ? 0 : 100);
+  int32_t page_size = get_pagesize(wctx->page_size_exp);
+  uint16_t len_of_rec_len_rowid = LEN_OF_REC_LEN + get_vlen_of_uint32(wctx->cur_write_rowid);
+  uint16_t last_pos = make_space_for_new_row(wctx, page_size,
+                        len_of_rec_len_rowid, rec_len);
   if (!last_pos)
+    return wctx->err_no;
+  int rec_count = read_uint16(ptr + 3) + 1;
+  if (rec_count * 2 + 8 >= last_pos)
     return DBLOG_RES_MALFORMED;
+
+  write_rec_len_rowid_hdr_len(wctx->buf + last_pos, rec_len,
+                    wctx->cur_write_rowid, read_vint16((byte *) rec, NULL));
+  memcpy(wctx->buf + last_pos + len_of_rec_len_rowid + LEN_OF_HDR_LEN,
+         (const byte *) rec + LEN_OF_HDR_LEN, rec_len - LEN_OF_HDR_LEN);
+  write_uint16(ptr + 3, rec_count);
+  write_uint16(ptr + 5, last_pos);
+  write_uint16(ptr + 8 - 2 + (rec_count * 2), last_pos);
+  wctx->state = DBLOG_ST_WRITE_PENDING;
+
+  return DBLOG_RES_OK;
+}
+
+// See .h file for API description
+int dblog_encode_row(int col_count, const uint8_t types[],
+      const void *values[], const uint16_t lengths[], void *rec, uint16_t rec_size) {
+  uint32_t hdr_len = LEN_OF_HDR_LEN;
+  uint32_t rec_len = 0;
+  for (int i = 0; i < col_count; i++) {
+    if (values[i] != NULL)
+      rec_len += (types[i] == DBLOG_TYPE_REAL ? 8 : lengths[i]);
+    hdr_len += get_vlen_of_uint32(derive_col_type_or_len(types[i], values[i], lengths[i]));
+  }
+  rec_len += hdr_len;
+  if (rec_len > rec_size || hdr_len >= 16384)
+    return DBLOG_RES_TOO_LONG;
+  if (rec == NULL)
+    return rec_len;
+  byte *rec_ptr = (byte *) rec;
+  *rec_ptr++ = 0x80 + (hdr_len >> 7);
+  *rec_ptr++ = hdr_len & 0x7F;
+  for (int i = 0; i < col_count; i++)
+    rec_ptr += write_vint32(rec_ptr, derive_col_type_or_len(types[i], values[i], lengths[i]));
+  for (int i = 0; i < col_count; i++) {
+    if (values[i] != NULL)
+      rec_ptr += write_data(rec_ptr, types[i], values[i], lengths[i]);
+  }
+  return rec_len;
+}
+
+// See .h file for API description
+int dblog_append_empty_row(struct dblog_write_context *wctx) {
+
+  wctx->cur_write_rowid++;
+  byte *ptr = wctx->buf + (wctx->buf[0] == 13 ? 0 : 100);
+  int32_t page_size = get_pagesize(wctx->page_size_exp);
+  uint16_t len_of_rec_len_rowid = LEN_OF_REC_LEN + get_vlen_of_uint32(wctx->cur_write_rowid);
+  uint16_t new_rec_len = wctx->col_count;
+  new_rec_len += LEN_OF_HDR_LEN;
+  uint16_t last_pos = make_space_for_new_row(wctx, page_size,
+                        len_of_rec_len_rowid, new_rec_len);
+  if (!last_pos)
+    return wctx->err_no;
   int rec_count = read_uint16(ptr + 3) + 1;
   if (rec_count * 2 + 8 >= last_pos)
     return DBLOG_RES_MALFORMED;
@@ -827,12 +2020,10 @@ int dblog_set_col_val(struct dblog_write_context *wctx,
     write_uint16(ptr + 3, rec_count - 1);
     write_uint16(ptr + 5, prev_last_pos);
     saveChecksumBytes(ptr, prev_last_pos);
-    int res = write_page(wctx, wctx->cur_write_page, page_size);
+    int res = finish_leaf_page(wctx, page_size);
     if (res)
       return res;
     restoreChecksumBytes(ptr, prev_last_pos);
-    wctx->cur_write_page++;
-    init_bt_tbl_leaf(wctx->buf);
     int8_t len_of_rowid;
     read_vint32(wctx->buf + last_pos + 3, &len_of_rowid);
     memmove(wctx->buf + page_size - wctx->page_resv_bytes 
@@ -893,13 +2084,127 @@ const void *dblog_get_col_val(struct dblog_write_context *wctx,
 // See .h file for API description
 int dblog_flush(struct dblog_write_context *wctx) {
   int32_t page_size = get_pagesize(wctx->page_size_exp);
-  int res = write_page(wctx, wctx->cur_write_page, page_size);
+  int res = write_pending_pages(wctx);
+  if (res)
+    return res;
+  write_page_summary(wctx, wctx->buf, page_size);
+  res = write_page(wctx, wctx->cur_write_page, page_size);
   if (res)
     return res;
   int ret = wctx->flush_fn(wctx);
-  if (!ret)
-    wctx->state = DBLOG_ST_WRITE_NOT_PENDING;
-  return ret;
+  if (ret)
+    return ret;
+  wctx->state = DBLOG_ST_WRITE_NOT_PENDING;
+  // page being written has no row yet if the last one just became full,
+  // which need not be the page before it if interior pages were written
+  // in between (spine_buf) or the ring wrapped around
+  uint32_t last_page = wctx->cur_write_page;
+  if (!read_uint16(wctx->buf + 3))
+    last_page = wctx->last_leaf_written;
+  publish_snapshot(wctx, last_page, wctx->cur_write_rowid);
+  return DBLOG_RES_OK;
+}
+
+// Reads given page into wctx->buf and checks whether it is a leaf page
+// with valid checksum, returning the Row ID of its last record
+// Returns DBLOG_RES_NOT_FOUND for interior pages
+int read_valid_leaf_page(struct dblog_write_context *wctx, uint32_t page_no,
+      int32_t page_size, uint32_t *out_rowid) {
+  int res = read_bytes_wctx(wctx, wctx->buf, page_no * page_size, page_size);
+  if (res)
+    return res;
+  if (*wctx->buf == 5)
+    return DBLOG_RES_NOT_FOUND;
+  if (*wctx->buf != 13)
+    return DBLOG_RES_MALFORMED;
+  uint16_t last_pos = read_uint16(wctx->buf + 5);
+  if (last_pos < 12 || last_pos > page_size - wctx->page_resv_bytes - 7)
+    return DBLOG_RES_MALFORMED;
+  if (check_sums(wctx->buf, page_size, 3))
+    return DBLOG_RES_INV_CHKSUM;
+  *out_rowid = read_vint32(wctx->buf + last_pos + LEN_OF_REC_LEN, NULL);
+  return DBLOG_RES_OK;
+}
+
+// Returns the page noted by mark_tail() in the given first page
+// along with its last rowid, or 0 if there is no valid marker
+uint32_t read_tail_mark(byte *buf, uint32_t *out_rowid) {
+  byte *mark = buf + DBLOG_PG1_TAIL_POS;
+  *out_rowid = 0;
+  if (mark[8] != tail_mark_chk_sum(mark, 8))
+    return 0;
+  *out_rowid = read_uint32(mark + 4);
+  return read_uint32(mark);
+}
+
+// Locates the last leaf page of a database that was not finalized
+// starting from the given page noted by mark_tail() and its last rowid
+// in *out_rowid, or the first leaf page if last_page is 0.
+// Whole of each page is checked so that a page torn during
+// power loss is not taken as the last page
+// Interior pages in between (if spine_buf was used) are skipped
+// If max_pages_exp is used, continues from first page after the last
+// and also finds the oldest page if writing had wrapped around,
+// else starts from wctx->first_leaf_page if oldest pages were dropped,
+// which is also kept as is for a ring formed by dblog_drop_oldest()
+// wctx->buf is overwritten
+// Returns 0 if no leaf page is found
+uint32_t locate_tail_page(struct dblog_write_context *wctx,
+      int32_t page_size, uint32_t last_page, uint32_t *out_rowid) {
+  uint32_t rowid;
+  int res;
+  // Noted page may have been written again after dblog_open_for_append()
+  if (last_page && wctx->state_read_fn) {
+    res = read_valid_leaf_page(wctx, last_page, page_size, &rowid);
+    if (res || rowid < *out_rowid)
+      last_page = *out_rowid = 0;
+    else
+      *out_rowid = rowid;
+  }
+  if (!last_page)
+    *out_rowid = 0;
+  uint32_t leaf_base = get_leaf_base_page(wctx->erase_block_exp, wctx->page_size_exp);
+  uint32_t ring_pages = get_ring_pages(wctx->max_pages_exp);
+  byte keep_first = !ring_pages || wctx->ring_reuse;
+  uint32_t page_no = last_page ? last_page
+          : (keep_first && wctx->first_leaf_page ? wctx->first_leaf_page : leaf_base) - 1;
+  for (uint32_t i = 0; !ring_pages || i < ring_pages; i++) {
+    page_no = get_ring_leaf_page(page_no, 2, leaf_base, ring_pages);
+    res = read_valid_leaf_page(wctx, page_no, page_size, &rowid);
+    if (res == DBLOG_RES_NOT_FOUND || res == DBLOG_RES_INV_CHKSUM)
+      continue;
+    if (res || rowid <= *out_rowid)
+      break; // end of log or left from earlier
+    last_page = page_no;
+    *out_rowid = rowid;
+  }
+  if (keep_first)
+    return last_page;
+  // If wrapped around, the oldest page is the next valid page
+  // after the pages erased ahead of the last page
+  wctx->first_leaf_page = 0;
+  if (last_page) {
+    page_no = last_page;
+    for (uint32_t i = (DBLOG_CFG_ERASE_AHEAD + 1) * leaf_base + 1; i; i--) {
+      page_no = get_ring_leaf_page(page_no, 2, leaf_base, ring_pages);
+      if (page_no == leaf_base)
+        break; // oldest page is the first page, same as not wrapped
+      res = read_valid_leaf_page(wctx, page_no, page_size, &rowid);
+      if (res == DBLOG_RES_OK) {
+        if (rowid < *out_rowid)
+          wctx->first_leaf_page = page_no;
+        break;
+      }
+    }
+  }
+  return last_page;
+}
+
+// Whether the database was opened for appending using the state record,
+// in which case the first page may still be as last finalized
+int is_open_in_state_rec(struct dblog_write_context *wctx) {
+  return wctx->state_write_fn && (wctx->state == DBLOG_ST_WRITE_PENDING
+            || wctx->state == DBLOG_ST_WRITE_NOT_PENDING);
 }
 
 // See .h file for API description
@@ -910,63 +2215,79 @@ int dblog_partial_finalize(struct dblog_write_context *wctx) {
     if (res)
       return res;
   }
+  res = write_pending_pages(wctx);
+  if (res)
+    return res;
   int32_t page_size = get_pagesize(wctx->page_size_exp);
   res = read_bytes_wctx(wctx, wctx->buf, 0, page_size);
   if (res)
     return res;
-  if (memcmp(wctx->buf, sqlite_sig, 16) == 0)
+  byte is_open = is_open_in_state_rec(wctx);
+  if (!is_open && memcmp(wctx->buf, sqlite_sig, 16) == 0)
     return DBLOG_RES_OK;
   uint32_t last_leaf_page = read_uint32(wctx->buf + 60);
   // Update the last page no. in first page
-  if (last_leaf_page == 0) {
+  // If opened using state record, first page is as last finalized
+  if (last_leaf_page == 0 || is_open) {
     if (!wctx->cur_write_page) {
-      byte head_buf[8];
-      do {
-        res = read_bytes_wctx(wctx, head_buf, (wctx->cur_write_page + 1) * page_size, 8);
-        if (res)
-          break;
-        if (head_buf[0] == 13)
-          wctx->cur_write_page++;
-      } while (head_buf[0] == 13);
+      uint32_t rowid;
+      wctx->max_pages_exp = wctx->buf[71] & 0x1F;
+      wctx->ring_reuse = wctx->buf[DBLOG_PG1_FLAGS_POS] & DBLOG_PG1_REUSE ? 1 : 0;
+      wctx->erase_block_exp = wctx->buf[DBLOG_PG1_ERASE_BLOCK_POS];
+      wctx->first_leaf_page = read_uint32(wctx->buf + DBLOG_PG1_FIRST_LEAF_POS);
+      uint32_t last_page = read_tail_mark(wctx->buf, &rowid);
+      wctx->cur_write_page = locate_tail_page(wctx, page_size, last_page, &rowid);
+      wctx->cur_write_rowid = rowid;
+      res = read_bytes_wctx(wctx, wctx->buf, 0, page_size);
+      if (res)
+        return res;
     }
     if (wctx->cur_write_page) {
+      // leaf pages should be stored before the first page points to them
+      if (wctx->flush_fn(wctx))
+        return DBLOG_RES_FLUSH_ERR;
+      memcpy(wctx->buf, dblog_sig, 16);
       write_uint32(wctx->buf + 60, wctx->cur_write_page);
+      write_uint32(wctx->buf + DBLOG_PG1_FIRST_LEAF_POS, wctx->first_leaf_page);
       res = write_page(wctx, 0, page_size);
       if (res)
         return res;
+      if (wctx->flush_fn(wctx))
+        return DBLOG_RES_FLUSH_ERR;
     } else
       return DBLOG_RES_MALFORMED;
   }
   return DBLOG_RES_OK;
 }
 
-// See .h file for API description
-int dblog_finalize(struct dblog_write_context *wctx) {
-
-  int res = dblog_partial_finalize(wctx);
-  if (res)
-    return res;
-
-  if (memcmp(wctx->buf, sqlite_sig, 16) == 0)
-    return DBLOG_RES_OK;
-
-  int32_t page_size = get_pagesize(wctx->page_size_exp);
-  uint32_t next_level_cur_pos = wctx->cur_write_page + 1;
+// Forms interior pages over the pages from cur_level_pos to cur_level_end,
+// which are counted from first_leaf_page (1 based) for leaf level,
+// writing them from *next_level_pos and continuing with the level
+// above till there is only one page, which is returned as root
+int write_inner_levels(struct dblog_write_context *wctx, int32_t page_size,
+      uint32_t first_leaf_page, uint32_t cur_level_pos, uint32_t cur_level_end,
+      byte leaf_only, uint32_t *next_level_pos, uint32_t *out_root_page) {
+  uint32_t leaf_base = get_leaf_base_page(wctx->erase_block_exp, wctx->page_size_exp);
+  uint32_t ring_pages = get_ring_pages(wctx->max_pages_exp);
+  uint32_t next_level_cur_pos = *next_level_pos;
   uint32_t next_level_begin_pos = next_level_cur_pos;
-  uint32_t cur_level_pos = 1;
+  uint32_t child_pos = 0;
   uint32_t rowid;
-  while (wctx->cur_write_page != 1) {
+  int res;
+  while (1) {
     init_bt_tbl_inner(wctx->buf);
-    while (cur_level_pos < next_level_begin_pos) {
-      res = get_last_rowid(wctx, cur_level_pos, page_size, &rowid);
+    while (cur_level_pos < cur_level_end) {
+      child_pos = leaf_only ? get_ring_leaf_page(first_leaf_page,
+                       cur_level_pos, leaf_base, ring_pages) : cur_level_pos;
+      res = get_last_rowid(wctx, child_pos, page_size, &rowid, leaf_only);
       if (res) {
         cur_level_pos++;
-        if (res == DBLOG_RES_INV_CHKSUM)
+        if (res == DBLOG_RES_INV_CHKSUM || res == DBLOG_RES_NOT_FOUND)
           continue;
         else
           break;
       }
-      if (add_rec_to_inner_tbl(wctx, wctx->buf, rowid, cur_level_pos)) {
+      if (add_rec_to_inner_tbl(wctx, wctx->buf, rowid, child_pos)) {
         res = write_page(wctx, next_level_cur_pos, page_size);
         if (res)
           return res;
@@ -976,8 +2297,15 @@ int dblog_finalize(struct dblog_write_context *wctx) {
       cur_level_pos++;
     }
     uint16_t rec_count = read_uint16(wctx->buf + 3);
+    if (rec_count == 1 && next_level_cur_pos > next_level_begin_pos) {
+      res = move_child_to_last_inner_page(wctx, page_size,
+              next_level_cur_pos - 1, child_pos, rowid);
+      if (res)
+        return res;
+      rec_count = 2;
+    }
     if (rec_count) { // remove last row and write as right most pointer
-      write_uint32(wctx->buf + 8, cur_level_pos);
+      write_uint32(wctx->buf + 8, child_pos + 1);
       rec_count--;
       write_vint32(wctx->buf + 12 + rec_count * 2, rowid);
       write_uint16(wctx->buf + 3, rec_count);
@@ -991,32 +2319,413 @@ int dblog_finalize(struct dblog_write_context *wctx) {
         return res;
       next_level_cur_pos++;
     }
+    *out_root_page = next_level_cur_pos;
+    *next_level_pos = next_level_cur_pos;
     if (next_level_begin_pos == next_level_cur_pos - 1)
       break;
     else {
       cur_level_pos = next_level_begin_pos;
-      next_level_begin_pos = next_level_cur_pos;
+      cur_level_end = next_level_begin_pos = next_level_cur_pos;
+      leaf_only = 0;
     }
   }
+  return DBLOG_RES_OK;
+}
 
-  res = read_bytes_wctx(wctx, wctx->buf, 0, page_size);
+// Returns page at given position (0 based) among pages of given
+// ranges, which are pairs of first page and page after the last
+uint32_t get_free_page(uint32_t ranges[], int range_count, uint32_t idx) {
+  for (int i = 0; i < range_count * 2; i += 2) {
+    uint32_t len = ranges[i + 1] > ranges[i] ? ranges[i + 1] - ranges[i] : 0;
+    if (idx < len)
+      return ranges[i] + idx;
+    idx -= len;
+  }
+  return 0;
+}
+
+// Writes freelist trunk pages listing all pages in given ranges
+// so that Sqlite finds every page either in the table or free
+// Trunk pages are taken from the free pages themselves and
+// are written part by part as wctx->buf holds the first page
+// Returns first trunk page (1 based) and no. of free pages
+int write_freelist(struct dblog_write_context *wctx, int32_t page_size,
+      uint32_t ranges[], int range_count, uint32_t *out_trunk, uint32_t *out_count) {
+  uint32_t total = 0;
+  for (int i = 0; i < range_count * 2; i += 2)
+    total += (ranges[i + 1] > ranges[i] ? ranges[i + 1] - ranges[i] : 0);
+  uint32_t trunk_cap = (page_size - wctx->page_resv_bytes) / 4 - 8;
+  *out_trunk = total ? get_free_page(ranges, range_count, 0) + 1 : 0;
+  *out_count = total;
+  byte part[64];
+  uint32_t idx = 0;
+  while (idx < total) {
+    uint32_t trunk_page = get_free_page(ranges, range_count, idx);
+    uint32_t leaf_count = total - idx - 1;
+    if (leaf_count > trunk_cap)
+      leaf_count = trunk_cap;
+    uint32_t next_idx = idx + 1 + leaf_count;
+    write_uint32(part, next_idx < total ? get_free_page(ranges, range_count, next_idx) + 1 : 0);
+    write_uint32(part + 4, leaf_count);
+    long pos = (long) trunk_page * page_size;
+    int len = 8;
+    for (uint32_t i = 0; i <= leaf_count; i++) {
+      if (len == sizeof(part) || i == leaf_count) {
+        if ((wctx->write_fn)(wctx, part, pos, len) != len)
+          return DBLOG_RES_WRITE_ERR;
+        pos += len;
+        len = 0;
+      }
+      if (i < leaf_count) {
+        write_uint32(part + len, get_free_page(ranges, range_count, idx + 1 + i) + 1);
+        len += 4;
+      }
+    }
+    idx = next_idx;
+  }
+  return DBLOG_RES_OK;
+}
+
+// Forms ranges of pages from 1 to before page_count that are neither
+// leaf pages from first_leaf_page to last_leaf_page (around the ring of
+// max_pages_exp) nor from inner_begin to before inner_end, as pairs
+// of first page and page after the last.  Returns no. of ranges (max 4)
+int get_free_ranges(struct dblog_write_context *wctx, uint32_t first_leaf_page,
+      uint32_t last_leaf_page, uint32_t inner_begin, uint32_t inner_end,
+      uint32_t page_count, uint32_t ranges[8]) {
+  uint32_t leaf_base = get_leaf_base_page(wctx->erase_block_exp, wctx->page_size_exp);
+  uint32_t ring_pages = get_ring_pages(wctx->max_pages_exp);
+  uint32_t used[6] = {first_leaf_page, last_leaf_page + 1, inner_begin, inner_end, 0, 0};
+  int used_count = 2;
+  if (last_leaf_page < first_leaf_page) { // wrapped around
+    used[1] = leaf_base + ring_pages;
+    used[4] = leaf_base;
+    used[5] = last_leaf_page + 1;
+    used_count = 3;
+  }
+  int range_count = 0;
+  uint32_t page_no = 1;
+  while (1) {
+    int next = -1; // used range starting first from page_no
+    for (int i = 0; i < used_count * 2; i += 2) {
+      if (used[i + 1] > used[i] && used[i + 1] > page_no
+            && (next < 0 || used[i] < used[next]))
+        next = i;
+    }
+    uint32_t end = next < 0 ? page_count : used[next];
+    if (end > page_count)
+      end = page_count;
+    if (end > page_no) {
+      ranges[range_count * 2] = page_no;
+      ranges[range_count * 2 + 1] = end;
+      range_count++;
+    }
+    if (next < 0 || used[next + 1] >= page_count)
+      break;
+    if (used[next + 1] > page_no)
+      page_no = used[next + 1];
+  }
+  return range_count;
+}
+
+// Updates root page, page count and signature in the first page
+// so that the database can be read by Sqlite
+// For a ring formed by dblog_drop_oldest(), pages other than the leaf
+// pages and the interior pages from inner_begin to before page_count
+// are written as freelist, upto the earlier page count
+int write_final_first_page(struct dblog_write_context *wctx, int32_t page_size,
+      uint32_t root_page, uint32_t page_count, uint32_t inner_begin, byte flags) {
+  int res = read_bytes_wctx(wctx, wctx->buf, 0, page_size);
   if (res)
     return res;
   byte *data_ptr = locate_col_root_page(wctx->buf, page_size - wctx->page_resv_bytes);
   if (data_ptr == NULL)
     return DBLOG_RES_MALFORMED;
-  write_uint32(data_ptr, next_level_cur_pos); // update root_page
-  write_uint32(wctx->buf + 28, next_level_cur_pos); // update page_count
+  if (wctx->ring_reuse) {
+    uint32_t old_page_count = read_uint32(wctx->buf + 28);
+    uint32_t ranges[8];
+    int range_count = get_free_ranges(wctx, wctx->first_leaf_page,
+          wctx->cur_write_page, inner_begin, page_count,
+          page_count > old_page_count ? page_count : old_page_count, ranges);
+    uint32_t trunk_page, free_count;
+    res = write_freelist(wctx, page_size, ranges, range_count, &trunk_page, &free_count);
+    if (res)
+      return res;
+    if (wctx->flush_fn(wctx))
+      return DBLOG_RES_FLUSH_ERR;
+    write_uint32(wctx->buf + 32, trunk_page);
+    write_uint32(wctx->buf + 36, free_count);
+    write_uint32(wctx->buf + DBLOG_PG1_FIRST_LEAF_POS, wctx->first_leaf_page);
+    wctx->buf[71] = wctx->max_pages_exp;
+    flags |= DBLOG_PG1_REUSE;
+    if (page_count < old_page_count)
+      page_count = old_page_count; // file is not truncated
+  }
+  write_uint32(data_ptr, root_page); // update root_page
+  write_uint32(wctx->buf + 28, page_count); // update page_count
+  wctx->buf[DBLOG_PG1_FLAGS_POS] = flags;
   memcpy(wctx->buf, sqlite_sig, 16);
   res = write_page(wctx, 0, page_size);
+  if (res || !wctx->state_write_fn)
+    return res;
+  wctx->state = DBLOG_ST_FINAL;
+  return write_state_rec(wctx, 0, wctx->cur_write_page, wctx->cur_write_rowid);
+}
+
+// Finalizes by closing the right most interior pages formed
+// in spine_buf and writing them from the lowest level upwards
+int finalize_spine(struct dblog_write_context *wctx, int32_t page_size) {
+  uint32_t last_leaf_page = wctx->cur_write_page;
+  uint32_t rowid;
+  int res = get_last_rowid(wctx, last_leaf_page, page_size, &rowid, 1);
   if (res)
     return res;
+  uint32_t child_pos = last_leaf_page;
+  uint32_t root_page = child_pos + 1;
+  for (byte level = 0; level < wctx->spine_height; level++) {
+    byte *buf = wctx->spine_buf + level * page_size;
+    if (!add_rec_to_inner_tbl(wctx, buf, rowid, child_pos))
+      close_inner_page(buf);
+    if (level == wctx->spine_height - 1 && read_uint16(buf + 3) == 0) {
+      root_page = read_uint32(buf + 8); // only one child at top
+      break;
+    }
+    wctx->cur_write_page++;
+    res = write_full_page(wctx, buf, wctx->cur_write_page, page_size);
+    if (res)
+      return res;
+    child_pos = wctx->cur_write_page;
+    root_page = child_pos + 1;
+  }
+  uint32_t page_count = wctx->cur_write_page + 1;
+  wctx->cur_write_page = last_leaf_page;
+  res = write_pending_pages(wctx);
+  if (res)
+    return res;
+  if (wctx->flush_fn(wctx))
+    return DBLOG_RES_FLUSH_ERR;
+  res = write_final_first_page(wctx, page_size, root_page,
+                               page_count, 0, DBLOG_PG1_SPINE);
+  if (res)
+    return res;
+  if (wctx->flush_fn(wctx))
+    return DBLOG_RES_FLUSH_ERR;
+  return DBLOG_RES_OK;
+}
+
+// See .h file for API description
+int dblog_finalize(struct dblog_write_context *wctx) {
+
+  int res = dblog_partial_finalize(wctx);
+  if (res)
+    return res;
+
+  if (memcmp(wctx->buf, sqlite_sig, 16) == 0)
+    return DBLOG_RES_OK;
+
+  int32_t page_size = get_pagesize(wctx->page_size_exp);
+  if (is_spine_active(wctx) && wctx->state != DBLOG_ST_TO_RECOVER)
+    return finalize_spine(wctx, page_size);
+
+  // Leaf pages are taken from the oldest.  Interior pages are written
+  // after the ring if wrapped around, else from the erase block
+  // after the last leaf page
+  uint32_t leaf_base = get_leaf_base_page(wctx->erase_block_exp, wctx->page_size_exp);
+  uint32_t ring_pages = get_ring_pages(wctx->max_pages_exp);
+  uint32_t first_leaf_page = wctx->first_leaf_page ? wctx->first_leaf_page : leaf_base;
+  uint32_t leaf_count = get_leaf_count(first_leaf_page, wctx->cur_write_page, ring_pages);
+  uint32_t next_level_pos = (ring_pages && wctx->first_leaf_page) ? leaf_base + ring_pages
+          : wctx->cur_write_page + leaf_base - (wctx->cur_write_page - leaf_base) % leaf_base;
+  uint32_t inner_begin = next_level_pos;
+  uint32_t root_page = first_leaf_page + 1; // if only one leaf page
+  if (leaf_count != 1) {
+    res = write_inner_levels(wctx, page_size, first_leaf_page, 1, leaf_count + 1,
+            1, &next_level_pos, &root_page);
+    if (res)
+      return res;
+    if (wctx->flush_fn(wctx))
+      return DBLOG_RES_FLUSH_ERR;
+  }
+
+  res = write_final_first_page(wctx, page_size, root_page,
+          leaf_count == 1 ? wctx->cur_write_page + 1 : next_level_pos,
+          leaf_count == 1 ? wctx->cur_write_page + 1 : inner_begin, 0);
+  if (res)
+    return res;
+  if (wctx->flush_fn(wctx))
+    return DBLOG_RES_FLUSH_ERR;
 
   return DBLOG_RES_OK;
 }
 
+// Descends along the left most pointers from the root to find
+// the first interior page of level 1 (just above leaf pages)
+// and of level 2, which are 0 if not present
+int locate_level1_pages(struct dblog_write_context *wctx, byte *page_buf,
+      int32_t page_size, uint32_t root_page, uint32_t *out_level1,
+      uint32_t *out_level2) {
+  uint32_t page_no = root_page;
+  *out_level1 = *out_level2 = 0;
+  for (int depth = 0; depth < 32; depth++) {
+    int res = read_bytes_wctx(wctx, page_buf, page_no * page_size, page_size);
+    if (res)
+      return res;
+    if (*page_buf != 5)
+      return *page_buf == 13 ? DBLOG_RES_OK : DBLOG_RES_MALFORMED;
+    *out_level2 = *out_level1;
+    *out_level1 = page_no;
+    page_no = (read_uint16(page_buf + 3) ?
+          read_uint32(page_buf + read_uint16(page_buf + 12)) :
+          read_uint32(page_buf + 8)) - 1;
+  }
+  return DBLOG_RES_MALFORMED;
+}
+
+// See .h file for API description
+int dblog_drop_oldest(struct dblog_write_context *wctx, uint32_t keep_rowid,
+      byte *page_buf, uint32_t *out_pages_freed) {
+  *out_pages_freed = 0;
+  int32_t page_size = dblog_read_page_size(wctx);
+  if (page_size < 0)
+    return page_size;
+  int res = read_bytes_wctx(wctx, wctx->buf, 0, page_size);
+  if (res)
+    return res;
+  if (memcmp(wctx->buf, sqlite_sig, 16))
+    return DBLOG_RES_NOT_FINALIZED;
+  byte ring_reuse = wctx->buf[DBLOG_PG1_FLAGS_POS] & DBLOG_PG1_REUSE ? 1 : 0;
+  if (((wctx->buf[71] & 0x1F) && !ring_reuse) || wctx->erase_fn
+        || (wctx->buf[DBLOG_PG1_FLAGS_POS] & DBLOG_PG1_SPINE))
+    return DBLOG_RES_ERR;
+  wctx->page_resv_bytes = wctx->buf[20];
+  wctx->max_pages_exp = wctx->buf[71] & 0x1F;
+  wctx->ring_reuse = ring_reuse;
+  wctx->erase_block_exp = wctx->buf[DBLOG_PG1_ERASE_BLOCK_POS];
+  uint32_t leaf_base = get_leaf_base_page(wctx->erase_block_exp, wctx->page_size_exp);
+  uint32_t last_leaf_page = read_uint32(wctx->buf + 60);
+  uint32_t first_leaf_page = read_uint32(wctx->buf + DBLOG_PG1_FIRST_LEAF_POS);
+  if (!first_leaf_page)
+    first_leaf_page = leaf_base;
+  uint32_t page_count = read_uint32(wctx->buf + 28);
+  uint32_t free_count = read_uint32(wctx->buf + 36);
+  byte *data_ptr = locate_col_root_page(wctx->buf, page_size - wctx->page_resv_bytes);
+  if (data_ptr == NULL)
+    return DBLOG_RES_MALFORMED;
+  uint32_t root_page = read_uint32(data_ptr) - 1;
+  uint32_t level1_page, level2_page;
+  res = locate_level1_pages(wctx, page_buf, page_size, root_page,
+                            &level1_page, &level2_page);
+  if (res || !level1_page)
+    return res; // only one leaf page
+  // Interior pages of a level are written one after the other
+  // by dblog_finalize(), so level 1 ends where level 2 begins
+  // and the root is the last of them
+  uint32_t level1_end = level2_page ? level2_page : level1_page + 1;
+  // The new interior pages, which are not more than the present ones,
+  // are written over pages already free so that the present ones stay
+  // intact till the first page is written, else after the last page
+  uint32_t ranges[8];
+  int range_count = get_free_ranges(wctx, first_leaf_page, last_leaf_page,
+                      level1_page, root_page + 1, page_count, ranges);
+  uint32_t inner_begin = page_count;
+  for (int i = 0; i < range_count * 2; i += 2) {
+    if (ranges[i + 1] - ranges[i] > root_page - level1_page) {
+      inner_begin = ranges[i];
+      break;
+    }
+  }
+  uint32_t new_first_leaf = 0;
+  uint32_t next_level_pos = inner_begin;
+  uint32_t child_pos;
+  uint32_t rowid = 0;
+  init_bt_tbl_inner(wctx->buf);
+  for (uint32_t page_no = level1_page; page_no < level1_end; page_no++) {
+    res = read_bytes_wctx(wctx, page_buf, page_no * page_size, page_size);
+    if (res)
+      return res;
+    if (*page_buf != 5)
+      return DBLOG_RES_MALFORMED;
+    uint16_t rec_count = read_uint16(page_buf + 3);
+    for (uint16_t i = 0; i <= rec_count; i++) {
+      if (i < rec_count) {
+        byte *cell = page_buf + read_uint16(page_buf + 12 + i * 2);
+        child_pos = read_uint32(cell) - 1;
+        rowid = read_vint32(cell + 4, NULL);
+      } else {
+        child_pos = read_uint32(page_buf + 8) - 1;
+        rowid = read_vint32(page_buf + 12 + rec_count * 2, NULL);
+      }
+      if (rowid < keep_rowid && child_pos != last_leaf_page)
+        continue;
+      if (!new_first_leaf) {
+        if (child_pos == first_leaf_page)
+          return DBLOG_RES_OK; // nothing to drop
+        new_first_leaf = child_pos;
+      }
+      if (add_rec_to_inner_tbl(wctx, wctx->buf, rowid, child_pos)) {
+        res = write_page(wctx, next_level_pos, page_size);
+        if (res)
+          return res;
+        next_level_pos++;
+        init_bt_tbl_inner(wctx->buf);
+      }
+    }
+  }
+  if (!new_first_leaf)
+    return DBLOG_RES_MALFORMED;
+  root_page = last_leaf_page + 1; // if only last leaf page is kept
+  if (new_first_leaf != last_leaf_page) {
+    if (read_uint16(wctx->buf + 3) == 1 && next_level_pos > inner_begin) {
+      res = move_child_to_last_inner_page(wctx, page_size,
+              next_level_pos - 1, child_pos, rowid);
+      if (res)
+        return res;
+    }
+    if (read_uint16(wctx->buf + 3)) {
+      close_inner_page(wctx->buf);
+      res = write_page(wctx, next_level_pos, page_size);
+      if (res)
+        return res;
+      next_level_pos++;
+    }
+    root_page = next_level_pos;
+    if (next_level_pos - inner_begin > 1) {
+      res = write_inner_levels(wctx, page_size, 0, inner_begin, next_level_pos,
+              0, &next_level_pos, &root_page);
+      if (res)
+        return res;
+    }
+  }
+  // Leaf pages wrap around over the pages dropped from now on, in a ring
+  // having all of them, which grows as needed
+  if (!wctx->ring_reuse) {
+    wctx->max_pages_exp = 1;
+    while (get_ring_pages(wctx->max_pages_exp) < leaf_base
+             || leaf_base + get_ring_pages(wctx->max_pages_exp) <= last_leaf_page)
+      wctx->max_pages_exp++;
+    wctx->ring_reuse = 1;
+  }
+  wctx->first_leaf_page = new_first_leaf;
+  wctx->cur_write_page = last_leaf_page;
+  wctx->cur_write_rowid = rowid;
+  // new interior pages should be stored before the first page points to them
+  if (wctx->flush_fn(wctx))
+    return DBLOG_RES_FLUSH_ERR;
+  res = write_final_first_page(wctx, page_size, root_page,
+          next_level_pos, inner_begin, 0);
+  if (res)
+    return res;
+  if (wctx->flush_fn(wctx))
+    return DBLOG_RES_FLUSH_ERR;
+  *out_pages_freed = read_uint32(wctx->buf + 36) - free_count;
+  return DBLOG_RES_OK;
+}
+
 // See .h file for API description
 int dblog_not_finalized(struct dblog_write_context *wctx) {
+  byte rec[DBLOG_STATE_REC_LEN];
+  if (read_state_rec(wctx, rec) == DBLOG_RES_OK)
+    return rec[0] & DBLOG_STATE_OPEN ? DBLOG_RES_NOT_FINALIZED : DBLOG_RES_OK;
   int res = read_bytes_wctx(wctx, wctx->buf, 0, 72);
   if (res)
     return res;
@@ -1042,14 +2751,63 @@ int32_t dblog_read_page_size(struct dblog_write_context *wctx) {
 
 // See .h file for API description
 int dblog_recover(struct dblog_write_context *wctx) {
+  byte rec[DBLOG_STATE_REC_LEN];
+  if (read_state_rec(wctx, rec) == DBLOG_RES_OK) {
+    if (!(rec[0] & DBLOG_STATE_OPEN))
+      return DBLOG_RES_OK;
+    int res = dblog_open_for_append(wctx);
+    if (res)
+      return res;
+    return dblog_finalize(wctx);
+  }
   wctx->state = DBLOG_ST_TO_RECOVER;
   wctx->cur_write_page = 0;
+  wctx->stage_count = 0;
+  wctx->async_writer = NULL;
+  wctx->spine_height = DBLOG_SPINE_OFF;
+  wctx->tail_mark_page = 0;
+  wctx->first_leaf_page = 0;
   int res = dblog_finalize(wctx);
   if (res)
     return res;
   return DBLOG_RES_OK;
 }
 
+// Loads right most interior pages of a database finalized
+// using spine_buf so that they can be continued
+// The right most pointers are left as is and are written again
+// by finalize_spine()
+int load_spine(struct dblog_write_context *wctx, int32_t page_size) {
+  byte *data_ptr = locate_col_root_page(wctx->buf, page_size - wctx->page_resv_bytes);
+  if (data_ptr == NULL)
+    return DBLOG_RES_MALFORMED;
+  uint32_t page_no = read_uint32(data_ptr);
+  uint32_t path[wctx->spine_levels];
+  byte height = 0;
+  byte head_buf[12];
+  while (1) {
+    int res = read_bytes_wctx(wctx, head_buf, (page_no - 1) * page_size, 12);
+    if (res)
+      return res;
+    if (*head_buf != 5)
+      break;
+    if (height == wctx->spine_levels)
+      return DBLOG_RES_TOO_LONG;
+    path[height++] = page_no;
+    page_no = read_uint32(head_buf + 8);
+  }
+  if (*head_buf != 13)
+    return DBLOG_RES_MALFORMED;
+  for (byte i = 0; i < height; i++) {
+    int res = read_bytes_wctx(wctx, wctx->spine_buf + (height - 1 - i) * page_size,
+                (path[i] - 1) * page_size, page_size);
+    if (res)
+      return res;
+  }
+  wctx->spine_height = height;
+  return DBLOG_RES_OK;
+}
+
 // See .h file for API description
 int dblog_init_for_append(struct dblog_write_context *wctx) {
   int res = read_bytes_wctx(wctx, wctx->buf, 0, 72);
@@ -1069,25 +2827,280 @@ int dblog_init_for_append(struct dblog_write_context *wctx) {
   wctx->cur_write_page = read_uint32(wctx->buf + 60);
   if (wctx->cur_write_page == 0)
     return DBLOG_RES_NOT_FINALIZED;
-  memcpy(wctx->buf, dblog_sig, 16);
-  write_uint32(wctx->buf + 60, 0);
-  res = write_page(wctx, 0, page_size);
+  wctx->stage_count = 0;
+  wctx->async_writer = NULL;
+  wctx->spine_height = DBLOG_SPINE_OFF;
+  wctx->tail_mark_page = wctx->cur_write_page;
+  wctx->last_leaf_written = 0;
+  wctx->max_pages_exp = wctx->buf[71] & 0x1F;
+  wctx->ring_reuse = wctx->buf[DBLOG_PG1_FLAGS_POS] & DBLOG_PG1_REUSE ? 1 : 0;
+  wctx->first_leaf_page = read_uint32(wctx->buf + DBLOG_PG1_FIRST_LEAF_POS);
+  wctx->erase_block_exp = wctx->buf[DBLOG_PG1_ERASE_BLOCK_POS];
+  if (wctx->spine_levels && !wctx->max_pages_exp
+        && (wctx->buf[DBLOG_PG1_FLAGS_POS] & DBLOG_PG1_SPINE)) {
+    res = load_spine(wctx, page_size);
+    if (res)
+      return res;
+  }
+  if (!wctx->state_write_fn) {
+    memcpy(wctx->buf, dblog_sig, 16);
+    write_uint32(wctx->buf + 60, 0);
+    res = write_page(wctx, 0, page_size);
+    if (res)
+      return res;
+  }
+  res = get_last_rowid(wctx, wctx->cur_write_page, page_size, &wctx->cur_write_rowid, 1);
+  if (res)
+    return res;
+  if (wctx->state_write_fn) {
+    res = write_state_rec(wctx, DBLOG_STATE_OPEN,
+            wctx->cur_write_page, wctx->cur_write_rowid);
+    if (res)
+      return res;
+  }
+  res = read_bytes_wctx(wctx, wctx->buf, wctx->cur_write_page * page_size, page_size);
   if (res)
     return res;
-  res = get_last_rowid(wctx, wctx->cur_write_page, page_size, &wctx->cur_write_rowid);
+  // blocks ahead may have interior pages written by finalize
+  res = erase_ahead(wctx, page_size, 1, DBLOG_CFG_ERASE_AHEAD);
   if (res)
     return res;
-  res = read_bytes_wctx(wctx, wctx->buf, wctx->cur_write_page * page_size, page_size);
+  wctx->state = DBLOG_ST_WRITE_NOT_PENDING;
+  return DBLOG_RES_OK;
+}
+
+// See .h file for API description
+int dblog_resume(struct dblog_write_context *wctx) {
+  int32_t page_size = dblog_read_page_size(wctx);
+  if (page_size < 0)
+    return page_size;
+  int res = read_bytes_wctx(wctx, wctx->buf, 0, page_size);
+  if (res)
+    return res;
+  if (memcmp(wctx->buf, sqlite_sig, 16) == 0)
+    return dblog_init_for_append(wctx);
+  wctx->stage_count = 0;
+  wctx->async_writer = NULL;
+  wctx->spine_height = DBLOG_SPINE_OFF; // right most interior pages lost
+  wctx->last_leaf_written = 0;
+  wctx->max_pages_exp = wctx->buf[71] & 0x1F;
+  wctx->ring_reuse = wctx->buf[DBLOG_PG1_FLAGS_POS] & DBLOG_PG1_REUSE ? 1 : 0;
+  wctx->erase_block_exp = wctx->buf[DBLOG_PG1_ERASE_BLOCK_POS];
+  wctx->first_leaf_page = read_uint32(wctx->buf + DBLOG_PG1_FIRST_LEAF_POS);
+  uint32_t last_page = read_tail_mark(wctx->buf, &wctx->cur_write_rowid);
+  wctx->cur_write_page = locate_tail_page(wctx, page_size,
+                            last_page, &wctx->cur_write_rowid);
+  if (wctx->cur_write_page) {
+    res = read_bytes_wctx(wctx, wctx->buf, wctx->cur_write_page * page_size, page_size);
+    if (res)
+      return res;
+  } else {
+    wctx->cur_write_page = get_leaf_base_page(wctx->erase_block_exp, wctx->page_size_exp);
+    init_bt_tbl_leaf(wctx->buf);
+  }
+  wctx->tail_mark_page = wctx->cur_write_page;
+  if (wctx->state_write_fn) {
+    res = write_state_rec(wctx, DBLOG_STATE_OPEN,
+            wctx->cur_write_page, wctx->cur_write_rowid);
+    if (res)
+      return res;
+  }
+  res = erase_ahead(wctx, page_size, 1, DBLOG_CFG_ERASE_AHEAD);
   if (res)
     return res;
   wctx->state = DBLOG_ST_WRITE_NOT_PENDING;
   return DBLOG_RES_OK;
 }
 
+// See .h file for API description
+int dblog_open_for_append(struct dblog_write_context *wctx) {
+  byte rec[DBLOG_STATE_REC_LEN];
+  if (!wctx->state_write_fn || read_state_rec(wctx, rec))
+    return dblog_resume(wctx);
+  wctx->page_size_exp = rec[1];
+  wctx->max_pages_exp = rec[2];
+  wctx->erase_block_exp = rec[3];
+  wctx->ring_reuse = rec[0] & DBLOG_STATE_REUSE ? 1 : 0;
+  if (wctx->page_size_exp < 9 || wctx->page_size_exp > 16)
+    return DBLOG_RES_MALFORMED;
+  int32_t page_size = get_pagesize(wctx->page_size_exp);
+  wctx->stage_count = 0;
+  wctx->async_writer = NULL;
+  wctx->spine_height = DBLOG_SPINE_OFF;
+  wctx->last_leaf_written = 0;
+  uint32_t rowid = read_uint32(rec + 8);
+  int res;
+  if (rec[0] & DBLOG_STATE_OPEN) {
+    // not finalized, continue from the tail marker
+    wctx->first_leaf_page = read_uint32(rec + 12);
+    wctx->cur_write_page = locate_tail_page(wctx, page_size, read_uint32(rec + 4), &rowid);
+    if (wctx->cur_write_page) {
+      res = read_bytes_wctx(wctx, wctx->buf, wctx->cur_write_page * page_size, page_size);
+      if (res)
+        return res;
+    }
+  } else {
+    // finalized, continue the last leaf page and note it as open
+    wctx->cur_write_page = read_uint32(rec + 4);
+    wctx->first_leaf_page = read_uint32(rec + 12);
+    if (rowid) {
+      res = read_valid_leaf_page(wctx, wctx->cur_write_page, page_size, &rowid);
+      if (res)
+        return res;
+    } else
+      wctx->cur_write_page = 0;
+  }
+  if (!wctx->cur_write_page) {
+    wctx->cur_write_page = get_leaf_base_page(wctx->erase_block_exp, wctx->page_size_exp);
+    init_bt_tbl_leaf(wctx->buf);
+  }
+  wctx->cur_write_rowid = rowid;
+  wctx->tail_mark_page = wctx->cur_write_page;
+  if (!(rec[0] & DBLOG_STATE_OPEN)) {
+    res = write_state_rec(wctx, DBLOG_STATE_OPEN, wctx->cur_write_page, rowid);
+    if (res)
+      return res;
+  }
+  res = erase_ahead(wctx, page_size, 1, DBLOG_CFG_ERASE_AHEAD);
+  if (res)
+    return res;
+  wctx->state = DBLOG_ST_WRITE_NOT_PENDING;
+  return DBLOG_RES_OK;
+}
+
+// Checksum of retained running values and page, FNV-1a
+uint32_t retained_chk_sum(struct dblog_write_context *wctx, struct dblog_retained *ret) {
+  uint32_t chk_sum = 2166136261u;
+  byte *ptr = (byte *) ret;
+  for (size_t i = 0; i < offsetof(struct dblog_retained, chk_sum); i++)
+    chk_sum = (chk_sum ^ ptr[i]) * 16777619u;
+  int32_t page_size = get_pagesize(ret->page_size_exp);
+  for (int32_t i = 0; i < page_size; i++)
+    chk_sum = (chk_sum ^ wctx->buf[i]) * 16777619u;
+  return chk_sum;
+}
+
+// See .h file for API description
+int dblog_retain(struct dblog_write_context *wctx, struct dblog_retained *ret) {
+  int res;
+#if DBLOG_CFG_ASYNC_WRITE
+  res = dblog_async_stop(wctx);
+  if (res)
+    return res;
+#endif
+  res = flush_staged_pages(wctx);
+  if (res)
+    return res;
+  // full pages written during the wake may still be buffered
+  if (wctx->flush_fn(wctx))
+    return DBLOG_RES_FLUSH_ERR;
+  ret->cur_write_page = wctx->cur_write_page;
+  ret->cur_write_rowid = wctx->cur_write_rowid;
+  ret->tail_mark_page = wctx->tail_mark_page;
+  ret->first_leaf_page = wctx->first_leaf_page;
+  ret->last_leaf_written = wctx->last_leaf_written;
+  ret->page_size_exp = wctx->page_size_exp;
+  ret->max_pages_exp = wctx->max_pages_exp;
+  ret->erase_block_exp = wctx->erase_block_exp;
+  ret->ring_reuse = wctx->ring_reuse;
+  ret->state = wctx->state;
+  ret->chk_sum = retained_chk_sum(wctx, ret);
+  return DBLOG_RES_OK;
+}
+
+// See .h file for API description
+int dblog_restore(struct dblog_write_context *wctx, struct dblog_retained *ret) {
+  if (ret->page_size_exp < 9 || ret->page_size_exp > 16
+        || (ret->state != DBLOG_ST_WRITE_PENDING
+              && ret->state != DBLOG_ST_WRITE_NOT_PENDING)
+        || ret->chk_sum != retained_chk_sum(wctx, ret))
+    return DBLOG_RES_INV_CHKSUM;
+  ret->chk_sum = ~ret->chk_sum;
+  wctx->cur_write_page = ret->cur_write_page;
+  wctx->cur_write_rowid = ret->cur_write_rowid;
+  wctx->tail_mark_page = ret->tail_mark_page;
+  wctx->first_leaf_page = ret->first_leaf_page;
+  wctx->last_leaf_written = ret->last_leaf_written;
+  wctx->page_size_exp = ret->page_size_exp;
+  wctx->max_pages_exp = ret->max_pages_exp;
+  wctx->erase_block_exp = ret->erase_block_exp;
+  wctx->ring_reuse = ret->ring_reuse;
+  wctx->state = ret->state;
+  wctx->stage_count = 0;
+  wctx->async_writer = NULL;
+  wctx->spine_height = DBLOG_SPINE_OFF;
+  return DBLOG_RES_OK;
+}
+
+// Hides rows of the last leaf page of a snapshot that were added after
+// the snapshot, as the writer may be writing them while the page is read.
+// Rows already flushed are not moved by the writer and Row IDs within
+// a page are consecutive, so only the record count is reduced.
+// The page summary may be of more rows, so it is also hidden
+void hide_rows_after_snap(struct dblog_read_context *rctx, int32_t page_size) {
+  byte *buf = rctx->buf;
+  uint16_t rec_count = read_uint16(buf + 3);
+  if (*buf != 13 || !rec_count)
+    return;
+  uint32_t first_rowid = read_vint32(buf + read_uint16(buf + 8) + LEN_OF_REC_LEN, NULL);
+  uint32_t keep = (rctx->snap_rowid >= first_rowid ? rctx->snap_rowid - first_rowid + 1 : 1);
+  if (keep < rec_count) {
+    write_uint16(buf + 3, keep);
+    write_uint16(buf + 5, read_uint16(buf + 8 + (keep - 1) * 2));
+  }
+  if (rctx->page_resv_bytes)
+    buf[page_size - rctx->page_resv_bytes] = 0;
+}
+
+// Reads given page (or first len bytes of it) into rctx->buf,
+// or if the file is mapped, points rctx->buf to it
+int read_page_rctx(struct dblog_read_context *rctx, uint32_t page_no, int32_t len) {
+  int32_t page_size = get_pagesize(rctx->page_size_exp);
+#if DBLOG_CFG_MMAP_READ
+  if (rctx->map) {
+    size_t pos = (size_t) page_no * page_size;
+    if (pos + len > rctx->map_len)
+      return DBLOG_RES_READ_ERR;
+    rctx->buf = (byte *) rctx->map + pos;
+    return DBLOG_RES_OK;
+  }
+#endif
+  int res = read_bytes_rctx(rctx, rctx->buf, page_no * page_size, len);
+  if (!res && rctx->snap_rowid && page_no == rctx->last_leaf_page && len == page_size)
+    hide_rows_after_snap(rctx, page_size);
+  return res;
+}
+
+#if DBLOG_CFG_MMAP_READ
+// Asks the OS to load DBLOG_CFG_MMAP_READAHEAD pages of the mapped
+// file in the direction of scan, once every half of as many pages
+void advise_map_ahead(struct dblog_read_context *rctx, int dir) {
+  uint32_t ahead = DBLOG_CFG_MMAP_READAHEAD;
+  uint32_t moved = dir > 0 ? rctx->cur_page - rctx->map_advised_page
+                           : rctx->map_advised_page - rctx->cur_page;
+  if (rctx->map_advised_page && moved < ahead / 2)
+    return;
+  rctx->map_advised_page = rctx->cur_page ? rctx->cur_page : 1;
+  size_t os_page = sysconf(_SC_PAGESIZE);
+  int32_t page_size = get_pagesize(rctx->page_size_exp);
+  size_t from = (size_t) rctx->cur_page * page_size;
+  size_t to = from + (size_t) ahead * page_size;
+  if (dir < 0) {
+    to = from + page_size;
+    from = to > (size_t) ahead * page_size ? to - (size_t) ahead * page_size : 0;
+  }
+  if (to > rctx->map_len)
+    to = rctx->map_len;
+  from -= from % os_page;
+  if (from < to)
+    madvise((void *) (rctx->map + from), to - from, MADV_WILLNEED);
+}
+#endif
+
 // Reads current page
 int read_cur_page(struct dblog_read_context *rctx) {
   int32_t page_size = get_pagesize(rctx->page_size_exp);
-  int res = read_bytes_rctx(rctx, rctx->buf, rctx->cur_page * page_size, page_size);
+  int res = read_page_rctx(rctx, rctx->cur_page, page_size);
   if (res)
     return res;
   if (rctx->buf[0] != 13)
@@ -1095,9 +3108,78 @@ int read_cur_page(struct dblog_read_context *rctx) {
   return DBLOG_RES_OK;
 }
 
+// Moves to next (dir = 1) or previous (dir = -1) leaf page, skipping
+// interior pages found in between when spine_buf was used for writing
+// If max_pages_exp was used, wraps around till the latest / oldest page
+// Reads current page from ra_buf, first reading ra_pages pages
+// starting from it in the direction of scan if not there.
+// The window is kept within the leaf pages (and the ring if used)
+int read_cur_page_ahead(struct dblog_read_context *rctx, int dir) {
+  uint32_t cur = rctx->cur_page;
+  uint32_t ring_pages = get_ring_pages(rctx->max_pages_exp);
+  uint32_t lo = rctx->leaf_base_page;
+  uint32_t hi = ring_pages ? lo + ring_pages
+                  : (rctx->last_leaf_page ? rctx->last_leaf_page + 1 : UINT32_MAX);
+  if (rctx->map || cur < lo || cur >= hi)
+    return read_cur_page(rctx);
+  int32_t page_size = get_pagesize(rctx->page_size_exp);
+  if (!rctx->ra_count || cur < rctx->ra_first_page
+        || cur >= rctx->ra_first_page + rctx->ra_count) {
+    uint32_t first = cur;
+    uint32_t count = rctx->ra_pages;
+    if (dir < 0) {
+      first = cur - lo + 1 > count ? cur + 1 - count : lo;
+      count = cur + 1 - first;
+    } else if (hi - cur < count)
+      count = hi - cur;
+    rctx->ra_count = 0;
+    int32_t len = count * page_size;
+    if ((rctx->read_fn)(rctx, rctx->ra_buf, first * page_size, len) != len)
+      return read_cur_page(rctx); // such as beyond end of file
+    rctx->ra_first_page = first;
+    rctx->ra_count = count;
+  }
+  memcpy(rctx->buf, rctx->ra_buf + (cur - rctx->ra_first_page) * page_size, page_size);
+  if (rctx->snap_rowid && cur == rctx->last_leaf_page)
+    hide_rows_after_snap(rctx, page_size);
+  if (rctx->buf[0] != 13)
+    return DBLOG_RES_NOT_FOUND;
+  return DBLOG_RES_OK;
+}
+
+int read_adj_leaf_page(struct dblog_read_context *rctx, int dir) {
+  int res;
+  uint32_t ring_pages = get_ring_pages(rctx->max_pages_exp);
+  // pages after the last leaf of a snapshot may also be leaf pages
+  if ((ring_pages || rctx->snap_rowid) && rctx->cur_page ==
+        (dir > 0 ? rctx->last_leaf_page : rctx->first_leaf_page))
+    return DBLOG_RES_NOT_FOUND;
+  do {
+    rctx->cur_page += dir;
+    if (ring_pages && rctx->cur_page >= rctx->leaf_base_page + ring_pages)
+      rctx->cur_page = rctx->leaf_base_page;
+    else if (ring_pages && rctx->cur_page < rctx->leaf_base_page)
+      rctx->cur_page = rctx->leaf_base_page + ring_pages - 1;
+#if DBLOG_CFG_MMAP_READ
+    if (rctx->map)
+      advise_map_ahead(rctx, dir);
+#endif
+    res = rctx->ra_pages ? read_cur_page_ahead(rctx, dir) : read_cur_page(rctx);
+  } while (res == DBLOG_RES_NOT_FOUND && rctx->buf[0] == 5
+             && rctx->cur_page > rctx->leaf_base_page
+             && (!rctx->last_leaf_page || rctx->cur_page < rctx->last_leaf_page));
+  return res;
+}
+
 // See .h file for API description
 int dblog_read_init(struct dblog_read_context *rctx) {
-  int res = read_bytes_rctx(rctx, rctx->buf, 0, 72);
+  rctx->page_size_exp = 0; // not known till read
+  rctx->cache_tick = rctx->cache_hits = rctx->cache_misses = 0;
+  if (rctx->cache_pages)
+    memset(rctx->cache_buf, '\0', rctx->cache_pages * DBLOG_CACHE_SLOT_HDR);
+  rctx->map_advised_page = 0;
+  rctx->ra_count = 0;
+  int res = read_page_rctx(rctx, 0, 80);
   if (res)
     return res;
   if (check_signature(rctx->buf))
@@ -1108,11 +3190,110 @@ int dblog_read_init(struct dblog_read_context *rctx) {
     return DBLOG_RES_INVALID_SIG;
   rctx->page_resv_bytes = read_uint8(rctx->buf + 20);
   rctx->last_leaf_page = read_uint32(rctx->buf + 60);
+  rctx->snap_rowid = 0;
+  rctx->max_pages_exp = rctx->buf[71] & 0x1F;
+  rctx->leaf_base_page = get_leaf_base_page(rctx->buf[DBLOG_PG1_ERASE_BLOCK_POS],
+                           rctx->page_size_exp);
+  rctx->first_leaf_page = read_uint32(rctx->buf + DBLOG_PG1_FIRST_LEAF_POS);
+  if (!rctx->first_leaf_page)
+    rctx->first_leaf_page = rctx->leaf_base_page;
   rctx->cur_page = 0;
   rctx->root_page = 0; // to be read when needed
   return DBLOG_RES_OK;
 }
 
+// See .h file for API description
+int dblog_read_snapshot(struct dblog_read_context *rctx, struct dblog_snapshot *snap) {
+  int res = dblog_read_init(rctx);
+  if (res)
+    return res;
+  // With state_write_fn, the first page stays as last finalized while
+  // the writer appends, so the snapshot or state record is looked at
+  // before taking the database as finalized
+  uint32_t last_page = 0;
+  uint32_t last_rowid = 0;
+  byte found = 0;
+  if (snap) {
+    uint32_t seq;
+    do {
+      seq = __atomic_load_n(&snap->seq, __ATOMIC_ACQUIRE);
+      last_page = __atomic_load_n(&snap->last_page, __ATOMIC_RELAXED);
+      last_rowid = __atomic_load_n(&snap->last_rowid, __ATOMIC_RELAXED);
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&snap->seq, __ATOMIC_RELAXED));
+    found = (seq != 0); // published at least once
+  }
+  if (rctx->state_read_fn) {
+    byte rec[DBLOG_STATE_REC_LEN];
+    if ((rctx->state_read_fn)(rctx, rec, DBLOG_STATE_REC_LEN) == DBLOG_STATE_REC_LEN
+          && rec[16] == tail_mark_chk_sum(rec, 16) && (rec[0] & DBLOG_STATE_OPEN)) {
+      if (!found) {
+        last_page = read_uint32(rec + 4);
+        last_rowid = read_uint32(rec + 8);
+        found = 1;
+      }
+      if (rec[0] & DBLOG_STATE_REUSE)
+        rctx->max_pages_exp = rec[2]; // ring may have grown
+    }
+  }
+  // Oldest page of a ring formed by dblog_drop_oldest() is not
+  // overwritten, so it can be read as written
+  if (rctx->map || (rctx->max_pages_exp
+        && !(rctx->buf[DBLOG_PG1_FLAGS_POS] & DBLOG_PG1_REUSE)))
+    return rctx->last_leaf_page ? DBLOG_RES_OK : DBLOG_RES_ERR;
+  if (!found && rctx->last_leaf_page)
+    return DBLOG_RES_OK; // finalized
+  if (!found) {
+    byte mark[DBLOG_TAIL_MARK_LEN];
+    res = read_bytes_rctx(rctx, mark, DBLOG_PG1_TAIL_POS, DBLOG_TAIL_MARK_LEN);
+    if (res)
+      return res;
+    if (mark[8] == tail_mark_chk_sum(mark, 8)) {
+      last_page = read_uint32(mark);
+      last_rowid = read_uint32(mark + 4);
+    }
+  }
+  if (!last_page || !last_rowid)
+    return DBLOG_RES_NOT_FOUND;
+  rctx->last_leaf_page = last_page;
+  rctx->snap_rowid = last_rowid;
+  return DBLOG_RES_OK;
+}
+
+#if DBLOG_CFG_MMAP_READ
+// See .h file for API description
+int dblog_read_map_file(struct dblog_read_context *rctx, const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return DBLOG_RES_READ_ERR;
+  struct stat st;
+  if (fstat(fd, &st) || st.st_size < 100) {
+    close(fd);
+    return DBLOG_RES_READ_ERR;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return DBLOG_RES_READ_ERR;
+  rctx->map = (const byte *) map;
+  rctx->map_len = st.st_size;
+  int res = dblog_read_init(rctx);
+  if (res)
+    dblog_read_unmap(rctx);
+  return res;
+}
+
+// See .h file for API description
+int dblog_read_unmap(struct dblog_read_context *rctx) {
+  if (!rctx->map)
+    return DBLOG_RES_OK;
+  int res = munmap((void *) rctx->map, rctx->map_len);
+  rctx->map = NULL;
+  rctx->buf = NULL;
+  return res ? DBLOG_RES_ERR : DBLOG_RES_OK;
+}
+#endif
+
 // See .h file for API description
 int dblog_cur_row_col_count(struct dblog_read_context *rctx) {
   uint16_t rec_data_pos = read_uint16(rctx->buf + 8 + rctx->cur_rec_pos * 2);
@@ -1156,9 +3337,82 @@ uint32_t dblog_derive_data_len(uint32_t col_type_or_len) {
   return 0;
 }
 
+// See .h file for API description
+int dblog_read_cols_batch(struct dblog_read_context *rctx, uint16_t max_rows,
+      int col_count, const int col_idxs[], const uint8_t types[],
+      void *values[], const uint8_t lengths[], uint16_t *row_lengths[]) {
+  if (rctx->cur_page == 0)
+    dblog_read_first_row(rctx);
+  if (rctx->buf[0] != 13)
+    return DBLOG_RES_NOT_FOUND;
+  int32_t limit = get_pagesize(rctx->page_size_exp) - rctx->page_resv_bytes;
+  int max_col = -1;
+  for (int i = 0; i < col_count; i++) {
+    if (col_idxs[i] > max_col)
+      max_col = col_idxs[i];
+  }
+  uint32_t col_types[max_col + 2]; // + 2 for Row ID and no columns
+  byte *col_ptrs[max_col + 2];
+  uint16_t rec_count = read_uint16(rctx->buf + 3);
+  uint16_t row = 0;
+  for (; row < max_rows && rctx->cur_rec_pos + row < rec_count; row++) {
+    if (read_rec_cols(rctx->buf, rctx->cur_rec_pos + row, limit, max_col, col_types, col_ptrs))
+      return DBLOG_RES_MALFORMED;
+    for (int i = 0; i < col_count; i++) {
+      uint32_t col_type = col_types[col_idxs[i] + 1];
+      byte *val_ptr = col_ptrs[col_idxs[i] + 1];
+      if (col_idxs[i] < 0)
+        col_type = 4; // Row ID as 4 byte integer
+      if (types[i] == DBLOG_TYPE_TEXT || types[i] == DBLOG_TYPE_BLOB) {
+        if (col_type > 0 && col_type < 12)
+          return DBLOG_RES_TYPE_MISMATCH;
+        ((const void **) values[i])[row] = col_type ? val_ptr : NULL;
+        if (row_lengths && row_lengths[i])
+          row_lengths[i][row] = dblog_derive_data_len(col_type);
+        continue;
+      }
+      if (col_type >= 12)
+        return DBLOG_RES_TYPE_MISMATCH;
+      int64_t ival = 0;
+      double dval = 0;
+      if (col_idxs[i] < 0)
+        ival = col_types[0];
+      else if (col_type == 7) {
+        uint64_t bits = read_uint64(val_ptr);
+        memcpy(&dval, &bits, 8);
+        if (types[i] != DBLOG_TYPE_REAL) {
+          // conversion is undefined for NaN, Inf or out of range values
+          if (!isfinite(dval) || fabs(dval) >= 9.2e18)
+            return DBLOG_RES_TYPE_MISMATCH;
+          ival = (int64_t) dval;
+        }
+      } else
+        ival = read_int_val(val_ptr, col_type);
+      if (types[i] == DBLOG_TYPE_REAL) {
+        if (col_type != 7)
+          dval = (double) ival;
+        if (lengths[i] == 4)
+          ((float *) values[i])[row] = (float) dval;
+        else
+          ((double *) values[i])[row] = dval;
+        continue;
+      }
+      switch (lengths[i]) {
+        case 1: ((int8_t *) values[i])[row] = (int8_t) ival; break;
+        case 2: ((int16_t *) values[i])[row] = (int16_t) ival; break;
+        case 4: ((int32_t *) values[i])[row] = (int32_t) ival; break;
+        default: ((int64_t *) values[i])[row] = ival;
+      }
+    }
+  }
+  if (row)
+    rctx->cur_rec_pos += row - 1;
+  return row;
+}
+
 // See .h file for API description
 int dblog_read_first_row(struct dblog_read_context *rctx) {
-  rctx->cur_page = 1;
+  rctx->cur_page = rctx->first_leaf_page;
   if (read_cur_page(rctx))
     return DBLOG_RES_NOT_FOUND;
   rctx->cur_rec_pos = 0;
@@ -1170,9 +3424,7 @@ int dblog_read_next_row(struct dblog_read_context *rctx) {
   uint16_t rec_count = read_uint16(rctx->buf + 3);
   rctx->cur_rec_pos++;
   if (rctx->cur_rec_pos == rec_count) {
-    int32_t page_size = get_pagesize(rctx->page_size_exp);
-    rctx->cur_page++;
-    if (read_cur_page(rctx))
+    if (read_adj_leaf_page(rctx, 1))
       return DBLOG_RES_NOT_FOUND;
     rctx->cur_rec_pos = 0;
   }
@@ -1182,10 +3434,9 @@ int dblog_read_next_row(struct dblog_read_context *rctx) {
 // See .h file for API description
 int dblog_read_prev_row(struct dblog_read_context *rctx) {
   if (rctx->cur_rec_pos == 0) {
-    if (rctx->cur_page == 1)
+    if (rctx->cur_page == rctx->first_leaf_page)
       return DBLOG_RES_NOT_FOUND;
-    rctx->cur_page--;
-    if (read_cur_page(rctx))
+    if (read_adj_leaf_page(rctx, -1))
       return DBLOG_RES_NOT_FOUND;
     rctx->cur_rec_pos = read_uint16(rctx->buf + 3);
   }
@@ -1208,13 +3459,22 @@ int dblog_read_last_row(struct dblog_read_context *rctx) {
 // Reads the buffer part by part to avoid reading entire buffer into memory
 // to support low memory systems (2kb ram)
 // The underlying callback function hopefully optimizes repeated IO
+// Returns DBLOG_RES_NOT_FOUND if the page is an interior page
 int read_last_val(struct dblog_read_context *rctx, uint32_t pos,
       int32_t page_size, int col_idx, byte *val_at, int val_len,
       uint32_t *out_col_type, uint16_t *out_rec_pos, byte is_rowid) {
   byte src_buf[12];
-  int res = read_bytes_rctx(rctx, src_buf, pos * page_size, 12);
+  int res;
+  if (rctx->snap_rowid && pos == rctx->last_leaf_page) {
+    // rows after snapshot are hidden only when the whole page is read
+    res = read_page_rctx(rctx, pos, page_size);
+    memcpy(src_buf, rctx->buf, 12);
+  } else
+    res = read_bytes_rctx(rctx, src_buf, pos * page_size, 12);
   if (res)
     return res;
+  if (*src_buf == 5)
+    return DBLOG_RES_NOT_FOUND;
   if (*src_buf != 13)
     return DBLOG_RES_MALFORMED;
   *out_rec_pos = read_uint16(src_buf + 3) - 1;
@@ -1279,8 +3539,8 @@ uint32_t read_rowid_at(struct dblog_read_context *rctx, uint32_t rec_pos) {
 
 int read_root_page_no(struct dblog_read_context *rctx, int32_t page_size) {
   if (rctx->root_page)
-    return rctx->root_page;
-  int res = read_bytes_rctx(rctx, rctx->buf, 0, page_size);
+    return DBLOG_RES_OK;
+  int res = read_page_rctx(rctx, 0, page_size);
   if (res)
     return res;
   byte *data_ptr = locate_col_root_page(rctx->buf, page_size - rctx->page_resv_bytes);
@@ -1303,7 +3563,7 @@ int dblog_srch_row_by_id(struct dblog_read_context *rctx, uint32_t rowid) {
     return DBLOG_RES_NOT_FINALIZED;
   do {
     srch_page--;
-    int res = read_bytes_rctx(rctx, rctx->buf, srch_page * page_size, page_size);
+    int res = read_page_rctx(rctx, srch_page, page_size);
     if (res)
       return res;
     uint32_t middle, first, size;
@@ -1427,23 +3687,83 @@ int compare_values(byte *val_at, uint32_t u32_at, int val_type, void *val, uint1
   return 1;
 }
 
+// Reads value of given column in the last record of the leaf page
+// at given position counted from the oldest, moving to earlier
+// positions if interior pages are found there
+int read_leaf_last_val(struct dblog_read_context *rctx, uint32_t *leaf_idx,
+      int col_idx, byte *val_at, int val_len, uint32_t *out_col_type,
+      uint16_t *out_rec_pos, uint32_t *out_page, byte is_rowid) {
+  int32_t page_size = get_pagesize(rctx->page_size_exp);
+  uint32_t ring_pages = get_ring_pages(rctx->max_pages_exp);
+  int res;
+  do {
+    *out_page = get_ring_leaf_page(rctx->first_leaf_page, *leaf_idx,
+                  rctx->leaf_base_page, ring_pages);
+    res = read_last_val(rctx, *out_page, page_size, col_idx,
+            val_at, val_len, out_col_type, out_rec_pos, is_rowid);
+  } while (res == DBLOG_RES_NOT_FOUND && --(*leaf_idx));
+  return res;
+}
+
+// Performs binary search within given leaf page and positions at
+// the record having given value, or the closest one after it
+int srch_in_leaf_page(struct dblog_read_context *rctx, uint32_t found_at_page,
+      int col_idx, int val_type, void *val, uint16_t len, byte is_rowid) {
+  int32_t page_size = get_pagesize(rctx->page_size_exp);
+  uint32_t middle, first, size;
+  int res = read_page_rctx(rctx, found_at_page, page_size);
+  if (res)
+    return res;
+  first = 0;
+  int16_t rec_count = read_uint16(rctx->buf + 3) - 1;
+  size = rec_count;
+  while (first < size) {
+    middle = (first + size) >> 1;
+    uint32_t u32_at;
+    byte *val_at = read_val_at(rctx, middle, col_idx, &u32_at, is_rowid);
+    if (!val_at)
+      return DBLOG_RES_NOT_FOUND;
+    int cmp = compare_values(val_at, u32_at, val_type, val, len, is_rowid);
+    if (cmp == DBLOG_RES_TYPE_MISMATCH)
+      return cmp;
+    if (cmp < 0)
+      first = middle + 1;
+    else if (cmp > 0)
+      size = middle;
+    else {
+      rctx->cur_page = found_at_page;
+      rctx->cur_rec_pos = middle;
+      return DBLOG_RES_OK;
+    }
+  }
+  rctx->cur_page = found_at_page;
+  rctx->cur_rec_pos = size;
+  return DBLOG_RES_OK;
+}
+
 // See .h file for API description
 int dblog_bin_srch_row_by_val(struct dblog_read_context *rctx, int col_idx,
       int val_type, void *val, uint16_t len, byte is_rowid) {
   int32_t page_size = get_pagesize(rctx->page_size_exp);
   if (rctx->last_leaf_page == 0)
     return DBLOG_RES_NOT_FINALIZED;
+  // Search is on position of leaf pages counting from the oldest
+  // which is different from page no. if wrapped around
+  uint32_t ring_pages = get_ring_pages(rctx->max_pages_exp);
+  uint32_t leaf_count = get_leaf_count(rctx->first_leaf_page, rctx->last_leaf_page, ring_pages);
   uint32_t middle, first, size;
   int res;
   first = 1;
-  size = rctx->last_leaf_page + 1;
+  size = leaf_count + 1;
   while (first < size) {
     middle = (first + size) >> 1;
+    uint32_t leaf_idx = middle; // nearest leaf page at or before middle
+    uint32_t leaf_page;
     uint16_t rec_pos;
     byte val_at[len + 1];
     uint32_t u32_at;
-    res = read_last_val(rctx, middle, page_size, col_idx, 
-            val_at, len + 1, &u32_at, &rec_pos, is_rowid);
+    res = read_leaf_last_val(rctx, &leaf_idx, col_idx, val_at, len + 1,
+            &u32_at, &rec_pos, &leaf_page, is_rowid);
     if (res)
       return res;
     int cmp = compare_values(val_at, u32_at, val_type, val, len, is_rowid);
@@ -1452,53 +3772,537 @@ int dblog_bin_srch_row_by_val(struct dblog_read_context *rctx, int col_idx,
     if (cmp < 0)
       first = middle + 1;
     else if (cmp > 0)
-      size = middle;
+      size = leaf_idx;
     else {
-      rctx->cur_page = middle;
+      rctx->cur_page = leaf_page;
       rctx->cur_rec_pos = rec_pos;
-      res = read_bytes_rctx(rctx, rctx->buf, middle * page_size, page_size);
+      res = read_page_rctx(rctx, leaf_page, page_size);
       if (res)
         return res;
       return DBLOG_RES_OK;
     }
   }
-  if (size == rctx->last_leaf_page + 1)
+  if (size == leaf_count + 1)
     size--;
-  uint32_t found_at_page = size;
-  res = read_bytes_rctx(rctx, rctx->buf, size * page_size, page_size);
-  if (res)
-    return res;
-  first = 0;
-  int16_t rec_count = read_uint16(rctx->buf + 3) - 1;
-  size = rec_count;
-  while (first < size) {
-    middle = (first + size) >> 1;
+  uint32_t found_at_page = get_ring_leaf_page(rctx->first_leaf_page, size,
+                             rctx->leaf_base_page, ring_pages);
+  return srch_in_leaf_page(rctx, found_at_page, col_idx, val_type, val, len, is_rowid);
+}
+
+// See .h file for API description
+int dblog_interp_srch_row_by_val(struct dblog_read_context *rctx, int col_idx,
+      int val_type, void *val, uint16_t len, byte is_rowid) {
+  if (rctx->last_leaf_page == 0)
+    return DBLOG_RES_NOT_FINALIZED;
+  double target;
+  if (is_rowid)
+    target = *((uint32_t *) val);
+  else if (val_type == DBLOG_TYPE_INT)
+    target = (double) convert_to_i64(val, len, 0);
+  else if (val_type == DBLOG_TYPE_REAL && len == 4)
+    target = *((float *) val);
+  else if (val_type == DBLOG_TYPE_REAL && len == 8)
+    target = *((double *) val);
+  else
+    return DBLOG_RES_TYPE_MISMATCH;
+  uint32_t ring_pages = get_ring_pages(rctx->max_pages_exp);
+  uint32_t leaf_count = get_leaf_count(rctx->first_leaf_page, rctx->last_leaf_page, ring_pages);
+  // Looking for the first leaf position whose last value is not less
+  // than given value, which is after lo and at or before hi.
+  // The last and first positions are read first to know the range
+  uint32_t lo = 0;
+  uint32_t hi = leaf_count;
+  double lo_val = 0;
+  double hi_val = 0;
+  byte slow_steps = 0; // guesses in a row that did not halve the range
+  uint32_t probes = 0;
+  while (hi - lo > 1 || probes < 2) {
+    uint32_t leaf_idx;
+    if (probes++ == 0)
+      leaf_idx = leaf_count;
+    else if (lo == 0)
+      leaf_idx = 1;
+    else if (slow_steps >= 2 || hi_val <= lo_val)
+      leaf_idx = lo + (hi - lo) / 2;
+    else {
+      double pos = lo + (target - lo_val) / (hi_val - lo_val) * (hi - lo);
+      leaf_idx = pos >= hi - 1 ? hi - 1 : (pos < lo + 1 ? lo + 1 : (uint32_t) pos + 1);
+    }
+    uint32_t probe_idx = leaf_idx;
+    uint32_t leaf_page;
+    uint16_t rec_pos;
+    byte val_at[len + 1];
     uint32_t u32_at;
-    byte *val_at = read_val_at(rctx, middle, col_idx, &u32_at, is_rowid);
-    if (!val_at)
-      return DBLOG_RES_NOT_FOUND;
+    int res = read_leaf_last_val(rctx, &leaf_idx, col_idx, val_at, len + 1,
+                &u32_at, &rec_pos, &leaf_page, is_rowid);
+    if (res)
+      return res;
     int cmp = compare_values(val_at, u32_at, val_type, val, len, is_rowid);
     if (cmp == DBLOG_RES_TYPE_MISMATCH)
       return cmp;
-    if (cmp < 0)
-      first = middle + 1;
-    else if (cmp > 0)
-      size = middle;
-    else {
-      rctx->cur_page = found_at_page;
-      rctx->cur_rec_pos = middle;
-      return DBLOG_RES_OK;
+    if (cmp == 0) {
+      rctx->cur_page = leaf_page;
+      rctx->cur_rec_pos = rec_pos;
+      return read_page_rctx(rctx, leaf_page, get_pagesize(rctx->page_size_exp));
+    }
+    uint32_t range = hi - lo;
+    if (cmp < 0) {
+      if (probe_idx == leaf_count)
+        break; // all are less, so closest is after the last record
+      lo = probe_idx;
+      lo_val = read_num_val(val_at, u32_at, is_rowid);
+    } else {
+      hi = leaf_idx;
+      hi_val = read_num_val(val_at, u32_at, is_rowid);
+      if (hi == 1)
+        break;
     }
+    // Halve next time if guesses did not narrow the range enough
+    // twice in a row, such as when values are not evenly spread
+    if (lo && range > 2 && hi - lo > range / 2)
+      slow_steps = (slow_steps >= 2 ? 0 : slow_steps + 1);
+    else
+      slow_steps = 0;
   }
-  rctx->cur_page = found_at_page;
-  rctx->cur_rec_pos = size;
+  uint32_t found_at_page = get_ring_leaf_page(rctx->first_leaf_page, hi,
+                             rctx->leaf_base_page, ring_pages);
+  return srch_in_leaf_page(rctx, found_at_page, col_idx, val_type, val, len, is_rowid);
+}
+
+
+// Converts values of given condition for comparing
+// with stored values of any numeric type
+void prepare_pred(struct dblog_pred *pred) {
+  for (int i = 0; i < 2; i++) {
+    const void *val = i ? pred->val2 : pred->val;
+    uint16_t len = i ? pred->len2 : pred->len;
+    if (!val)
+      continue;
+    if (pred->val_type == DBLOG_TYPE_INT) {
+      pred->i64[i] = convert_to_i64((byte *) val, len, 0);
+      pred->f64[i] = (double) pred->i64[i];
+    } else if (pred->val_type == DBLOG_TYPE_REAL) {
+      if (len == 4) {
+        float fval;
+        memcpy(&fval, val, 4);
+        pred->f64[i] = fval;
+      } else
+        memcpy(&pred->f64[i], val, 8);
+      pred->i64[i] = (int64_t) pred->f64[i];
+    }
+  }
+  if (pred->op == DBLOG_OP_EQ && pred->val)
+    pred->hash = bloom_hash(pred->val, pred->len,
+                   pred->val_type == DBLOG_TYPE_INT || pred->val_type == DBLOG_TYPE_REAL,
+                   pred->f64[0]);
+}
+
+// Compares stored value with value (which = 0) or val2 (which = 1)
+// of given condition, returning 1, -1 or 0 or
+// DBLOG_RES_TYPE_MISMATCH if they cannot be compared
+int compare_pred(struct dblog_pred *pred, int which,
+      uint32_t col_type, byte *val_at, uint32_t rowid) {
+  int64_t ival_at = rowid;
+  double dval_at = 0;
+  byte is_real_at = 0;
+  if (pred->col_idx >= 0) {
+    if (col_type >= 12) {
+      if (pred->val_type != DBLOG_TYPE_TEXT && pred->val_type != DBLOG_TYPE_BLOB)
+        return DBLOG_RES_TYPE_MISMATCH;
+      uint32_t len_at = dblog_derive_data_len(col_type);
+      uint16_t len = which ? pred->len2 : pred->len;
+      int cmp = memcmp(val_at, which ? pred->val2 : pred->val, len_at < len ? len_at : len);
+      if (!cmp)
+        cmp = (len_at > len ? 1 : (len_at < len ? -1 : 0));
+      return cmp > 0 ? 1 : (cmp < 0 ? -1 : 0);
+    }
+    if (col_type == 0 || col_type == 10 || col_type == 11
+          || pred->val_type == DBLOG_TYPE_TEXT || pred->val_type == DBLOG_TYPE_BLOB)
+      return DBLOG_RES_TYPE_MISMATCH;
+    if (col_type == 7) {
+      uint64_t bits = read_uint64(val_at);
+      memcpy(&dval_at, &bits, 8);
+      is_real_at = 1;
+    } else
+      ival_at = read_int_val(val_at, col_type);
+  }
+  if (is_real_at || pred->val_type == DBLOG_TYPE_REAL) {
+    if (!is_real_at)
+      dval_at = (double) ival_at;
+    double dval = pred->f64[which];
+    return dval_at > dval ? 1 : (dval_at < dval ? -1 : 0);
+  }
+  int64_t ival = pred->i64[which];
+  return ival_at > ival ? 1 : (ival_at < ival ? -1 : 0);
+}
+
+// Checks whether given condition is satisfied by the stored value
+int pred_matches(struct dblog_pred *pred, uint32_t col_types[], byte *col_ptrs[]) {
+  int col = pred->col_idx + 1;
+  int cmp = compare_pred(pred, 0, col_types[col], col_ptrs[col], col_types[0]);
+  if (cmp == DBLOG_RES_TYPE_MISMATCH)
+    return 0;
+  switch (pred->op) {
+    case DBLOG_OP_EQ:
+      return cmp == 0;
+    case DBLOG_OP_LT:
+      return cmp < 0;
+    case DBLOG_OP_LE:
+      return cmp <= 0;
+    case DBLOG_OP_GT:
+      return cmp > 0;
+    case DBLOG_OP_GE:
+      return cmp >= 0;
+    case DBLOG_OP_BETWEEN:
+      if (cmp < 0)
+        return 0;
+      cmp = compare_pred(pred, 1, col_types[col], col_ptrs[col], col_types[0]);
+      return cmp != DBLOG_RES_TYPE_MISMATCH && cmp <= 0;
+  }
+  return 0;
+}
+
+// Reads reserved bytes of given page without reading the page,
+// from the readahead window or mapped file if there, and checks them
+int read_page_summary(struct dblog_read_context *rctx, uint32_t page_no, byte *summ) {
+  int32_t page_size = get_pagesize(rctx->page_size_exp);
+  byte resv = rctx->page_resv_bytes;
+  long pos = (long) (page_no + 1) * page_size - resv;
+  if (rctx->snap_rowid && page_no == rctx->last_leaf_page)
+    return DBLOG_RES_NOT_FOUND; // may be of rows after snapshot
+  if (rctx->ra_count && page_no >= rctx->ra_first_page
+        && page_no < rctx->ra_first_page + rctx->ra_count)
+    memcpy(summ, rctx->ra_buf + (page_no - rctx->ra_first_page + 1) * page_size - resv, resv);
+  else if (rctx->map) {
+    if (read_bytes_rctx(rctx, summ, pos, resv))
+      return DBLOG_RES_READ_ERR;
+  } else if ((rctx->read_fn)(rctx, summ, pos, resv) != resv)
+    return DBLOG_RES_READ_ERR;
+  return check_page_summary(summ, resv);
+}
+
+// Checks using min and max of a zone section whether
+// any value in the page may satisfy given condition
+int zone_may_match(struct dblog_pred *pred, byte *zone) {
+  if (pred->val_type == DBLOG_TYPE_TEXT || pred->val_type == DBLOG_TYPE_BLOB)
+    return 1;
+  if (!zone[0])
+    return 0; // no numeric value in page
+  int lo = compare_pred(pred, 0, zone[0], zone + 1, 0);
+  int hi = compare_pred(pred, 0, zone[0], zone + 9, 0);
+  switch (pred->op) {
+    case DBLOG_OP_EQ:
+      return lo <= 0 && hi >= 0;
+    case DBLOG_OP_LT:
+      return lo < 0;
+    case DBLOG_OP_LE:
+      return lo <= 0;
+    case DBLOG_OP_GT:
+      return hi > 0;
+    case DBLOG_OP_GE:
+      return hi >= 0;
+    case DBLOG_OP_BETWEEN:
+      return hi >= 0 && compare_pred(pred, 1, zone[0], zone + 1, 0) <= 0;
+  }
+  return 1;
+}
+
+// Checks using the zone sections of a page summary whether
+// any row of the page may match the conditions of the scan
+// Returns 0 if none can, -1 if all keys of the page exceed key_to, else 1
+int summary_may_match(byte *summ, struct dblog_scan *scan) {
+  byte *end = summ + DBLOG_SUMM_HDR_LEN + summ[1];
+  byte *sec = summ + DBLOG_SUMM_HDR_LEN;
+  for (; sec + 3 <= end && sec + 3 + sec[2] <= end; sec += 3 + sec[2]) {
+    if (sec[0] == DBLOG_SUMM_BLOOM && sec[2]) {
+      for (byte i = 0; i < scan->pred_count; i++) {
+        struct dblog_pred *pred = &scan->preds[i];
+        if (pred->col_idx == sec[1] && pred->op == DBLOG_OP_EQ
+              && !bloom_bits(sec + 3, sec[2], pred->hash, 0))
+          return 0;
+      }
+    }
+    if ((sec[0] != DBLOG_SUMM_ZONE && sec[0] != DBLOG_SUMM_AGG)
+          || sec[2] < DBLOG_ZONE_DATA_LEN)
+      continue;
+    byte *zone = sec + 3;
+    struct dblog_pred *key_pred = &scan->key_pred;
+    if (scan->key_to && sec[1] == key_pred->col_idx && zone[0]
+          && (key_pred->val_type == DBLOG_TYPE_INT || key_pred->val_type == DBLOG_TYPE_REAL)
+          && compare_pred(key_pred, scan->key_from ? 1 : 0, zone[0], zone + 1, 0) > 0)
+      return -1;
+    for (byte i = 0; i < scan->pred_count; i++) {
+      if (scan->preds[i].col_idx == sec[1] && !zone_may_match(&scan->preds[i], zone))
+        return 0;
+    }
+  }
+  return 1;
+}
+
+// Gives the page after current page, which may not be a leaf page
+// Returns DBLOG_RES_NOT_FOUND if current page is the last leaf page
+int get_next_page_no(struct dblog_read_context *rctx, uint32_t *next_page) {
+  uint32_t ring_pages = get_ring_pages(rctx->max_pages_exp);
+  if (ring_pages && rctx->cur_page == rctx->last_leaf_page)
+    return DBLOG_RES_NOT_FOUND;
+  *next_page = rctx->cur_page + 1;
+  if (ring_pages && *next_page >= rctx->leaf_base_page + ring_pages)
+    *next_page = rctx->leaf_base_page;
+  if (!ring_pages && rctx->last_leaf_page && *next_page > rctx->last_leaf_page)
+    return DBLOG_RES_NOT_FOUND;
+  return DBLOG_RES_OK;
+}
+
+// Moves to next row of the scan.  When moving to the next page,
+// pages whose summary shows that no row in them can match
+// are skipped without being read
+int scan_next_row(struct dblog_read_context *rctx, struct dblog_scan *scan) {
+  byte resv = rctx->page_resv_bytes;
+  if (resv < DBLOG_SUMM_HDR_LEN || rctx->cur_rec_pos + 1 < read_uint16(rctx->buf + 3))
+    return dblog_read_next_row(rctx);
+  byte summ[resv];
+  uint32_t next_page;
+  while (!get_next_page_no(rctx, &next_page)) {
+    if (read_page_summary(rctx, next_page, summ))
+      break;
+    int res = summary_may_match(summ, scan);
+    if (res < 0)
+      return DBLOG_RES_NOT_FOUND;
+    if (res)
+      break;
+    rctx->cur_page = next_page;
+    scan->pages_skipped++;
+  }
+  return dblog_read_next_row(rctx);
+}
+
+// Compares key of current row with key_from (which = 0) or key_to
+int compare_scan_key(struct dblog_read_context *rctx, struct dblog_scan *scan,
+      int which, int *out_cmp) {
+  int key_col = scan->key_col_idx < 0 ? -1 : scan->key_col_idx;
+  uint32_t col_types[key_col + 2];
+  byte *col_ptrs[key_col + 2];
+  int32_t limit = get_pagesize(rctx->page_size_exp) - rctx->page_resv_bytes;
+  if (read_rec_cols(rctx->buf, rctx->cur_rec_pos, limit, key_col, col_types, col_ptrs))
+    return DBLOG_RES_MALFORMED;
+  *out_cmp = compare_pred(&scan->key_pred, which, col_types[key_col + 1],
+               col_ptrs[key_col + 1], col_types[0]);
   return DBLOG_RES_OK;
 }
 
+// Moves from current row to the first row that matches
+// all conditions of the scan, checking that key is within key_to
+int scan_to_match(struct dblog_read_context *rctx, struct dblog_scan *scan) {
+  int32_t limit = get_pagesize(rctx->page_size_exp) - rctx->page_resv_bytes;
+  uint32_t col_types[scan->max_col + 2];
+  byte *col_ptrs[scan->max_col + 2];
+  do {
+    if (read_rec_cols(rctx->buf, rctx->cur_rec_pos, limit, scan->max_col, col_types, col_ptrs))
+      return DBLOG_RES_MALFORMED;
+    if (scan->key_to) {
+      int key_col = (scan->key_col_idx < 0 ? -1 : scan->key_col_idx) + 1;
+      int cmp = compare_pred(&scan->key_pred, scan->key_from ? 1 : 0,
+                  col_types[key_col], col_ptrs[key_col], col_types[0]);
+      if (cmp > 0)
+        return DBLOG_RES_NOT_FOUND; // rest of the rows have larger keys
+    }
+    byte i = 0;
+    while (i < scan->pred_count && pred_matches(&scan->preds[i], col_types, col_ptrs))
+      i++;
+    if (i == scan->pred_count)
+      return DBLOG_RES_OK;
+  } while (scan_next_row(rctx, scan) == DBLOG_RES_OK);
+  return DBLOG_RES_NOT_FOUND;
+}
+
+// See .h file for API description
+int dblog_scan_first(struct dblog_read_context *rctx, struct dblog_scan *scan) {
+  struct dblog_pred *key_pred = &scan->key_pred;
+  key_pred->col_idx = scan->key_col_idx < 0 ? -1 : scan->key_col_idx;
+  key_pred->val_type = scan->key_col_idx < 0 ? DBLOG_TYPE_INT : scan->key_type;
+  key_pred->val = scan->key_from ? scan->key_from : scan->key_to;
+  key_pred->len = scan->key_from ? scan->key_from_len : scan->key_to_len;
+  key_pred->val2 = scan->key_to;
+  key_pred->len2 = scan->key_to_len;
+  prepare_pred(key_pred);
+  scan->max_col = key_pred->col_idx;
+  scan->pages_skipped = 0;
+  for (byte i = 0; i < scan->pred_count; i++) {
+    prepare_pred(&scan->preds[i]);
+    if (scan->preds[i].col_idx > scan->max_col)
+      scan->max_col = scan->preds[i].col_idx;
+  }
+  int res;
+  if (!scan->key_from)
+    return dblog_read_first_row(rctx) ? DBLOG_RES_NOT_FOUND : scan_to_match(rctx, scan);
+  if (scan->key_col_idx < 0) {
+    uint32_t rowid = key_pred->i64[0] < 0 ? 0 : (key_pred->i64[0] > UINT32_MAX
+                       ? UINT32_MAX : (uint32_t) key_pred->i64[0]);
+    res = dblog_bin_srch_row_by_val(rctx, 0, DBLOG_TYPE_INT, &rowid, 4, 1);
+  } else
+    res = dblog_bin_srch_row_by_val(rctx, scan->key_col_idx, scan->key_type,
+            (void *) scan->key_from, scan->key_from_len, 0);
+  if (res)
+    return res;
+  // Binary search stops at any row having same key or near the
+  // closest, so move back over same keys and forward to the first
+  int cmp;
+  do {
+    res = compare_scan_key(rctx, scan, 0, &cmp);
+    if (res)
+      return res;
+  } while (cmp >= 0 && dblog_read_prev_row(rctx) == DBLOG_RES_OK);
+  while (cmp < 0) {
+    if (dblog_read_next_row(rctx))
+      return DBLOG_RES_NOT_FOUND;
+    res = compare_scan_key(rctx, scan, 0, &cmp);
+    if (res)
+      return res;
+  }
+  return scan_to_match(rctx, scan);
+}
+
+// See .h file for API description
+int dblog_scan_next(struct dblog_read_context *rctx, struct dblog_scan *scan) {
+  if (scan_next_row(rctx, scan))
+    return DBLOG_RES_NOT_FOUND;
+  return scan_to_match(rctx, scan);
+}
+
+// Returns data of section of given kind for given column in page
+// summary, taking aggregate section as zone section too
+byte *find_summary_data(byte *summ, byte resv, int col_idx, byte kind) {
+  if (col_idx < 0 || check_page_summary(summ, resv))
+    return NULL;
+  byte min_len = (kind == DBLOG_SUMM_AGG ? DBLOG_AGG_DATA_LEN : DBLOG_ZONE_DATA_LEN);
+  byte *end = summ + DBLOG_SUMM_HDR_LEN + summ[1];
+  byte *sec = summ + DBLOG_SUMM_HDR_LEN;
+  for (; sec + 3 <= end && sec + 3 + sec[2] <= end; sec += 3 + sec[2]) {
+    if ((sec[0] == kind || (kind == DBLOG_SUMM_ZONE && sec[0] == DBLOG_SUMM_AGG))
+          && sec[1] == col_idx && sec[2] >= min_len)
+      return sec + 3;
+  }
+  return NULL;
+}
+
+// Adds integer values to the aggregate
+void add_agg_int(struct dblog_agg *agg, int64_t min, int64_t max, int64_t sum, uint32_t count) {
+  if (!agg->int_count || min < agg->min)
+    agg->min = min;
+  if (!agg->int_count || max > agg->max)
+    agg->max = max;
+  agg->sum += sum;
+  agg->int_count += count;
+}
+
+// Adds real values to the aggregate
+void add_agg_real(struct dblog_agg *agg, double min, double max, double sum, uint32_t count) {
+  if (!agg->is_real || min < agg->min_dbl)
+    agg->min_dbl = min;
+  if (!agg->is_real || max > agg->max_dbl)
+    agg->max_dbl = max;
+  agg->sum_dbl += sum;
+  agg->count += count;
+  agg->is_real = 1;
+}
+
+// Adds page from its aggregate section data
+void add_agg_page(struct dblog_agg *agg, byte *data) {
+  uint16_t count = read_uint16(data + 17);
+  if (count && data[0] == 6)
+    add_agg_int(agg, read_int_val(data + 1, 6), read_int_val(data + 9, 6),
+      read_int_val(data + 19, 6), count);
+  else if (count && data[0] == 7)
+    add_agg_real(agg, read_double(data + 1), read_double(data + 9),
+      read_double(data + 19), count);
+  agg->pages_summarized++;
+}
+
+// Checks whether key of the last row of current page is within key_to
+int is_last_key_within(struct dblog_read_context *rctx, struct dblog_scan *scan,
+      int32_t limit) {
+  if (!scan->key_to)
+    return 1;
+  int key_col = scan->key_pred.col_idx;
+  uint32_t col_types[key_col + 2];
+  byte *col_ptrs[key_col + 2];
+  if (read_rec_cols(rctx->buf, read_uint16(rctx->buf + 3) - 1, limit,
+        key_col, col_types, col_ptrs))
+    return 0;
+  int cmp = compare_pred(&scan->key_pred, scan->key_from ? 1 : 0,
+              col_types[key_col + 1], col_ptrs[key_col + 1], col_types[0]);
+  return cmp != DBLOG_RES_TYPE_MISMATCH && cmp <= 0;
+}
+
+// See .h file for API description
+int dblog_agg_range(struct dblog_read_context *rctx, struct dblog_scan *scan,
+      int col_idx, struct dblog_agg *agg) {
+  memset(agg, '\0', sizeof(struct dblog_agg));
+  int32_t limit = get_pagesize(rctx->page_size_exp) - rctx->page_resv_bytes;
+  byte resv = rctx->page_resv_bytes;
+  byte summ[resv ? resv : 1];
+  int res = dblog_scan_first(rctx, scan);
+  while (res == DBLOG_RES_OK) {
+    uint16_t rec_count = read_uint16(rctx->buf + 3);
+    byte *data = NULL;
+    if (!scan->pred_count && rctx->cur_rec_pos == 0)
+      data = find_summary_data(rctx->buf + limit, resv, col_idx, DBLOG_SUMM_AGG);
+    if (data && is_last_key_within(rctx, scan, limit)) {
+      add_agg_page(agg, data);
+      rctx->cur_rec_pos = rec_count - 1;
+    } else {
+      uint32_t col_type;
+      byte *val_at = (byte *) dblog_read_col_val(rctx, col_idx, &col_type);
+      if (val_at && col_type == 7) {
+        double dval = read_double(val_at);
+        add_agg_real(agg, dval, dval, dval, 1);
+      } else if (val_at && col_type >= 1 && col_type <= 9) {
+        int64_t ival = read_int_val(val_at, col_type);
+        add_agg_int(agg, ival, ival, ival, 1);
+      }
+      agg->rows_decoded++;
+    }
+    // Following pages wholly within range are taken from their
+    // summary without reading them, if max of key is known
+    uint32_t next_page;
+    while (!scan->pred_count && rctx->cur_rec_pos == rec_count - 1
+             && !get_next_page_no(rctx, &next_page)
+             && !read_page_summary(rctx, next_page, summ)) {
+      data = find_summary_data(summ, resv, col_idx, DBLOG_SUMM_AGG);
+      byte *zone = find_summary_data(summ, resv, scan->key_pred.col_idx, DBLOG_SUMM_ZONE);
+      if (!data || (scan->key_to && (!zone || !zone[0])))
+        break;
+      if (scan->key_to) {
+        int cmp = compare_pred(&scan->key_pred, scan->key_from ? 1 : 0, zone[0], zone + 9, 0);
+        if (cmp == DBLOG_RES_TYPE_MISMATCH || cmp > 0)
+          break;
+      }
+      add_agg_page(agg, data);
+      rctx->cur_page = next_page;
+    }
+    res = scan_next_row(rctx, scan);
+    if (!res)
+      res = scan_to_match(rctx, scan);
+  }
+  agg->count += agg->int_count;
+  if (agg->is_real && agg->int_count) {
+    agg->sum_dbl += agg->sum;
+    if (agg->min < agg->min_dbl)
+      agg->min_dbl = agg->min;
+    if (agg->max > agg->max_dbl)
+      agg->max_dbl = agg->max;
+  } else if (!agg->is_real) {
+    agg->sum_dbl = agg->sum;
+    agg->min_dbl = agg->min;
+    agg->max_dbl = agg->max;
+  }
+  return res == DBLOG_RES_NOT_FOUND ? DBLOG_RES_OK : res;
+}
+
 // See .h file for API description
 int dblog_upd_col_val(struct dblog_read_context *rctx, int col_idx, const void *val) {
   uint8_t *buf = rctx->buf;
-  if (buf[0] != 13)
+  if (rctx->map || buf[0] != 13)
     return DBLOG_RES_ERR;
   int16_t rec_count = read_uint16(rctx->buf + 3);
   if (rec_count <= rctx->cur_rec_pos)
@@ -1514,7 +4318,38 @@ int dblog_upd_col_val(struct dblog_read_context *rctx, int col_idx, const void *
 
 int dblog_write_cur_page(struct dblog_read_context *rctx, write_fn_def write_fn) {
   struct dblog_write_context wctx;
+  memset(&wctx, '\0', sizeof(wctx));
   wctx.buf = rctx->buf;
   wctx.write_fn = write_fn;
+  // Summary is formed again for the same columns as updated
+  // value may change their min or max
+  int32_t page_size = get_pagesize(rctx->page_size_exp);
+  byte resv = rctx->page_resv_bytes;
+  byte *summ = rctx->buf + page_size - resv;
+  byte zone_cols[resv ? resv : 1];
+  byte bloom_cols[resv ? resv : 1];
+  byte agg_cols[resv ? resv : 1];
+  if (!check_page_summary(summ, resv)) {
+    byte *end = summ + DBLOG_SUMM_HDR_LEN + summ[1];
+    byte *sec = summ + DBLOG_SUMM_HDR_LEN;
+    for (; sec + 3 <= end && sec + 3 + sec[2] <= end; sec += 3 + sec[2]) {
+      if (sec[0] == DBLOG_SUMM_ZONE)
+        zone_cols[wctx.zone_col_count++] = sec[1];
+      if (sec[0] == DBLOG_SUMM_BLOOM) {
+        bloom_cols[wctx.bloom_col_count++] = sec[1];
+        wctx.bloom_bytes = sec[2];
+      }
+      if (sec[0] == DBLOG_SUMM_AGG)
+        agg_cols[wctx.agg_col_count++] = sec[1];
+    }
+    wctx.zone_cols = zone_cols;
+    wctx.bloom_cols = bloom_cols;
+    wctx.agg_cols = agg_cols;
+    wctx.page_resv_bytes = resv;
+    write_page_summary(&wctx, rctx->buf, page_size);
+  }
+  if (rctx->cache_pages)
+    uncache_page(rctx, rctx->cur_page);
+  rctx->ra_count = 0;
   return write_page(&wctx, rctx->cur_page, get_pagesize(rctx->page_size_exp));
 }
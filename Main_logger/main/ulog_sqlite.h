@@ -34,6 +34,66 @@
 
 extern const char sqlite_sig[16];
 
+// 0 - Pages are always written by the calling task
+// 1 - dblog_async_start() can be used to hand over full pages
+//     to a writer task (FreeRTOS task on ESP-IDF, pthread otherwise)
+#define DBLOG_CFG_ASYNC_WRITE 1
+
+// 0 - No tail marker, recovery probes all pages from the beginning
+// n - After every n full pages reach the disk, they are flushed and
+//     their position is noted in the first page, so that recovery
+//     only needs to look at pages written after that
+#define DBLOG_CFG_TAIL_MARK_INTERVAL 16
+
+// No. of erase blocks ahead of the page being written that are
+// erased using erase_fn, if erase_block_exp and erase_fn are given
+#define DBLOG_CFG_ERASE_AHEAD 2
+
+// Length of the state record read and written using state_read_fn
+// and state_write_fn, if given
+#define DBLOG_STATE_REC_LEN 17
+
+// Reserved bytes needed in each page for summary of zone_col_count
+// columns (see zone_cols of dblog_write_context)
+#define DBLOG_SUMM_RESV_LEN(zone_col_count) (4 + (zone_col_count) * 20)
+
+// Additional reserved bytes needed for Bloom filters of bloom_col_count
+// columns (see bloom_cols of dblog_write_context)
+#define DBLOG_BLOOM_RESV_LEN(bloom_col_count, bloom_bytes) \
+          ((bloom_col_count) * (3 + (bloom_bytes)))
+
+// Additional reserved bytes needed for count, min, max and sum
+// of agg_col_count columns (see agg_cols of dblog_write_context)
+#define DBLOG_AGG_RESV_LEN(agg_col_count) ((agg_col_count) * 30)
+
+// 0 - Pages are always read using read_fn
+// 1 - dblog_read_map_file() can be used to read pages in place from
+//     the memory mapped file (POSIX hosts only, not on ESP-IDF)
+#ifndef DBLOG_CFG_MMAP_READ
+#ifdef ESP_PLATFORM
+#define DBLOG_CFG_MMAP_READ 0
+#else
+#define DBLOG_CFG_MMAP_READ 1
+#endif
+#endif
+
+// No. of pages ahead of a scan on a mapped file that
+// the OS is asked to load (see dblog_read_map_file())
+#define DBLOG_CFG_MMAP_READAHEAD 64
+
+// Attribute for variables that should be retained during deep sleep,
+// such as wctx->buf and struct dblog_retained (see dblog_retain())
+// On hosts other than ESP-IDF, static memory that is not
+// re-initialized between simulated sleeps stands in for RTC memory
+#ifndef DBLOG_RETAINED_ATTR
+#ifdef ESP_PLATFORM
+#include "esp_attr.h"
+#define DBLOG_RETAINED_ATTR RTC_NOINIT_ATTR
+#else
+#define DBLOG_RETAINED_ATTR
+#endif
+#endif
+
 // Not implemented yet
 // 0 - No checking
 // 1 - Check if page checksum matches everytime page is loaded
@@ -57,7 +117,17 @@ enum {DBLOG_RES_OK = 0, DBLOG_RES_ERR = -1, DBLOG_RES_INV_PAGE_SZ = -2,
 enum {DBLOG_RES_SEEK_ERR = -6, DBLOG_RES_READ_ERR = -7,
   DBLOG_RES_INVALID_SIG = -8, DBLOG_RES_MALFORMED = -9,
   DBLOG_RES_NOT_FOUND = -10, DBLOG_RES_NOT_FINALIZED = -11,
-  DBLOG_RES_TYPE_MISMATCH = -12, DBLOG_RES_INV_CHKSUM = -13};
+  DBLOG_RES_TYPE_MISMATCH = -12, DBLOG_RES_INV_CHKSUM = -13,
+  DBLOG_RES_DROPPED = -14};
+
+// Point upto which a database being written can be read by other tasks,
+// updated by the writer each time pages are flushed
+// See dblog_read_snapshot()
+struct dblog_snapshot {
+  uint32_t seq;       // odd while being updated
+  uint32_t last_page; // last leaf page flushed, 0 if none
+  uint32_t last_rowid; // Row ID of last row flushed
+};
 
 // Write context to be passed to create / append
 // a database.  The running values need not be supplied
@@ -65,18 +135,76 @@ struct dblog_write_context {
   byte *buf;          // working buffer of size page_size
   byte col_count;     // No. of columns (whether fits into page is not checked)
   byte page_size_exp; // 9=512, 10=1024 and so on upto 16=65536
-  byte max_pages_exp; // Maximum data pages (as exponent of 2) after which
-                      //   to roll. 0 means no max. Not implemented yet.
+  byte max_pages_exp; // Maximum leaf pages (as exponent of 2) after which
+                      //   to wrap around and overwrite the oldest pages
+                      //   0 means no max.  spine_buf is not used if set
   byte page_resv_bytes; // Reserved bytes at end of every page (say checksum)
   // read_fn and write_fn should return no. of bytes read or written
   int32_t (*read_fn)(struct dblog_write_context *ctx, void *buf, uint32_t pos, size_t len);
   int32_t (*write_fn)(struct dblog_write_context *ctx, void *buf, uint32_t pos, size_t len);
   int (*flush_fn)(struct dblog_write_context *ctx); // Success if returns 0
+                      //   Called by dblog_flush(), before updating the tail
+                      //   marker and by dblog_finalize(), dblog_recover(),
+                      //   dblog_partial_finalize() and dblog_drop_oldest()
+                      //   both before and after writing the first page, so
+                      //   that it never points to pages not yet stored
+  byte *stage_buf;    // Optional staging area of stage_pages * page_size bytes
+                      //   where consecutive full pages are gathered and
+                      //   written with a single write_fn call
+  byte stage_pages;   // No. of pages in stage_buf. 0 means no staging
+  byte *spine_buf;    // Optional buffer of spine_levels * page_size bytes
+                      //   to form the right most interior pages as leaf
+                      //   pages are written, so that finalize need not
+                      //   read all the leaf pages
+  byte spine_levels;  // Max interior levels in spine_buf. 0 means not used
+  byte erase_block_exp; // Flash erase block size (as exponent of 2, 12=4096)
+                      //   First page is kept alone in its erase block and
+                      //   leaf pages start at the next. 0 means not aligned
+  // Optional, erases given range ahead of the pages being written
+  // so that write_fn need not erase before writing. Success if returns 0
+  int (*erase_fn)(struct dblog_write_context *ctx, uint32_t pos, size_t len);
+  // Optional, read / write the small state record of DBLOG_STATE_REC_LEN
+  // bytes kept outside the database (say NVS or another file).  If given,
+  // the first page is not written until finalize and the tail marker
+  // is kept in the state record.  Should return no. of bytes read or written
+  int32_t (*state_read_fn)(struct dblog_write_context *ctx, void *buf, size_t len);
+  int32_t (*state_write_fn)(struct dblog_write_context *ctx, void *buf, size_t len);
+  const byte *zone_cols; // Optional, columns for which min and max of numeric
+                      //   values in each leaf page are kept in its reserved
+                      //   bytes, so that scans can skip pages without reading.
+                      //   page_resv_bytes should be at least
+                      //   DBLOG_SUMM_RESV_LEN(zone_col_count)
+  byte zone_col_count; // No. of columns in zone_cols
+  const byte *bloom_cols; // Optional, columns for which a Bloom filter of
+                      //   bloom_bytes of values in each leaf page is kept
+                      //   in its reserved bytes, so that scans for equal
+                      //   value can skip pages not having it.  page_resv_bytes
+                      //   should be at least DBLOG_SUMM_RESV_LEN(zone_col_count)
+                      //   + DBLOG_BLOOM_RESV_LEN(bloom_col_count, bloom_bytes)
+  byte bloom_col_count; // No. of columns in bloom_cols
+  byte bloom_bytes;   // Size of each Bloom filter, say 16 for 100 values
+  const byte *agg_cols; // Optional, numeric columns for which count, min, max
+                      //   and sum of each leaf page are kept in its reserved
+                      //   bytes for dblog_agg_range().  Also used as zone_cols
+                      //   Needs DBLOG_AGG_RESV_LEN(agg_col_count) more bytes
+  byte agg_col_count; // No. of columns in agg_cols
+  struct dblog_snapshot *snapshot; // Optional, updated after every flush
+                      //   for readers using dblog_read_snapshot()
   // following are running values used internally
   uint32_t cur_write_page;
   uint32_t cur_write_rowid;
+  uint32_t stage_first_page;
+  byte stage_count;
+  byte spine_height;
+  uint32_t tail_mark_page;
+  uint32_t first_leaf_page; // oldest page once wrapped around, else 0
+  byte ring_reuse;    // ring formed by dblog_drop_oldest(), which grows
+                      //   instead of overwriting the oldest page
+  uint32_t last_leaf_written; // last full leaf page written, 0 if none
+                      //   in this session (interior pages may follow it)
   byte state;
   int err_no;
+  void *async_writer; // set by dblog_async_start()
 };
 
 typedef int32_t (*write_fn_def)(struct dblog_write_context *ctx, void *buf, uint32_t pos, size_t len);
@@ -94,10 +222,24 @@ int dblog_write_init_with_script(struct dblog_write_context *wctx,
 
 // Initalizes database - resets signature on first page
 // positions at last page for writing
+// If spine_buf is used and the database was finalized using it,
+// right most interior pages are loaded into it to continue
 // If this returns DBLOG_RES_NOT_FINALIZED,
 // call dblog_finalize() to first finalize the database
+// If state_write_fn is given, the first page is left as is
+// and the database is marked open in the state record instead
 int dblog_init_for_append(struct dblog_write_context *wctx);
 
+// Opens database for appending using only the state record and the
+// last page, without reading or writing the first page.  Needs
+// state_read_fn and state_write_fn.  If the database was not finalized
+// (such as after power loss), the last page is located as in dblog_resume()
+// If the state record is not valid, same as dblog_init_for_append()
+// Till finalized, the first page describes the database as it was
+// last finalized and the file cannot be read by Sqlite
+// Right most interior pages are not loaded into spine_buf
+int dblog_open_for_append(struct dblog_write_context *wctx);
+
 // Creates new record with all columns null
 // If no more space in page, writes it to disk
 // creates new page, and creates a new record
@@ -109,6 +251,40 @@ int dblog_append_empty_row(struct dblog_write_context *wctx);
 int dblog_append_row_with_values(struct dblog_write_context *wctx,
       uint8_t types[], const void *values[], uint16_t lengths[]);
 
+// Creates row_count new records from values given column by column
+// values[i] points to row_count values of column i placed lengths[i] bytes
+// apart, or is NULL if column i is null in all the rows
+// For TEXT and BLOB columns, row_lengths[i] may point to the length
+// of each value, in which case lengths[i] is only the distance between values
+// row_lengths itself may be NULL if all values are of fixed length
+// Record headers are formed once per row and rows are packed into the
+// current page in one pass. Full pages are written to disk as needed
+// No. of rows appended is returned in out_rows_appended.  If an error
+// is returned, such as DBLOG_RES_TOO_LONG for a row that does not fit
+// in a page, the rows before it remain appended, some of them already
+// written to disk, and appending can resume from that row
+int dblog_append_rows_columnar(struct dblog_write_context *wctx, uint32_t row_count,
+      const uint8_t types[], const void *values[], const uint16_t lengths[],
+      const uint16_t *row_lengths[], uint32_t *out_rows_appended);
+
+// Creates new record from given record body, which is the header length
+// (as 2 byte varint), column types and column data in Sqlite record format
+// See https://www.sqlite.org/fileformat.html#record_format
+// Used by ulog_sqlite.hpp to append rows encoded at compile time
+// If no more space in page, writes it to disk
+// creates new page, and creates a new record
+int dblog_append_encoded_row(struct dblog_write_context *wctx,
+      const void *rec, uint16_t rec_len);
+
+// Forms the record body taken by dblog_append_encoded_row() from
+// col_count values given as in dblog_append_row_with_values()
+// Does not need the write context, so rows can be encoded
+// by other tasks, such as for ulog_ingest.h
+// Returns length of record or DBLOG_RES_TOO_LONG if more than rec_size
+// If rec is NULL, only the length is found and nothing is written
+int dblog_encode_row(int col_count, const uint8_t types[],
+      const void *values[], const uint16_t lengths[], void *rec, uint16_t rec_size);
+
 // Sets value of column in the current record for the given column index
 // If no more space in page, writes it to disk
 // creates new page, and moves the row to new page
@@ -124,8 +300,22 @@ const void *dblog_get_col_val(struct dblog_write_context *wctx, int col_idx, uin
 // Page is written only when it becomes full
 // If it needs to be written for each record or column,
 // this can be used
+// Any pages held in stage_buf are written first
+// Also waits for page being written by the writer task, if started
 int dblog_flush(struct dblog_write_context *wctx);
 
+// Starts a writer task to which full pages are handed over
+// so that appending rows does not wait for the page to be written.
+// page_buf should be of page size and holds the page being written
+// Should be called after dblog_write_init() or dblog_init_for_append()
+// Errors from the writer task are returned by the next append
+// that fills a page, or by dblog_flush() / dblog_async_stop()
+int dblog_async_start(struct dblog_write_context *wctx, byte *page_buf);
+
+// Waits for the page being written and stops the writer task
+// Returns the first error reported by the writer task, if any
+int dblog_async_stop(struct dblog_write_context *wctx);
+
 // Flushes data written so far and Updates the last leaf page number
 // in the first page to enable Binary Search
 int dblog_partial_finalize(struct dblog_write_context *wctx);
@@ -133,16 +323,85 @@ int dblog_partial_finalize(struct dblog_write_context *wctx);
 // Based on the data written so far, forms Interior B-Tree pages
 // according to SQLite format and update the root page number
 // in the first page.
+// If spine_buf is used, interior pages that become full are written
+// in between leaf pages as data is written and only the right most
+// interior pages are written here
 int dblog_finalize(struct dblog_write_context *wctx);
 
+// Positions at the last page of a database that was not finalized,
+// such as after power loss, so that logging can continue without
+// first forming the interior pages.  The last page is located using
+// the tail marker and only pages written after it are checked.
+// A page torn while being written fails its checksum and is overwritten.
+// If the database is already finalized, same as dblog_init_for_append()
+int dblog_resume(struct dblog_write_context *wctx);
+
+// Running values of write context kept in retained memory
+// along with wctx->buf during deep sleep
+struct dblog_retained {
+  uint32_t cur_write_page;
+  uint32_t cur_write_rowid;
+  uint32_t tail_mark_page;
+  uint32_t first_leaf_page;
+  uint32_t last_leaf_written;
+  byte page_size_exp;
+  byte max_pages_exp;
+  byte erase_block_exp;
+  byte ring_reuse;
+  byte state;
+  uint32_t chk_sum; // of above values and the page in wctx->buf
+};
+
+// Saves running values into ret before going to deep sleep without
+// writing the current page, which is written only once full.
+// wctx->buf and ret should be in retained memory (DBLOG_RETAINED_ATTR)
+// Pages in stage_buf are written, full pages written are flushed using
+// flush_fn and the writer task, if started, is stopped.
+// Rows in the current page are lost on power loss or reset
+int dblog_retain(struct dblog_write_context *wctx, struct dblog_retained *ret);
+
+// Restores running values saved by dblog_retain() after wake up
+// so that rows can be appended to the page in wctx->buf.
+// Returns DBLOG_RES_INV_CHKSUM if ret or wctx->buf is not intact,
+// such as after power on, in which case dblog_open_for_append() or
+// dblog_resume() can be used.  ret is invalidated so that it is not
+// restored again if reset before the next dblog_retain().
+// Right most interior pages are not kept in spine_buf
+int dblog_restore(struct dblog_write_context *wctx, struct dblog_retained *ret);
+
 // Returns 1 if the database is in unfinalized state
+// If state_read_fn is given, the state record is checked
 int dblog_not_finalized(struct dblog_write_context *wctx);
 
 // Reads page size from database if not known
 int32_t dblog_read_page_size(struct dblog_write_context *wctx);
 
+// Drops leaf pages having only rows with Row ID less than keep_rowid
+// from a finalized database by forming the interior pages again over
+// the remaining leaf pages, without moving any of them.  The new
+// interior pages are written over pages already free (or after the
+// last page if there are not enough) and dropped pages are added to
+// the Sqlite freelist, so the file stays readable by Sqlite.
+// Only the interior pages are read, so the time taken does not depend
+// on the no. of rows dropped.  The last leaf page is never dropped.
+// page_buf should be of page size and different from wctx->buf
+// Not supported if max_pages_exp (which drops oldest pages anyway),
+// spine_buf or erase_fn was used.  No. of pages added to freelist is
+// returned in out_pages_freed.  dblog_init_for_append() can be used
+// to continue logging, after which leaf pages wrap around over the
+// pages dropped as with max_pages_exp, so the file does not grow if
+// oldest rows are dropped as fast as rows are added.  Unlike
+// max_pages_exp, no page is overwritten: once no dropped page is left,
+// the ring is doubled, copying the pages that had wrapped around.
+// The file does not shrink, which needs VACUUM by stock Sqlite
+int dblog_drop_oldest(struct dblog_write_context *wctx, uint32_t keep_rowid,
+      byte *page_buf, uint32_t *out_pages_freed);
+
 // Recovers database pointed by given context
 // and finalizes it
+// The last page is located using the tail marker as in dblog_resume()
+// If state_read_fn is given, the state record is used as in
+// dblog_open_for_append()
 int dblog_recover(struct dblog_write_context *wctx);
 
 // Read context to be passed to read from a database created using this library.
@@ -151,21 +410,90 @@ struct dblog_read_context {
   byte *buf;
   // read_fn should return no. of bytes read
   int32_t (*read_fn)(struct dblog_read_context *ctx, void *buf, uint32_t pos, size_t len);
+  byte *cache_buf;    // Optional page cache of DBLOG_CACHE_BUF_SIZE(cache_pages,
+                      //   page_size) bytes.  Least recently used page is
+                      //   replaced, but interior pages are kept as long as
+                      //   there are leaf pages to replace
+  byte cache_pages;   // No. of pages in cache_buf. 0 means no cache
+  byte *ra_buf;       // Optional readahead window of ra_pages * page_size
+                      //   bytes.  When next / prev row crosses into a page
+                      //   not in it, ra_pages pages in the direction of scan
+                      //   are read into it using a single read_fn call
+  byte ra_pages;      // No. of pages in ra_buf. 0 means no readahead
+  const byte *map;    // File mapped by dblog_read_map_file(), else NULL
+  size_t map_len;
+  // Optional, reads the state record kept by a writer using state_write_fn
+  // so that dblog_read_snapshot() can find rows appended since the
+  // database was last finalized.  Should return no. of bytes read
+  int32_t (*state_read_fn)(struct dblog_read_context *ctx, void *buf, size_t len);
   // following are running values used internally
+  uint32_t ra_first_page;
+  byte ra_count;
+  uint32_t map_advised_page;
+  uint32_t cache_tick;
+  uint32_t cache_hits;   // reads served from cache_buf
+  uint32_t cache_misses; // pages read into cache_buf using read_fn
   uint32_t last_leaf_page;
+  uint32_t snap_rowid; // last Row ID visible if opened as snapshot, else 0
+  uint32_t first_leaf_page;
+  uint32_t leaf_base_page;
   uint32_t root_page;
   uint32_t cur_page;
   uint16_t cur_rec_pos;
   byte page_size_exp;
   byte page_resv_bytes;
+  byte max_pages_exp;
 };
 
+// Size of cache_buf for given no. of pages and page size
+// 8 bytes per page are used to note page no. and last use
+#define DBLOG_CACHE_BUF_SIZE(pages, page_size) ((pages) * ((page_size) + 8))
+
+// Same as dblog_read_init(), but maps the file at given path into
+// memory instead of using read_fn.  Pages are used in place, so
+// rctx->buf points into the mapping and values returned by
+// dblog_read_col_val() are not copied.  buf need not be given.
+// During dblog_read_next_row() / dblog_read_prev_row(), the OS is
+// asked to load DBLOG_CFG_MMAP_READAHEAD pages ahead of the scan
+// The mapping is read only, so dblog_upd_col_val() cannot be used
+// Available if DBLOG_CFG_MMAP_READ is 1
+int dblog_read_map_file(struct dblog_read_context *rctx, const char *path);
+
+// Unmaps file mapped by dblog_read_map_file()
+int dblog_read_unmap(struct dblog_read_context *rctx);
+
 // Reads a database created using this library,
 // checks signature and positions at the first record.
+// If max_pages_exp was used for writing, the database should be
+// finalized or partially finalized so that the oldest and latest
+// pages are known, and rows are read from the oldest page
 // Cannot be used to read SQLite databases
 // not created using this library or modified using other libraries
+// Clears cache_buf and its hit / miss counts, if cache is used
+// and the readahead window, if used
 int dblog_read_init(struct dblog_read_context *rctx);
 
+// Same as dblog_read_init(), but for a database still being written,
+// without waiting for the writer or finalize.  Rows upto the point
+// noted in snap by the writer (see wctx->snapshot) are visible, or if
+// snap is NULL (or not yet updated), upto the tail marker (when the writer
+// is in another process), which is updated once in
+// DBLOG_CFG_TAIL_MARK_INTERVAL pages.  If the writer uses state_write_fn,
+// the first page stays as last finalized and the tail marker is kept
+// in the state record, so rctx->state_read_fn should be given when snap
+// is NULL, else only the rows upto the last finalize are visible.
+// The last page flushed may be written again by the writer as it
+// fills, so rows after the point are hidden from the page read.
+// Reading rows in order, dblog_bin_srch_row_by_val() (also for Row ID),
+// scans and aggregates work as if the database was partially finalized
+// at the point.  dblog_srch_row_by_id() needs the interior pages
+// and returns DBLOG_RES_NOT_FINALIZED.  Call again to see
+// rows flushed since.  Same as dblog_read_init() if the database is
+// finalized and no later point is known from snap or the state record.
+// Not supported for mapped file or if max_pages_exp is used
+// Returns DBLOG_RES_NOT_FOUND if no row is flushed yet
+int dblog_read_snapshot(struct dblog_read_context *rctx, struct dblog_snapshot *snap);
+
 // Returns number of columns in the current record
 int dblog_cur_row_col_count(struct dblog_read_context *rctx);
 
@@ -180,6 +508,24 @@ const void *dblog_read_col_val(struct dblog_read_context *rctx, int col_idx, uin
 // returned by dblog_read_col_val() to get the actual length
 uint32_t dblog_derive_data_len(uint32_t col_type);
 
+// Decodes given columns of up to max_rows rows of the current page,
+// starting from the current row, parsing each record header once
+// col_idxs[i] is the column index (-1 for Row ID) to be placed in
+// values[i] in native form according to types[i] and lengths[i]:
+//   DBLOG_TYPE_INT - int8_t, int16_t, int32_t or int64_t for length 1 to 8
+//   DBLOG_TYPE_REAL - float or double for length 4 or 8
+//   DBLOG_TYPE_TEXT or BLOB - const void * pointing into the page,
+//     with length in row_lengths[i] if row_lengths and row_lengths[i] given
+// Null values are returned as 0 or NULL
+// Positions at the last row decoded so that dblog_read_next_row()
+// moves to the rows that follow.  Returns no. of rows decoded
+// or DBLOG_RES_TYPE_MISMATCH if text or blob is stored in a number
+// column or vice versa, or if a REAL value to be placed as INT is
+// NaN, infinite or beyond the range of int64_t
+int dblog_read_cols_batch(struct dblog_read_context *rctx, uint16_t max_rows,
+      int col_count, const int col_idxs[], const uint8_t types[],
+      void *values[], const uint8_t lengths[], uint16_t *row_lengths[]);
+
 // Positions current position at first record
 int dblog_read_first_row(struct dblog_read_context *rctx);
 
@@ -206,6 +552,98 @@ int dblog_srch_row_by_id(struct dblog_read_context *rctx, uint32_t rowid);
 int dblog_bin_srch_row_by_val(struct dblog_read_context *rctx, int col_idx,
       int val_type, void *val, uint16_t len, byte is_rowid);
 
+// Same as dblog_bin_srch_row_by_val(), but for numeric columns whose
+// values increase with Row ID, such as timestamps.  Instead of the
+// middle, the leaf page where the value is expected is read, assuming
+// values are evenly spread, so that a time series logged at regular
+// intervals is located in a few page reads.  Falls back to halving
+// the range whenever a guess does not narrow it enough
+int dblog_interp_srch_row_by_val(struct dblog_read_context *rctx, int col_idx,
+      int val_type, void *val, uint16_t len, byte is_rowid);
+
+enum {DBLOG_OP_EQ = 1, DBLOG_OP_LT, DBLOG_OP_LE, DBLOG_OP_GT, DBLOG_OP_GE,
+  DBLOG_OP_BETWEEN};
+
+// Condition on a column used by dblog_scan_first() / dblog_scan_next()
+// Values are given as for dblog_bin_srch_row_by_val(), that is,
+// native integer of len bytes for DBLOG_TYPE_INT, float or double
+// for DBLOG_TYPE_REAL and bytes for DBLOG_TYPE_TEXT / BLOB
+// Rows having null or a value of other kind in the column do not match
+struct dblog_pred {
+  int col_idx;        // -1 for Row ID
+  byte op;            // DBLOG_OP_*, BETWEEN includes both values
+  byte val_type;
+  const void *val;
+  uint16_t len;
+  const void *val2;   // upper value for DBLOG_OP_BETWEEN
+  uint16_t len2;
+  // following are running values used internally
+  int64_t i64[2];
+  double f64[2];
+  uint32_t hash; // of val for Bloom filter, if op is DBLOG_OP_EQ
+};
+
+// Range scan over rows whose key column (sorted, such as Row ID or
+// timestamp) is from key_from to key_to, returning only rows
+// matching all of preds
+struct dblog_scan {
+  int key_col_idx;    // -1 for Row ID
+  byte key_type;      // type of key_from and key_to as in struct dblog_pred
+  const void *key_from; // NULL to start from first row
+  uint16_t key_from_len;
+  const void *key_to; // NULL to scan till last row, else included
+  uint16_t key_to_len;
+  struct dblog_pred *preds; // conditions on other columns, can be NULL
+  byte pred_count;
+  // following are running values used internally
+  struct dblog_pred key_pred;
+  int max_col;
+  uint32_t pages_skipped; // pages not read as per min and max in summary
+};
+
+// Seeks to the first row having key not less than key_from using
+// binary search and positions at the first row from there that matches
+// all conditions.  Values are compared in the form stored
+// in the page, without decoding other columns of the row.
+// If zone_cols or bloom_cols was used for writing, pages that cannot
+// have rows matching conditions on those columns are skipped without
+// reading them, only reading their reserved bytes.  Bloom filters are
+// used for DBLOG_OP_EQ conditions, so that looking up rows of a value
+// (such as a device ID) reads only the pages that may have it
+// Returns DBLOG_RES_NOT_FOUND if no row matches
+// Needs database to be finalized or partially finalized if key_from is given
+int dblog_scan_first(struct dblog_read_context *rctx, struct dblog_scan *scan);
+
+// Positions at the next row that matches all conditions of the scan
+// Returns DBLOG_RES_NOT_FOUND once key exceeds key_to or no more rows
+int dblog_scan_next(struct dblog_read_context *rctx, struct dblog_scan *scan);
+
+// Count, sum, min and max of numeric values found by dblog_agg_range()
+// Null, text and blob values are not counted, as in Sqlite
+struct dblog_agg {
+  uint32_t count;
+  byte is_real;       // 1 if any value is real, then only *_dbl are valid
+  int64_t sum;
+  int64_t min;
+  int64_t max;
+  double sum_dbl;     // same as sum, min and max as double
+  double min_dbl;
+  double max_dbl;
+  uint32_t pages_summarized; // pages taken from summary without decoding
+  uint32_t rows_decoded;     // rows decoded at the edges of the range
+  // following are running values used internally
+  uint32_t int_count;
+};
+
+// Finds count, sum, min and max of given column for the rows of the
+// given scan.  If the column is in agg_cols used for writing and the
+// scan has no preds, pages wholly within the range are taken from
+// their summary, so that only the pages at the edges of the range
+// are decoded.  If the key column is also in zone_cols or agg_cols,
+// such pages are not even read except for their reserved bytes
+int dblog_agg_range(struct dblog_read_context *rctx, struct dblog_scan *scan,
+      int col_idx, struct dblog_agg *agg);
+
 // Updates value of column at current position
 // For text and blob columns, pass the type to dblog_derive_data_len()
 // to get the actual length
@@ -0,0 +1,211 @@
+/*
+  Sqlite Micro Logger - typed row schema
+
+  Header-only C++ layer over dblog_write_context for tables whose
+  column types are known at compile time, for example:
+
+    ulog::Writer<int32_t, float, ulog::Text<16>> writer(&wctx);
+    writer.append(i, temperature, ulog::Text<16>("sensor-1"));
+
+  Serial types, header bytes and maximum record length are computed
+  at compile time and each row is formed in a local buffer and added to
+  the page with a single dblog_append_encoded_row() call.
+  The C API in ulog_sqlite.h is unchanged and can be mixed with this.
+
+  Needs C++17 (if constexpr and fold expressions).  If the toolchain
+  defaults to an older standard, compile the component with -std=gnu++17.
+*/
+
+#ifndef __ULOG_SQLITE_HPP__
+#define __ULOG_SQLITE_HPP__
+
+#include <stdint.h>
+#include <string.h>
+
+#include "ulog_sqlite.h"
+
+static_assert(__cplusplus >= 201703L, "ulog_sqlite.hpp needs C++17 or later");
+
+namespace ulog {
+
+// TEXT column holding at most N bytes
+template <uint16_t N>
+struct Text {
+  const char *str;
+  uint16_t len;
+  Text(const char *s, uint16_t l) : str(s), len(l > N ? N : l) {}
+  explicit Text(const char *s) : Text(s, (uint16_t) strnlen(s, N)) {}
+};
+
+// BLOB column holding at most N bytes
+template <uint16_t N>
+struct Blob {
+  const void *data;
+  uint16_t len;
+  Blob(const void *d, uint16_t l) : data(d), len(l > N ? N : l) {}
+};
+
+namespace detail {
+
+// Returns how many bytes the given integer will
+// occupy if stored as a variable integer
+constexpr uint8_t vlen_of_uint32(uint32_t vint) {
+  return vint > 268435455 ? 5 : (vint > 2097151 ? 4
+           : (vint > 16383 ? 3 : (vint > 127 ? 2 : 1)));
+}
+
+// Stores the given uint32_t in variable integer format
+inline byte *put_vint32(byte *ptr, uint32_t vint) {
+  int len = vlen_of_uint32(vint);
+  for (int i = len - 1; i > 0; i--)
+    *ptr++ = 0x80 + ((vint >> (7 * i)) & 0x7F);
+  *ptr++ = vint & 0x7F;
+  return ptr;
+}
+
+// Stores the lower N bytes of given value in big-endian sequence
+template <int N>
+inline byte *put_be(byte *ptr, uint64_t input) {
+  for (int i = N - 1; i >= 0; i--) {
+    ptr[i] = input & 0xFF;
+    input >>= 8;
+  }
+  return ptr + N;
+}
+
+// Compile time description of how each column type is stored
+// See https://www.sqlite.org/fileformat.html#record_format
+template <typename T, uint32_t SerialType, int DataLen>
+struct FixedColumn {
+  static constexpr bool is_fixed = true;
+  static constexpr uint32_t serial_type = SerialType;
+  static constexpr uint16_t hdr_len = vlen_of_uint32(SerialType);
+  static constexpr uint16_t max_hdr_len = hdr_len;
+  static constexpr uint16_t max_data_len = DataLen;
+  static byte *put_type(byte *hdr, const T &) {
+    if (hdr_len == 1) {
+      *hdr = (byte) serial_type;
+      return hdr + 1;
+    }
+    return put_vint32(hdr, serial_type);
+  }
+};
+
+template <typename T> struct Column;
+
+template <> struct Column<int8_t> : FixedColumn<int8_t, 1, 1> {
+  static byte *put_data(byte *data, int8_t val) { return put_be<1>(data, (uint8_t) val); }
+};
+
+template <> struct Column<int16_t> : FixedColumn<int16_t, 2, 2> {
+  static byte *put_data(byte *data, int16_t val) { return put_be<2>(data, (uint16_t) val); }
+};
+
+template <> struct Column<int32_t> : FixedColumn<int32_t, 4, 4> {
+  static byte *put_data(byte *data, int32_t val) { return put_be<4>(data, (uint32_t) val); }
+};
+
+template <> struct Column<int64_t> : FixedColumn<int64_t, 6, 8> {
+  static byte *put_data(byte *data, int64_t val) { return put_be<8>(data, (uint64_t) val); }
+};
+
+// Sqlite stores REAL as 8 byte IEEE-754 double,
+// so float is widened by the compiler instead of float_to_double()
+template <> struct Column<double> : FixedColumn<double, 7, 8> {
+  static byte *put_data(byte *data, double val) {
+    uint64_t bytes;
+    memcpy(&bytes, &val, 8);
+    return put_be<8>(data, bytes);
+  }
+};
+
+template <> struct Column<float> : FixedColumn<float, 7, 8> {
+  static byte *put_data(byte *data, float val) { return Column<double>::put_data(data, val); }
+};
+
+template <typename T, uint32_t TypeBase, uint16_t N>
+struct VarColumn {
+  static constexpr bool is_fixed = false;
+  static constexpr uint16_t max_hdr_len = vlen_of_uint32(N * 2 + TypeBase);
+  static constexpr uint16_t max_data_len = N;
+  static uint16_t hdr_len_of(const T &val) {
+    return vlen_of_uint32(val.len * 2 + TypeBase);
+  }
+  static byte *put_type(byte *hdr, const T &val) {
+    return put_vint32(hdr, val.len * 2 + TypeBase);
+  }
+};
+
+template <uint16_t N> struct Column<Text<N>> : VarColumn<Text<N>, 13, N> {
+  static byte *put_data(byte *data, const Text<N> &val) {
+    memcpy(data, val.str, val.len);
+    return data + val.len;
+  }
+};
+
+template <uint16_t N> struct Column<Blob<N>> : VarColumn<Blob<N>, 12, N> {
+  static byte *put_data(byte *data, const Blob<N> &val) {
+    memcpy(data, val.data, val.len);
+    return data + val.len;
+  }
+};
+
+// Header bytes taken by a column, known at compile time for fixed columns
+template <typename T>
+inline uint16_t col_hdr_len(const T &val) {
+  if constexpr (Column<T>::is_fixed)
+    return Column<T>::hdr_len;
+  else
+    return Column<T>::hdr_len_of(val);
+}
+
+} // namespace detail
+
+// Appends rows of the given column types to the table of wctx
+// Column count of wctx is set from the schema, so the Writer should be
+// constructed before dblog_write_init() writes the table definition.
+// If wctx is initialized by dblog_init_for_append() or dblog_resume(),
+// the schema should have as many columns as the existing table
+template <typename... Cols>
+class Writer {
+ public:
+  static constexpr int col_count = sizeof...(Cols);
+  static constexpr bool all_fixed = (detail::Column<Cols>::is_fixed && ...);
+  // 2 bytes for header length, as written by the C API
+  static constexpr uint16_t max_hdr_len = 2 + (detail::Column<Cols>::max_hdr_len + ...);
+  static constexpr uint16_t max_rec_len = max_hdr_len + (detail::Column<Cols>::max_data_len + ...);
+
+  static_assert(col_count > 0 && col_count < 256, "Column count should be 1 to 255");
+  static_assert(max_hdr_len < 16384, "Record header too long");
+
+  explicit Writer(struct dblog_write_context *wctx) : wctx_(wctx) {
+    wctx_->col_count = col_count;
+  }
+
+  struct dblog_write_context *context() { return wctx_; }
+
+  // Forms the record for given values and appends it as a new row
+  // Returns DBLOG_RES_TYPE_MISMATCH if col_count of wctx was changed
+  int append(const Cols &... vals) {
+    if (wctx_->col_count != col_count)
+      return DBLOG_RES_TYPE_MISMATCH;
+    byte rec[max_rec_len];
+    uint16_t hdr_len = max_hdr_len;
+    if constexpr (!all_fixed)
+      hdr_len = 2 + (detail::col_hdr_len(vals) + ...);
+    rec[0] = 0x80 + (hdr_len >> 7);
+    rec[1] = hdr_len & 0x7F;
+    byte *hdr_ptr = rec + 2;
+    ((hdr_ptr = detail::Column<Cols>::put_type(hdr_ptr, vals)), ...);
+    byte *data_ptr = rec + hdr_len;
+    ((data_ptr = detail::Column<Cols>::put_data(data_ptr, vals)), ...);
+    return dblog_append_encoded_row(wctx_, rec, data_ptr - rec);
+  }
+
+ private:
+  struct dblog_write_context *wctx_;
+};
+
+} // namespace ulog
+
+#endif
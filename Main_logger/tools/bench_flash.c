@@ -0,0 +1,150 @@
+/*
+  Sqlite Micro Logger - host benchmark using a NOR flash timing model
+
+  Compares time spent in write_fn for plain, staged and erase block
+  aligned writing.  Flash is modelled in memory as 4 KB sectors with
+  45 ms erase and 0.7 ms to program 256 bytes.  Writing to bytes
+  already programmed costs a sector erase and reprogram of the whole
+  sector (read-modify-erase), while erase_fn erases sectors ahead of
+  the writer, off the write path.  Flash starts fully programmed.
+
+  Build and run on the host from this folder:
+
+    gcc -O2 -I../main bench_flash.c ../main/ulog_sqlite.c -lm -lpthread -o bench_flash
+    ./bench_flash [rows]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ulog_sqlite.h"
+
+#define FLASH_SIZE (64 << 20)
+#define SECTOR_EXP 12
+#define SECTOR_SIZE (1 << SECTOR_EXP)
+#define ERASE_MS 45.0
+#define PROGRAM_MS 0.7 // per 256 bytes
+#define MAX_PAGE_SIZE 4096
+#define STAGE_PAGES 8
+
+byte *flash;
+byte *programmed; // 1 for each byte programmed since erase
+double write_ms, max_write_ms, erase_ahead_ms;
+int rmw_count, erase_ahead_count;
+
+int32_t flash_read_fn_wctx(struct dblog_write_context *ctx, void *buf, uint32_t pos, size_t len) {
+  memcpy(buf, flash + pos, len);
+  return len;
+}
+
+int32_t flash_read_fn_rctx(struct dblog_read_context *ctx, void *buf, uint32_t pos, size_t len) {
+  memcpy(buf, flash + pos, len);
+  return len;
+}
+
+// Programs given bytes, erasing and reprogramming
+// the whole sector if any of them is already programmed
+int32_t flash_write_fn(struct dblog_write_context *ctx, void *buf, uint32_t pos, size_t len) {
+  double ms = 0;
+  for (uint32_t sector = pos >> SECTOR_EXP; sector <= (pos + len - 1) >> SECTOR_EXP; sector++) {
+    uint32_t start = sector << SECTOR_EXP;
+    uint32_t from = pos > start ? pos : start;
+    uint32_t to = pos + len < start + SECTOR_SIZE ? pos + len : start + SECTOR_SIZE;
+    if (memchr(programmed + from, 1, to - from)) {
+      rmw_count++;
+      ms += ERASE_MS + SECTOR_SIZE / 256 * PROGRAM_MS;
+      memset(programmed + start, 1, SECTOR_SIZE);
+    } else {
+      ms += (to - from + 255) / 256 * PROGRAM_MS;
+      memset(programmed + from, 1, to - from);
+    }
+  }
+  memcpy(flash + pos, buf, len);
+  write_ms += ms;
+  if (ms > max_write_ms)
+    max_write_ms = ms;
+  return len;
+}
+
+int flash_flush_fn(struct dblog_write_context *ctx) {
+  return 0;
+}
+
+int flash_erase_fn(struct dblog_write_context *ctx, uint32_t pos, size_t len) {
+  erase_ahead_count += len >> SECTOR_EXP;
+  erase_ahead_ms += (len >> SECTOR_EXP) * ERASE_MS;
+  memset(programmed + pos, 0, len);
+  memset(flash + pos, 0xFF, len);
+  return 0;
+}
+
+int run(const char *name, byte page_size_exp, byte stage_pages,
+      byte erase_block_exp, int row_count) {
+  static byte buf[MAX_PAGE_SIZE];
+  static byte stage_buf[STAGE_PAGES * MAX_PAGE_SIZE];
+  memset(flash, '\0', FLASH_SIZE);
+  memset(programmed, 1, FLASH_SIZE);
+  write_ms = max_write_ms = erase_ahead_ms = 0;
+  rmw_count = erase_ahead_count = 0;
+  struct dblog_write_context ctx;
+  memset(&ctx, '\0', sizeof(ctx));
+  ctx.buf = buf;
+  ctx.col_count = 2;
+  ctx.page_size_exp = page_size_exp;
+  ctx.read_fn = flash_read_fn_wctx;
+  ctx.write_fn = flash_write_fn;
+  ctx.flush_fn = flash_flush_fn;
+  if (stage_pages) {
+    ctx.stage_buf = stage_buf;
+    ctx.stage_pages = stage_pages;
+  }
+  if (erase_block_exp) {
+    ctx.erase_block_exp = erase_block_exp;
+    ctx.erase_fn = flash_erase_fn;
+  }
+  int res = dblog_write_init(&ctx);
+  for (int i = 1; !res && i <= row_count; i++) {
+    int32_t val = i * 3;
+    uint8_t types[] = {DBLOG_TYPE_INT, DBLOG_TYPE_INT};
+    const void *values[] = {&val, &i};
+    uint16_t lengths[] = {4, 4};
+    res = dblog_append_row_with_values(&ctx, types, values, lengths);
+  }
+  if (!res)
+    res = dblog_finalize(&ctx);
+  if (!res) {
+    struct dblog_read_context rctx;
+    memset(&rctx, '\0', sizeof(rctx));
+    rctx.buf = buf;
+    rctx.read_fn = flash_read_fn_rctx;
+    res = dblog_read_init(&rctx);
+    if (!res)
+      res = dblog_read_last_row(&rctx);
+  }
+  if (res) {
+    printf("%-26s error %d\n", name, res);
+    return 1;
+  }
+  printf("%-26s %8.1f s %6d %8.1f ms %6d %8.1f s\n", name, write_ms / 1000,
+         rmw_count, max_write_ms, erase_ahead_count, erase_ahead_ms / 1000);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  int row_count = argc > 1 ? atoi(argv[1]) : 100000;
+  flash = malloc(FLASH_SIZE);
+  programmed = malloc(FLASH_SIZE);
+  if (!flash || !programmed)
+    return 1;
+  printf("%-26s %10s %6s %11s %6s %10s\n", "", "write_fn", "RMW",
+         "max write", "ahead", "erase");
+  int res = run("pexp 9, plain", 9, 0, 0, row_count)
+          | run("pexp 9, staged x8", 9, STAGE_PAGES, 0, row_count)
+          | run("pexp 9, ebe 12 + erase_fn", 9, 0, 12, row_count)
+          | run("pexp 12, plain", 12, 0, 0, row_count)
+          | run("pexp 12, ebe 12 + erase_fn", 12, 0, 12, row_count);
+  free(flash);
+  free(programmed);
+  return res;
+}
@@ -0,0 +1,221 @@
+/*
+  Sqlite Micro Logger - host benchmark of multi-threaded scans
+
+  Writes a log of (int64 ts, REAL temperature, INT count) rows without
+  page summaries, so that every row is decoded, and times
+  dblog_mt_scan_rows() with a row_fn adding up the temperature and
+  dblog_mt_agg() with a condition, for 1 to 8 threads.
+
+  Wall time only drops with threads on as many cores.  So that the
+  split of work can also be judged on fewer cores, row_fn samples the
+  CPU time of its thread, and the largest CPU time taken by a worker
+  (the critical path) is shown along with the speedup it allows.
+
+  Build and run on the host from this folder:
+
+    gcc -O2 -I../main bench_mt_scan.c ../main/ulog_mt_scan.c ../main/ulog_sqlite.c -lm -lpthread -o bench_mt_scan
+    ./bench_mt_scan [rows] [db_file]
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ulog_mt_scan.h"
+
+#define PAGE_SIZE_EXP 12
+#define PAGE_SIZE (1 << PAGE_SIZE_EXP)
+#define RUNS 3
+#define CPU_SAMPLE_ROWS 256
+
+FILE *bench_file;
+
+// Per worker values updated by row_fn
+struct worker_stats {
+  double sum;
+  uint32_t rows;
+  double cpu_start;
+  double cpu_last;
+  char pad[32]; // keeps workers off each other's cache lines
+} stats[DBLOG_MT_MAX_THREADS];
+
+int32_t bench_read_fn(struct dblog_write_context *ctx, void *buf, uint32_t pos, size_t len) {
+  if (fseek(bench_file, pos, SEEK_SET))
+    return DBLOG_RES_SEEK_ERR;
+  size_t ret = fread(buf, 1, len, bench_file);
+  if (ret != len)
+    return DBLOG_RES_READ_ERR;
+  return ret;
+}
+
+int32_t bench_write_fn(struct dblog_write_context *ctx, void *buf, uint32_t pos, size_t len) {
+  if (fseek(bench_file, pos, SEEK_SET))
+    return DBLOG_RES_SEEK_ERR;
+  size_t ret = fwrite(buf, 1, len, bench_file);
+  if (ret != len)
+    return DBLOG_RES_ERR;
+  return ret;
+}
+
+int bench_flush_fn(struct dblog_write_context *ctx) {
+  return fflush(bench_file);
+}
+
+double clock_secs(clockid_t clock_id) {
+  struct timespec ts;
+  clock_gettime(clock_id, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double temp_of(int row) {
+  return ((row * 7919) % 1000) / 10.0 - 20;
+}
+
+int write_log(const char *path, int row_count) {
+  static byte buf[PAGE_SIZE];
+  bench_file = fopen(path, "w+b");
+  if (!bench_file) {
+    perror(path);
+    return 1;
+  }
+  struct dblog_write_context ctx;
+  memset(&ctx, '\0', sizeof(ctx));
+  ctx.buf = buf;
+  ctx.col_count = 3;
+  ctx.page_size_exp = PAGE_SIZE_EXP;
+  ctx.read_fn = bench_read_fn;
+  ctx.write_fn = bench_write_fn;
+  ctx.flush_fn = bench_flush_fn;
+  int res = dblog_write_init(&ctx);
+  for (int i = 1; !res && i <= row_count; i++) {
+    int64_t ts = 1700000000LL + i;
+    double temp = temp_of(i);
+    int32_t count = (i * 31) % 97 - 10;
+    uint8_t types[] = {DBLOG_TYPE_INT, DBLOG_TYPE_REAL, DBLOG_TYPE_INT};
+    const void *values[] = {&ts, &temp, &count};
+    uint16_t lengths[] = {8, 8, 4};
+    res = dblog_append_row_with_values(&ctx, types, values, lengths);
+  }
+  if (!res)
+    res = dblog_finalize(&ctx);
+  fclose(bench_file);
+  return res;
+}
+
+// Adds up temperature, noting CPU time of the worker thread
+// every CPU_SAMPLE_ROWS rows
+int sum_temp_fn(struct dblog_mt_scan *mt, int worker, struct dblog_read_context *rctx) {
+  (void) mt;
+  struct worker_stats *st = &stats[worker];
+  uint32_t col_type;
+  const byte *val = (const byte *) dblog_read_col_val(rctx, 1, &col_type);
+  uint64_t bits = 0;
+  for (int i = 0; i < 8; i++)
+    bits = (bits << 8) | val[i];
+  double temp;
+  memcpy(&temp, &bits, 8);
+  st->sum += temp;
+  if (st->rows++ % CPU_SAMPLE_ROWS == 0) {
+    st->cpu_last = clock_secs(CLOCK_THREAD_CPUTIME_ID);
+    if (st->rows == 1)
+      st->cpu_start = st->cpu_last;
+  }
+  return 0;
+}
+
+int run_scan(const char *path, int thread_count, int row_count, double *out_wall, double *out_crit) {
+  struct dblog_mt_scan mt;
+  memset(&mt, '\0', sizeof(mt));
+  mt.path = path;
+  mt.thread_count = thread_count;
+  mt.row_fn = sum_temp_fn;
+  memset(stats, '\0', sizeof(stats));
+  double start = clock_secs(CLOCK_MONOTONIC);
+  int res = dblog_mt_scan_rows(&mt);
+  *out_wall = clock_secs(CLOCK_MONOTONIC) - start;
+  if (res)
+    return res;
+  uint32_t rows = 0;
+  double sum = 0;
+  *out_crit = 0;
+  for (int i = 0; i < thread_count; i++) {
+    rows += stats[i].rows;
+    sum += stats[i].sum;
+    if (stats[i].cpu_last - stats[i].cpu_start > *out_crit)
+      *out_crit = stats[i].cpu_last - stats[i].cpu_start;
+  }
+  double expected = 0;
+  for (int i = 1; i <= row_count; i++)
+    expected += temp_of(i);
+  if (rows != (uint32_t) row_count || fabs(sum - expected) > 1e-6 * fabs(expected) + 1e-6)
+    return 1;
+  return 0;
+}
+
+int run_agg(const char *path, int thread_count, double *out_wall) {
+  double threshold = 50;
+  struct dblog_pred pred;
+  memset(&pred, '\0', sizeof(pred));
+  pred.col_idx = 1;
+  pred.op = DBLOG_OP_GT;
+  pred.val_type = DBLOG_TYPE_REAL;
+  pred.val = &threshold;
+  pred.len = 8;
+  struct dblog_mt_scan mt;
+  memset(&mt, '\0', sizeof(mt));
+  mt.path = path;
+  mt.thread_count = thread_count;
+  mt.preds = &pred;
+  mt.pred_count = 1;
+  struct dblog_agg agg;
+  double start = clock_secs(CLOCK_MONOTONIC);
+  int res = dblog_mt_agg(&mt, 2, &agg);
+  *out_wall = clock_secs(CLOCK_MONOTONIC) - start;
+  return res;
+}
+
+int main(int argc, char *argv[]) {
+  int row_count = argc > 1 ? atoi(argv[1]) : 4000000;
+  const char *path = argc > 2 ? argv[2] : "bench_mt_scan.db";
+  int res = write_log(path, row_count);
+  if (res) {
+    printf("Error writing: %d\n", res);
+    return 1;
+  }
+  printf("%d rows, %ld online CPUs, best of %d runs\n", row_count,
+         sysconf(_SC_NPROCESSORS_ONLN), RUNS);
+  printf("threads  scan wall  speedup  critical path  allows   agg wall  speedup\n");
+  int thread_counts[] = {1, 2, 4, 8};
+  double scan_base = 0, crit_base = 0, agg_base = 0;
+  for (int t = 0; !res && t < 4; t++) {
+    double scan_wall = 1e9, crit = 1e9, agg_wall = 1e9;
+    for (int run = 0; !res && run < RUNS; run++) {
+      double wall, run_crit;
+      res = run_scan(path, thread_counts[t], row_count, &wall, &run_crit);
+      if (wall < scan_wall)
+        scan_wall = wall;
+      if (run_crit < crit)
+        crit = run_crit;
+      if (!res)
+        res = run_agg(path, thread_counts[t], &wall);
+      if (wall < agg_wall)
+        agg_wall = wall;
+    }
+    if (!t) {
+      scan_base = scan_wall;
+      crit_base = crit;
+      agg_base = agg_wall;
+    }
+    if (!res)
+      printf("%7d %9.3f s %7.2fx %11.3f s %6.2fx %8.3f s %7.2fx\n",
+             thread_counts[t], scan_wall, scan_base / scan_wall, crit,
+             crit_base / crit, agg_wall, agg_base / agg_wall);
+  }
+  remove(path);
+  if (res)
+    printf("Error: %d\n", res);
+  return res ? 1 : 0;
+}
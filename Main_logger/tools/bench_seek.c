@@ -0,0 +1,169 @@
+/*
+  Sqlite Micro Logger - host benchmark of time seek
+
+  Counts pages read by dblog_bin_srch_row_by_val() and
+  dblog_interp_srch_row_by_val() for random seeks on a timestamp
+  column of a million row log, for evenly spaced, jittered and bursty
+  timestamps and for a ring of leaf pages.  Both searches are checked
+  to leave the cursor at the same row.
+
+  Build and run on the host from this folder:
+
+    gcc -O2 -I../main bench_seek.c ../main/ulog_sqlite.c -lm -lpthread -o bench_seek
+    ./bench_seek [rows] [db_file]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ulog_sqlite.h"
+
+#define PAGE_SIZE_EXP 12
+#define PAGE_SIZE (1 << PAGE_SIZE_EXP)
+#define SEEK_COUNT 1000
+#define RING_PAGES_EXP 10
+
+enum {TS_EVEN = 0, TS_JITTER, TS_BURSTY};
+
+FILE *seek_file;
+int pages_read;
+uint32_t last_page_read;
+
+int32_t seek_read_fn_wctx(struct dblog_write_context *ctx, void *buf, uint32_t pos, size_t len) {
+  if (fseek(seek_file, pos, SEEK_SET))
+    return DBLOG_RES_SEEK_ERR;
+  size_t ret = fread(buf, 1, len, seek_file);
+  if (ret != len)
+    return DBLOG_RES_READ_ERR;
+  return ret;
+}
+
+// Counts distinct pages, as reads of parts of
+// the same page are served by the file system buffer
+int32_t seek_read_fn_rctx(struct dblog_read_context *ctx, void *buf, uint32_t pos, size_t len) {
+  if (pos >> PAGE_SIZE_EXP != last_page_read) {
+    pages_read++;
+    last_page_read = pos >> PAGE_SIZE_EXP;
+  }
+  if (fseek(seek_file, pos, SEEK_SET))
+    return DBLOG_RES_SEEK_ERR;
+  size_t ret = fread(buf, 1, len, seek_file);
+  if (ret != len)
+    return DBLOG_RES_READ_ERR;
+  return ret;
+}
+
+int32_t seek_write_fn(struct dblog_write_context *ctx, void *buf, uint32_t pos, size_t len) {
+  if (fseek(seek_file, pos, SEEK_SET))
+    return DBLOG_RES_SEEK_ERR;
+  size_t ret = fwrite(buf, 1, len, seek_file);
+  if (ret != len)
+    return DBLOG_RES_ERR;
+  return ret;
+}
+
+int seek_flush_fn(struct dblog_write_context *ctx) {
+  return fflush(seek_file);
+}
+
+// Timestamp in ms of given row
+int64_t ts_of(int row, int mode) {
+  int64_t base = 1700000000000LL;
+  switch (mode) {
+    case TS_JITTER:
+      return base + (int64_t) row * 1000 + (row * 7919) % 700;
+    case TS_BURSTY: // alternating dense and sparse stretches
+      return base + (int64_t) row * 10 + (int64_t) (row / 100000) * 500000000LL
+               + ((row / 100000) % 2 ? (int64_t) (row % 100000) * 5000 : 0);
+  }
+  return base + (int64_t) row * 1000;
+}
+
+int write_log(const char *path, int row_count, int mode, byte max_pages_exp) {
+  static byte buf[PAGE_SIZE];
+  seek_file = fopen(path, "w+b");
+  if (!seek_file) {
+    perror(path);
+    return 1;
+  }
+  struct dblog_write_context ctx;
+  memset(&ctx, '\0', sizeof(ctx));
+  ctx.buf = buf;
+  ctx.col_count = 2;
+  ctx.page_size_exp = PAGE_SIZE_EXP;
+  ctx.max_pages_exp = max_pages_exp;
+  ctx.read_fn = seek_read_fn_wctx;
+  ctx.write_fn = seek_write_fn;
+  ctx.flush_fn = seek_flush_fn;
+  int res = dblog_write_init(&ctx);
+  for (int i = 1; !res && i <= row_count; i++) {
+    int64_t ts = ts_of(i, mode);
+    uint8_t types[] = {DBLOG_TYPE_INT, DBLOG_TYPE_INT};
+    const void *values[] = {&ts, &i};
+    uint16_t lengths[] = {8, 4};
+    res = dblog_append_row_with_values(&ctx, types, values, lengths);
+  }
+  if (!res)
+    res = dblog_finalize(&ctx);
+  return res;
+}
+
+int run(const char *name, const char *path, int row_count, int mode, byte max_pages_exp) {
+  int res = write_log(path, row_count, mode, max_pages_exp);
+  static byte buf[PAGE_SIZE];
+  struct dblog_read_context rctx;
+  memset(&rctx, '\0', sizeof(rctx));
+  rctx.buf = buf;
+  rctx.read_fn = seek_read_fn_rctx;
+  if (!res)
+    res = dblog_read_init(&rctx);
+  // a ring keeps only the latest pages
+  int min_row = max_pages_exp ? row_count - 1000 : 1;
+  long bin_pages = 0;
+  long interp_pages = 0;
+  srand(1);
+  for (int i = 0; !res && i < SEEK_COUNT; i++) {
+    int row = min_row + rand() % (row_count - min_row + 1);
+    int64_t ts = ts_of(row, mode) + (i % 3 == 0 ? 1 : 0); // also between rows
+    if (i % 50 == 0)
+      ts = ts_of(1, mode) - 5;
+    if (i % 51 == 0)
+      ts = ts_of(row_count, mode) + 5;
+    pages_read = 0;
+    last_page_read = UINT32_MAX;
+    int bin_res = dblog_bin_srch_row_by_val(&rctx, 0, DBLOG_TYPE_INT, &ts, 8, 0);
+    uint32_t bin_page = rctx.cur_page;
+    uint16_t bin_pos = rctx.cur_rec_pos;
+    bin_pages += pages_read;
+    pages_read = 0;
+    last_page_read = UINT32_MAX;
+    int interp_res = dblog_interp_srch_row_by_val(&rctx, 0, DBLOG_TYPE_INT, &ts, 8, 0);
+    interp_pages += pages_read;
+    if (bin_res != interp_res || bin_page != rctx.cur_page || bin_pos != rctx.cur_rec_pos) {
+      printf("%s: seek to %lld differs\n", name, (long long) ts);
+      res = 1;
+    }
+  }
+  fclose(seek_file);
+  if (res) {
+    printf("%-20s error %d\n", name, res);
+    return 1;
+  }
+  printf("%-20s %10.1f %14.1f\n", name, (double) bin_pages / SEEK_COUNT,
+         (double) interp_pages / SEEK_COUNT);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  int row_count = argc > 1 ? atoi(argv[1]) : 1000000;
+  const char *path = argc > 2 ? argv[2] : "bench_seek.db";
+  printf("Pages read per seek, %d rows, %d seeks\n", row_count, SEEK_COUNT);
+  printf("%-20s %10s %14s\n", "", "binary", "interpolation");
+  int res = run("ts every 1 s", path, row_count, TS_EVEN, 0)
+          | run("ts with jitter", path, row_count, TS_JITTER, 0)
+          | run("bursty ts", path, row_count, TS_BURSTY, 0)
+          | run("ring of 1024 pages", path, row_count, TS_EVEN, RING_PAGES_EXP);
+  remove(path);
+  return res;
+}
@@ -0,0 +1,116 @@
+/*
+  Sqlite Micro Logger - host benchmark of page staging
+
+  Appends the same rows with stage_pages of 0, 4 and 16 and prints
+  the no. of write calls and time taken.  Each write call is synced
+  to disk so that its fixed cost shows as on a flash file system.
+
+  Build and run on the host from this folder:
+
+    gcc -O2 -I../main bench_stage.c ../main/ulog_sqlite.c -lm -lpthread -o bench_stage
+    ./bench_stage [rows] [db_file]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ulog_sqlite.h"
+
+#define PAGE_SIZE_EXP 12
+#define PAGE_SIZE (1 << PAGE_SIZE_EXP)
+#define MAX_STAGE_PAGES 16
+
+FILE *bench_file;
+int write_calls;
+
+int32_t bench_read_fn(struct dblog_write_context *ctx, void *buf, uint32_t pos, size_t len) {
+  if (fseek(bench_file, pos, SEEK_SET))
+    return DBLOG_RES_SEEK_ERR;
+  size_t ret = fread(buf, 1, len, bench_file);
+  if (ret != len)
+    return DBLOG_RES_READ_ERR;
+  return ret;
+}
+
+// Syncs every call, as the cost per call is what staging saves
+int32_t bench_write_fn(struct dblog_write_context *ctx, void *buf, uint32_t pos, size_t len) {
+  write_calls++;
+  if (fseek(bench_file, pos, SEEK_SET))
+    return DBLOG_RES_SEEK_ERR;
+  size_t ret = fwrite(buf, 1, len, bench_file);
+  if (ret != len)
+    return DBLOG_RES_ERR;
+  if (fflush(bench_file) || fsync(fileno(bench_file)))
+    return DBLOG_RES_ERR;
+  return ret;
+}
+
+int bench_flush_fn(struct dblog_write_context *ctx) {
+  return fflush(bench_file);
+}
+
+double elapsed_ms(struct timespec *from, struct timespec *to) {
+  return (to->tv_sec - from->tv_sec) * 1e3 + (to->tv_nsec - from->tv_nsec) / 1e6;
+}
+
+int run(const char *path, byte stage_pages, int row_count) {
+  static byte buf[PAGE_SIZE];
+  static byte stage_buf[MAX_STAGE_PAGES * PAGE_SIZE];
+  bench_file = fopen(path, "w+b");
+  if (!bench_file) {
+    perror(path);
+    return 1;
+  }
+  write_calls = 0;
+  struct dblog_write_context ctx;
+  memset(&ctx, '\0', sizeof(ctx));
+  ctx.buf = buf;
+  ctx.col_count = 3;
+  ctx.page_size_exp = PAGE_SIZE_EXP;
+  ctx.read_fn = bench_read_fn;
+  ctx.write_fn = bench_write_fn;
+  ctx.flush_fn = bench_flush_fn;
+  ctx.stage_buf = stage_buf;
+  ctx.stage_pages = stage_pages;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  int res = dblog_write_init(&ctx);
+  for (int i = 1; !res && i <= row_count; i++) {
+    int ival = i * 3;
+    float fval = i * 0.5f;
+    char text[8];
+    sprintf(text, "r%d", i % 100);
+    uint8_t types[] = {DBLOG_TYPE_INT, DBLOG_TYPE_REAL, DBLOG_TYPE_TEXT};
+    const void *values[] = {&ival, &fval, text};
+    uint16_t lengths[] = {4, 4, (uint16_t) strlen(text)};
+    res = dblog_append_row_with_values(&ctx, types, values, lengths);
+    if (!res && i % 5000 == 0)
+      res = dblog_flush(&ctx);
+  }
+  if (!res)
+    res = dblog_finalize(&ctx);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  fclose(bench_file);
+  if (res) {
+    printf("Error: %d\n", res);
+    return 1;
+  }
+  printf("stage_pages %2d: %6d write calls, %8.1f ms\n", stage_pages,
+         write_calls, elapsed_ms(&start, &end));
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  int row_count = argc > 1 ? atoi(argv[1]) : 100000;
+  const char *path = argc > 2 ? argv[2] : "bench_stage.db";
+  byte stage_counts[] = {0, 4, MAX_STAGE_PAGES};
+  for (int i = 0; i < 3; i++) {
+    if (run(path, stage_counts[i], row_count))
+      return 1;
+  }
+  remove(path);
+  return 0;
+}
@@ -0,0 +1,125 @@
+/*
+  Sqlite Micro Logger - host benchmark of the typed row writer
+
+  Appends the same rows of (int32_t, float, Text<16>) columns using
+  ulog::Writer of ulog_sqlite.hpp and using dblog_append_empty_row()
+  followed by dblog_set_col_val() for each column, and prints the time
+  taken by each.  Pages are written to memory so that only the cost of
+  forming the rows is compared.
+
+  Build and run on the host from this folder:
+
+    gcc -O2 -c ../main/ulog_sqlite.c -o ulog_sqlite.o
+    g++ -std=gnu++17 -O2 -I../main bench_writer.cpp ulog_sqlite.o -lm -lpthread -o bench_writer
+    ./bench_writer [rows]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ulog_sqlite.hpp"
+
+#define PAGE_SIZE_EXP 12
+#define PAGE_SIZE (1 << PAGE_SIZE_EXP)
+#define MAX_DB_SIZE (64 * 1024 * 1024)
+
+byte *db_data;
+uint32_t db_size;
+
+int32_t mem_read_fn(struct dblog_write_context *ctx, void *buf, uint32_t pos, size_t len) {
+  if (pos + len > db_size)
+    return DBLOG_RES_READ_ERR;
+  memcpy(buf, db_data + pos, len);
+  return len;
+}
+
+int32_t mem_write_fn(struct dblog_write_context *ctx, void *buf, uint32_t pos, size_t len) {
+  if (pos + len > MAX_DB_SIZE)
+    return DBLOG_RES_ERR;
+  memcpy(db_data + pos, buf, len);
+  if (pos + len > db_size)
+    db_size = pos + len;
+  return len;
+}
+
+int mem_flush_fn(struct dblog_write_context *ctx) {
+  return 0;
+}
+
+double elapsed_ms(struct timespec *from, struct timespec *to) {
+  return (to->tv_sec - from->tv_sec) * 1e3 + (to->tv_nsec - from->tv_nsec) / 1e6;
+}
+
+// Appends rows using ulog::Writer
+int append_typed(struct dblog_write_context *ctx, int row_count) {
+  ulog::Writer<int32_t, float, ulog::Text<16>> writer(ctx);
+  int res = dblog_write_init(ctx);
+  for (int i = 1; !res && i <= row_count; i++) {
+    char text[16];
+    int len = snprintf(text, sizeof(text), "sensor-%d", i % 100);
+    res = writer.append(i * 3, i * 0.5f, ulog::Text<16>(text, (uint16_t) len));
+  }
+  return res;
+}
+
+// Appends rows using dblog_set_col_val()
+int append_set_col_val(struct dblog_write_context *ctx, int row_count) {
+  int res = dblog_write_init(ctx);
+  for (int i = 1; !res && i <= row_count; i++) {
+    int32_t ival = i * 3;
+    float fval = i * 0.5f;
+    char text[16];
+    int len = snprintf(text, sizeof(text), "sensor-%d", i % 100);
+    if (i > 1)
+      res = dblog_append_empty_row(ctx);
+    if (!res)
+      res = dblog_set_col_val(ctx, 0, DBLOG_TYPE_INT, &ival, 4);
+    if (!res)
+      res = dblog_set_col_val(ctx, 1, DBLOG_TYPE_REAL, &fval, 4);
+    if (!res)
+      res = dblog_set_col_val(ctx, 2, DBLOG_TYPE_TEXT, text, len);
+  }
+  return res;
+}
+
+int run(const char *name, int (*append_fn)(struct dblog_write_context *, int),
+      int row_count) {
+  static byte buf[PAGE_SIZE];
+  db_size = 0;
+  struct dblog_write_context ctx;
+  memset(&ctx, '\0', sizeof(ctx));
+  ctx.buf = buf;
+  ctx.col_count = 3;
+  ctx.page_size_exp = PAGE_SIZE_EXP;
+  ctx.read_fn = mem_read_fn;
+  ctx.write_fn = mem_write_fn;
+  ctx.flush_fn = mem_flush_fn;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  int res = append_fn(&ctx, row_count);
+  if (!res)
+    res = dblog_finalize(&ctx);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  if (res) {
+    printf("Error: %d\n", res);
+    return 1;
+  }
+  double ms = elapsed_ms(&start, &end);
+  printf("%-18s: %8.1f ms, %10.0f rows/s, %u bytes\n", name, ms,
+         row_count * 1000 / (ms > 0 ? ms : 1), db_size);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  int row_count = argc > 1 ? atoi(argv[1]) : 300000;
+  db_data = (byte *) malloc(MAX_DB_SIZE);
+  if (!db_data)
+    return 1;
+  int res = run("ulog::Writer", append_typed, row_count);
+  if (!res)
+    res = run("dblog_set_col_val", append_set_col_val, row_count);
+  free(db_data);
+  return res;
+}
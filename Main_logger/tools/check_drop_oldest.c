@@ -0,0 +1,203 @@
+/*
+  Sqlite Micro Logger - host check of space returned by dblog_drop_oldest()
+
+  Keeps the last KEEP_ROWS rows of a database by calling
+  dblog_drop_oldest() and appending APPEND_ROWS rows after
+  dblog_init_for_append() in each cycle, as retention would.  Every
+  few cycles the file is closed without finalize, as after power loss,
+  and reopened using dblog_resume().  Rows appended per second and the
+  file size are printed for each cycle.  As leaf pages wrap around over
+  the pages dropped and interior pages are written over free pages, the
+  file should stop growing once the ring has enough pages, so no growth
+  is expected in the second half of the cycles.  The rows kept are
+  checked to be contiguous upto the last row appended.
+
+  Build and run on the host from this folder:
+
+    gcc -O2 -I../main check_drop_oldest.c ../main/ulog_sqlite.c -lm -lpthread -o check_drop_oldest
+    ./check_drop_oldest [cycles] [db_file]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ulog_sqlite.h"
+
+#define PAGE_SIZE_EXP 9
+#define PAGE_SIZE (1 << PAGE_SIZE_EXP)
+#define KEEP_ROWS 20000
+#define APPEND_ROWS 5000
+#define RESUME_EVERY 3
+
+FILE *drop_file;
+
+int32_t drop_read_fn_wctx(struct dblog_write_context *ctx, void *buf, uint32_t pos, size_t len) {
+  if (fseek(drop_file, pos, SEEK_SET))
+    return DBLOG_RES_SEEK_ERR;
+  size_t ret = fread(buf, 1, len, drop_file);
+  if (ret != len)
+    return DBLOG_RES_READ_ERR;
+  return ret;
+}
+
+int32_t drop_read_fn_rctx(struct dblog_read_context *ctx, void *buf, uint32_t pos, size_t len) {
+  if (fseek(drop_file, pos, SEEK_SET))
+    return DBLOG_RES_SEEK_ERR;
+  size_t ret = fread(buf, 1, len, drop_file);
+  if (ret != len)
+    return DBLOG_RES_READ_ERR;
+  return ret;
+}
+
+int32_t drop_write_fn(struct dblog_write_context *ctx, void *buf, uint32_t pos, size_t len) {
+  if (fseek(drop_file, pos, SEEK_SET))
+    return DBLOG_RES_SEEK_ERR;
+  size_t ret = fwrite(buf, 1, len, drop_file);
+  if (ret != len)
+    return DBLOG_RES_ERR;
+  return ret;
+}
+
+int drop_flush_fn(struct dblog_write_context *ctx) {
+  return fflush(drop_file);
+}
+
+void init_ctx(struct dblog_write_context *ctx, byte *buf) {
+  memset(ctx, '\0', sizeof(*ctx));
+  ctx->buf = buf;
+  ctx->col_count = 2;
+  ctx->page_size_exp = PAGE_SIZE_EXP;
+  ctx->read_fn = drop_read_fn_wctx;
+  ctx->write_fn = drop_write_fn;
+  ctx->flush_fn = drop_flush_fn;
+}
+
+uint32_t read_be32(const byte *ptr) {
+  return ((uint32_t) ptr[0] << 24) | ((uint32_t) ptr[1] << 16)
+           | ((uint32_t) ptr[2] << 8) | ptr[3];
+}
+
+long file_size() {
+  fseek(drop_file, 0, SEEK_END);
+  return ftell(drop_file);
+}
+
+double elapsed_ms(struct timespec *from, struct timespec *to) {
+  return (to->tv_sec - from->tv_sec) * 1e3 + (to->tv_nsec - from->tv_nsec) / 1e6;
+}
+
+int append_row(struct dblog_write_context *ctx, int32_t id) {
+  char text[16];
+  int len = snprintf(text, sizeof(text), "row %06d", id);
+  uint8_t types[] = {DBLOG_TYPE_INT, DBLOG_TYPE_TEXT};
+  const void *values[] = {&id, text};
+  uint16_t lengths[] = {4, (uint16_t) len};
+  return dblog_append_row_with_values(ctx, types, values, lengths);
+}
+
+// Checks that rows read are contiguous from first_id to last_id
+int check_rows(int32_t first_id, int32_t last_id) {
+  static byte buf[PAGE_SIZE];
+  struct dblog_read_context rctx;
+  memset(&rctx, '\0', sizeof(rctx));
+  rctx.buf = buf;
+  rctx.read_fn = drop_read_fn_rctx;
+  int res = dblog_read_init(&rctx);
+  if (!res)
+    res = dblog_read_first_row(&rctx);
+  if (res)
+    return res;
+  uint32_t col_type;
+  int32_t id = read_be32(dblog_read_col_val(&rctx, 0, &col_type));
+  if (id > first_id) {
+    printf("First row %d after %d\n", id, first_id);
+    return 1;
+  }
+  first_id = id;
+  do {
+    if ((int32_t) read_be32(dblog_read_col_val(&rctx, 0, &col_type)) != id) {
+      printf("Row %d out of order\n", id);
+      return 1;
+    }
+    id++;
+  } while (!dblog_read_next_row(&rctx));
+  if (id - 1 != last_id) {
+    printf("Last row %d instead of %d\n", id - 1, last_id);
+    return 1;
+  }
+  return 0;
+}
+
+// Appends rows after dblog_init_for_append() and finalizes,
+// or closes the file and finalizes after dblog_resume()
+int append_rows(struct dblog_write_context *ctx, byte *buf, const char *path,
+      int32_t from_id, byte resume, double *out_ms) {
+  init_ctx(ctx, buf);
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  int res = dblog_init_for_append(ctx);
+  for (int32_t id = from_id; !res && id < from_id + APPEND_ROWS; id++)
+    res = append_row(ctx, id);
+  if (!res && resume) {
+    res = dblog_flush(ctx);
+    // reopen without finalize, as after power loss
+    fclose(drop_file);
+    drop_file = fopen(path, "r+b");
+    init_ctx(ctx, buf);
+    if (!res)
+      res = dblog_resume(ctx);
+  }
+  if (!res)
+    res = dblog_finalize(ctx);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  *out_ms = elapsed_ms(&start, &end);
+  return res;
+}
+
+int main(int argc, char *argv[]) {
+  static byte buf[PAGE_SIZE];
+  static byte page_buf[PAGE_SIZE];
+  int cycles = argc > 1 ? atoi(argv[1]) : 20;
+  const char *path = argc > 2 ? argv[2] : "check_drop.db";
+  drop_file = fopen(path, "w+b");
+  if (!drop_file) {
+    perror(path);
+    return 1;
+  }
+  struct dblog_write_context ctx;
+  init_ctx(&ctx, buf);
+  int res = dblog_write_init(&ctx);
+  int32_t next_id = 1;
+  for (; !res && next_id <= KEEP_ROWS; next_id++)
+    res = append_row(&ctx, next_id);
+  if (!res)
+    res = dblog_finalize(&ctx);
+  long max_size = 0;
+  for (int cycle = 1; !res && cycle <= cycles; cycle++) {
+    uint32_t pages_freed;
+    init_ctx(&ctx, buf);
+    // Row ID is same as id
+    res = dblog_drop_oldest(&ctx, next_id - KEEP_ROWS, page_buf, &pages_freed);
+    double ms = 0;
+    if (!res)
+      res = append_rows(&ctx, buf, path, next_id, cycle % RESUME_EVERY == 0, &ms);
+    next_id += APPEND_ROWS;
+    if (!res)
+      res = check_rows(next_id - APPEND_ROWS - KEEP_ROWS, next_id - 1);
+    long size = file_size();
+    printf("Cycle %2d: %u pages freed, %.0f rows/s, file size %ld\n", cycle,
+           pages_freed, APPEND_ROWS * 1000 / (ms > 0 ? ms : 1), size);
+    if (!res && cycle > cycles / 2 && size > max_size) {
+      printf("File still growing\n");
+      res = 1;
+    }
+    if (size > max_size)
+      max_size = size;
+  }
+  fclose(drop_file);
+  remove(path);
+  printf(res ? "Failed: %d\n" : "Ok\n", res);
+  return res ? 1 : 0;
+}
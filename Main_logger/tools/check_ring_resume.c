@@ -0,0 +1,179 @@
+/*
+  Sqlite Micro Logger - host check of tail marker in a ring
+
+  Writes rows into a ring of leaf pages (max_pages_exp) for several
+  rounds, checking after every flush that the tail marker in the first
+  page stays within DBLOG_CFG_TAIL_MARK_INTERVAL pages of the page
+  being written.  At a few points the file is closed without finalize,
+  as after power loss, and reopened using dblog_resume(), which should
+  read only the pages after the marker.  Finally the rows kept in the
+  ring are checked to be contiguous upto the last row appended.
+
+  Build and run on the host from this folder:
+
+    gcc -O2 -I../main check_ring_resume.c ../main/ulog_sqlite.c -lm -lpthread -o check_ring_resume
+    ./check_ring_resume [db_file]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ulog_sqlite.h"
+
+#define PAGE_SIZE_EXP 9
+#define PAGE_SIZE (1 << PAGE_SIZE_EXP)
+#define MAX_PAGES_EXP 6
+#define ROW_COUNT 20000
+#define RESUME_EVERY 3000
+
+FILE *ring_file;
+int read_calls;
+
+int32_t ring_read_fn_wctx(struct dblog_write_context *ctx, void *buf, uint32_t pos, size_t len) {
+  read_calls++;
+  if (fseek(ring_file, pos, SEEK_SET))
+    return DBLOG_RES_SEEK_ERR;
+  size_t ret = fread(buf, 1, len, ring_file);
+  if (ret != len)
+    return DBLOG_RES_READ_ERR;
+  return ret;
+}
+
+int32_t ring_read_fn_rctx(struct dblog_read_context *ctx, void *buf, uint32_t pos, size_t len) {
+  if (fseek(ring_file, pos, SEEK_SET))
+    return DBLOG_RES_SEEK_ERR;
+  size_t ret = fread(buf, 1, len, ring_file);
+  if (ret != len)
+    return DBLOG_RES_READ_ERR;
+  return ret;
+}
+
+int32_t ring_write_fn(struct dblog_write_context *ctx, void *buf, uint32_t pos, size_t len) {
+  if (fseek(ring_file, pos, SEEK_SET))
+    return DBLOG_RES_SEEK_ERR;
+  size_t ret = fwrite(buf, 1, len, ring_file);
+  if (ret != len)
+    return DBLOG_RES_ERR;
+  return ret;
+}
+
+int ring_flush_fn(struct dblog_write_context *ctx) {
+  return fflush(ring_file);
+}
+
+void init_ctx(struct dblog_write_context *ctx, byte *buf) {
+  memset(ctx, '\0', sizeof(*ctx));
+  ctx->buf = buf;
+  ctx->col_count = 2;
+  ctx->page_size_exp = PAGE_SIZE_EXP;
+  ctx->max_pages_exp = MAX_PAGES_EXP;
+  ctx->read_fn = ring_read_fn_wctx;
+  ctx->write_fn = ring_write_fn;
+  ctx->flush_fn = ring_flush_fn;
+}
+
+uint32_t read_be32(const byte *ptr) {
+  return ((uint32_t) ptr[0] << 24) | ((uint32_t) ptr[1] << 16)
+           | ((uint32_t) ptr[2] << 8) | ptr[3];
+}
+
+// Returns no. of pages from the marked page to the page being written
+uint32_t marker_lag(struct dblog_write_context *ctx) {
+  byte mark[4];
+  fseek(ring_file, 80, SEEK_SET); // tail marker position in first page
+  if (fread(mark, 1, 4, ring_file) != 4)
+    return UINT32_MAX;
+  uint32_t ring_pages = (uint32_t) 1 << MAX_PAGES_EXP;
+  return (ctx->cur_write_page + ring_pages - read_be32(mark)) % ring_pages;
+}
+
+int append_row(struct dblog_write_context *ctx, int32_t id) {
+  int32_t val = id * 3;
+  uint8_t types[] = {DBLOG_TYPE_INT, DBLOG_TYPE_INT};
+  const void *values[] = {&id, &val};
+  uint16_t lengths[] = {4, 4};
+  return dblog_append_row_with_values(ctx, types, values, lengths);
+}
+
+// Checks that rows read are contiguous and end with last_id
+int check_rows(int32_t last_id) {
+  static byte buf[PAGE_SIZE];
+  struct dblog_read_context rctx;
+  memset(&rctx, '\0', sizeof(rctx));
+  rctx.buf = buf;
+  rctx.read_fn = ring_read_fn_rctx;
+  int res = dblog_read_init(&rctx);
+  if (!res)
+    res = dblog_read_first_row(&rctx);
+  if (res)
+    return res;
+  uint32_t col_type;
+  int32_t first_id = read_be32(dblog_read_col_val(&rctx, 0, &col_type));
+  int32_t id = first_id;
+  do {
+    if ((int32_t) read_be32(dblog_read_col_val(&rctx, 0, &col_type)) != id) {
+      printf("Row %d out of order\n", id);
+      return 1;
+    }
+    id++;
+  } while (!dblog_read_next_row(&rctx));
+  printf("Rows %d to %d in ring\n", first_id, id - 1);
+  return id - 1 == last_id ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+  static byte buf[PAGE_SIZE];
+  const char *path = argc > 1 ? argv[1] : "check_ring.db";
+  ring_file = fopen(path, "w+b");
+  if (!ring_file) {
+    perror(path);
+    return 1;
+  }
+  struct dblog_write_context ctx;
+  init_ctx(&ctx, buf);
+  int res = dblog_write_init(&ctx);
+  uint32_t max_lag = 0;
+  int resume_count = 0;
+  for (int32_t id = 1; !res && id <= ROW_COUNT; id++) {
+    res = append_row(&ctx, id);
+    if (res || id % 50)
+      continue;
+    res = dblog_flush(&ctx);
+    uint32_t lag = marker_lag(&ctx);
+    if (lag > max_lag)
+      max_lag = lag;
+    if (res || id % RESUME_EVERY)
+      continue;
+    // reopen without finalize, as after power loss
+    fclose(ring_file);
+    ring_file = fopen(path, "r+b");
+    init_ctx(&ctx, buf);
+    read_calls = 0;
+    res = dblog_resume(&ctx);
+    if (!res && ctx.cur_write_rowid != (uint32_t) id) {
+      printf("Resumed at row %u instead of %d\n", ctx.cur_write_rowid, id);
+      res = 1;
+    }
+    printf("Resumed at row %d, page %u using %d reads\n", id,
+           ctx.cur_write_page, read_calls);
+    if (read_calls > 4 * DBLOG_CFG_TAIL_MARK_INTERVAL) {
+      printf("Too many pages read by dblog_resume()\n");
+      res = 1;
+    }
+    resume_count++;
+  }
+  if (!res)
+    res = dblog_finalize(&ctx);
+  printf("Max pages from tail marker to page being written: %u\n", max_lag);
+  if (!res && max_lag > 2 * DBLOG_CFG_TAIL_MARK_INTERVAL) {
+    printf("Tail marker not advancing\n");
+    res = 1;
+  }
+  if (!res)
+    res = check_rows(ROW_COUNT);
+  fclose(ring_file);
+  remove(path);
+  printf(res ? "Failed: %d\n" : "Ok\n", res);
+  return res ? 1 : 0;
+}
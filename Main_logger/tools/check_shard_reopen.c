@@ -0,0 +1,196 @@
+/*
+  Sqlite Micro Logger - host check of shards opened again after close
+
+  Appends rows to an hourly shard, closes the shards as before reset
+  and opens them again, then appends more rows of the same hour.
+  The shard is expected to be continued and not created again, so all
+  rows should be found by dblog_shards_scan() and the manifest should
+  still have a single entry.  Rows older than the last row, of the same
+  or an earlier hour, should be refused as no scan could find them.
+  Then the shard is finalized, after which a row for its hour should
+  be refused.
+  A shard file left without manifest entry, as on reset before the
+  manifest is written, should be continued.  Finally the manifest copy
+  written last is cut short, as on reset while writing it, and the
+  shards should still be found using the other copy.
+
+  Build and run on the host from this folder:
+
+    gcc -O2 -I../main check_shard_reopen.c ../main/ulog_shards.c ../main/ulog_sqlite.c -lm -lpthread -o check_shard_reopen
+    ./check_shard_reopen [prefix]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ulog_shards.h"
+
+#define PAGE_SIZE_EXP 12
+#define PAGE_SIZE (1 << PAGE_SIZE_EXP)
+#define WINDOW_SECS 3600
+#define MAX_SHARDS 8
+#define ROW_COUNT 500
+
+#define T0 (1700000000LL - 1700000000LL % WINDOW_SECS)
+
+byte page_buf[PAGE_SIZE];
+byte fin_buf[PAGE_SIZE];
+byte scan_buf[PAGE_SIZE];
+struct dblog_shard_info infos[MAX_SHARDS];
+
+void init_shards(struct dblog_shards *sh, const char *prefix) {
+  memset(sh, '\0', sizeof(*sh));
+  sh->prefix = prefix;
+  sh->window_secs = WINDOW_SECS;
+  sh->ts_col_idx = 0;
+  sh->shards = infos;
+  sh->max_shards = MAX_SHARDS;
+  sh->fin_buf = fin_buf;
+  sh->cur.wctx.buf = page_buf;
+  sh->cur.wctx.col_count = 2;
+  sh->cur.wctx.page_size_exp = PAGE_SIZE_EXP;
+}
+
+int append_row(struct dblog_shards *sh, int64_t ts) {
+  int32_t val = (int32_t) (ts - T0);
+  uint8_t types[] = {DBLOG_TYPE_INT, DBLOG_TYPE_INT};
+  const void *values[] = {&ts, &val};
+  uint16_t lengths[] = {8, 4};
+  return dblog_shards_append(sh, types, values, lengths);
+}
+
+int count_fn(struct dblog_shards *sh, struct dblog_read_context *rctx, void *arg) {
+  (void) sh;
+  (void) rctx;
+  (*(int *) arg)++;
+  return 0;
+}
+
+// Checks no. of rows found by scan of given range
+// and no. of shards in manifest
+int check_range(struct dblog_shards *sh, const char *step, int64_t from_ts,
+      int64_t to_ts, int row_count, int shard_count) {
+  int found = 0;
+  int res = dblog_shards_scan(sh, from_ts, to_ts,
+              NULL, 0, scan_buf, count_fn, &found);
+  printf("%-28s scan %d, %d rows in %u shards\n", step, res, found,
+         sh->shard_count);
+  if (res || found != row_count || sh->shard_count != shard_count) {
+    printf("Expected %d rows in %d shards\n", row_count, shard_count);
+    return 1;
+  }
+  return 0;
+}
+
+int check(struct dblog_shards *sh, const char *step, int row_count, int shard_count) {
+  return check_range(sh, step, T0 - WINDOW_SECS, T0 + 10 * WINDOW_SECS,
+           row_count, shard_count);
+}
+
+// Checks that a row older than the last one is refused
+int check_refused(struct dblog_shards *sh, const char *step, int64_t ts) {
+  int append_res = append_row(sh, ts);
+  printf("%-28s append %d\n", step, append_res);
+  return append_res == DBLOG_RES_ERR ? 0 : 1;
+}
+
+void remove_files(const char *prefix) {
+  char path[DBLOG_SHARD_PATH_MAX];
+  for (int i = -1; i < 3; i++) {
+    snprintf(path, sizeof(path), "%s_%lld.db", prefix, T0 + i * WINDOW_SECS);
+    remove(path);
+  }
+  for (int i = 0; i < 2; i++) {
+    snprintf(path, sizeof(path), "%s.man%d", prefix, i);
+    remove(path);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  const char *prefix = argc > 1 ? argv[1] : "check_shard";
+  struct dblog_shards sh;
+  remove_files(prefix);
+  init_shards(&sh, prefix);
+  int res = dblog_shards_open(&sh);
+  for (int i = 0; !res && i < ROW_COUNT; i++)
+    res = append_row(&sh, T0 + i);
+  if (!res)
+    res = dblog_shards_close(&sh);
+  // open again in the same hour, as after reset
+  init_shards(&sh, prefix);
+  if (!res)
+    res = dblog_shards_open(&sh);
+  if (!res)
+    res = append_row(&sh, T0 + ROW_COUNT);
+  if (!res)
+    res = check(&sh, "same window after close", ROW_COUNT + 1, 1);
+  // late rows, also after the shard is opened again
+  if (!res)
+    res = check_refused(&sh, "late row in same window", T0 + ROW_COUNT - 5);
+  if (!res)
+    res = dblog_shards_close(&sh);
+  if (!res)
+    res = check_refused(&sh, "earlier window after close", T0 - 10);
+  if (!res)
+    res = check_refused(&sh, "late row after close", T0 + 5);
+  if (!res)
+    res = append_row(&sh, T0 + ROW_COUNT);
+  if (!res)
+    res = check_range(&sh, "same time as last row", T0 + ROW_COUNT - 1,
+            T0 + ROW_COUNT, 3, 1);
+  if (!res)
+    res = check_range(&sh, "before first row", T0 - 20, T0 - 5, 0, 1);
+  if (!res)
+    res = dblog_shards_close(&sh);
+  if (!res && dblog_shards_finalize_closed(&sh) != 1)
+    res = 1;
+  if (!res)
+    res = check_refused(&sh, "same window after finalize", T0 + ROW_COUNT + 1);
+  if (!res)
+    res = check(&sh, "after row refused", ROW_COUNT + 2, 1);
+  // shard file created but manifest not written before reset
+  if (!res)
+    res = append_row(&sh, T0 + WINDOW_SECS);
+  if (!res)
+    res = dblog_flush(&sh.cur.wctx);
+  if (!res) {
+    fclose(sh.cur.file);
+    sh.cur.file = NULL;
+    sh.shard_count--; // manifest written without the new shard
+    res = dblog_shards_flush(&sh);
+  }
+  init_shards(&sh, prefix);
+  if (!res)
+    res = dblog_shards_open(&sh);
+  if (!res)
+    res = append_row(&sh, T0 + WINDOW_SECS + 1);
+  if (!res)
+    res = check(&sh, "file without manifest entry", ROW_COUNT + 4, 2);
+  if (!res)
+    res = dblog_shards_close(&sh);
+  // manifest copy being written cut short, as on reset
+  if (!res)
+    res = append_row(&sh, T0 + WINDOW_SECS + 2);
+  if (!res)
+    res = dblog_shards_flush(&sh);
+  if (!res) {
+    char path[DBLOG_SHARD_PATH_MAX];
+    snprintf(path, sizeof(path), "%s.man%u", prefix, sh.manifest_seq % 2);
+    FILE *file = fopen(path, "wb");
+    if (!file || fwrite(path, 1, 20, file) != 20)
+      res = 1;
+    if (file)
+      fclose(file);
+  }
+  init_shards(&sh, prefix);
+  if (!res)
+    res = dblog_shards_open(&sh);
+  if (!res)
+    res = check(&sh, "manifest write cut short", ROW_COUNT + 5, 2);
+  if (!res)
+    res = dblog_shards_close(&sh);
+  remove_files(prefix);
+  printf(res ? "Failed: %d\n" : "Ok\n", res);
+  return res ? 1 : 0;
+}
@@ -0,0 +1,191 @@
+/*
+  Sqlite Micro Logger - host simulation of deep sleep with retained memory
+
+  A node wakes, appends a few rows and goes back to deep sleep using
+  dblog_retain(), keeping wctx->buf and struct dblog_retained in a
+  region standing in for RTC memory, while the write context itself
+  is formed again on each wake using dblog_restore().
+
+  Flash is modelled in memory.  Writes go to a file system buffer and
+  reach flash only when flush_fn is called, as with stdio or the VFS,
+  and the buffer is lost on deep sleep.  Half way, the retained region
+  is corrupted as on power on, after which dblog_resume() is used.
+  At the end the rows in flash are checked to be contiguous and only
+  the rows of the page held in retained memory at power on are lost.
+
+  Build and run on the host from this folder:
+
+    gcc -O2 -I../main sim_retain.c ../main/ulog_sqlite.c -lm -lpthread -o sim_retain
+    ./sim_retain [wakes] [rows_per_wake]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ulog_sqlite.h"
+
+#define PAGE_SIZE_EXP 12
+#define PAGE_SIZE (1 << PAGE_SIZE_EXP)
+#define FLASH_SIZE (16 << 20)
+
+byte *flash;      // contents that survive deep sleep
+byte *fs_buf;     // contents as seen through the file system buffer
+byte *fs_dirty;   // 1 for bytes in fs_buf not yet in flash
+uint32_t fs_len;  // highest position written
+int page_writes;
+
+// Stands in for RTC memory that is not initialized on wake up
+struct retained_region {
+  byte buf[PAGE_SIZE];
+  struct dblog_retained ret;
+} DBLOG_RETAINED_ATTR rtc;
+
+int32_t sim_read_fn_wctx(struct dblog_write_context *ctx, void *buf, uint32_t pos, size_t len) {
+  if (pos + len > fs_len)
+    return DBLOG_RES_READ_ERR;
+  memcpy(buf, fs_buf + pos, len);
+  return len;
+}
+
+int32_t sim_read_fn_rctx(struct dblog_read_context *ctx, void *buf, uint32_t pos, size_t len) {
+  if (pos + len > fs_len)
+    return DBLOG_RES_READ_ERR;
+  memcpy(buf, fs_buf + pos, len);
+  return len;
+}
+
+int32_t sim_write_fn(struct dblog_write_context *ctx, void *buf, uint32_t pos, size_t len) {
+  if (len == PAGE_SIZE)
+    page_writes++;
+  memcpy(fs_buf + pos, buf, len);
+  memset(fs_dirty + pos, 1, len);
+  if (pos + len > fs_len)
+    fs_len = pos + len;
+  return len;
+}
+
+int sim_flush_fn(struct dblog_write_context *ctx) {
+  for (uint32_t i = 0; i < fs_len; i++) {
+    if (fs_dirty[i]) {
+      flash[i] = fs_buf[i];
+      fs_dirty[i] = 0;
+    }
+  }
+  return 0;
+}
+
+// Contents of the file system buffer not flushed are lost
+void deep_sleep() {
+  for (uint32_t i = 0; i < fs_len; i++) {
+    if (fs_dirty[i]) {
+      fs_buf[i] = flash[i];
+      fs_dirty[i] = 0;
+    }
+  }
+}
+
+void init_ctx(struct dblog_write_context *ctx) {
+  memset(ctx, '\0', sizeof(*ctx));
+  ctx->buf = rtc.buf;
+  ctx->col_count = 2;
+  ctx->page_size_exp = PAGE_SIZE_EXP;
+  ctx->read_fn = sim_read_fn_wctx;
+  ctx->write_fn = sim_write_fn;
+  ctx->flush_fn = sim_flush_fn;
+}
+
+int append_row(struct dblog_write_context *ctx, int32_t id) {
+  int32_t val = id * 3;
+  uint8_t types[] = {DBLOG_TYPE_INT, DBLOG_TYPE_INT};
+  const void *values[] = {&id, &val};
+  uint16_t lengths[] = {4, 4};
+  return dblog_append_row_with_values(ctx, types, values, lengths);
+}
+
+uint32_t read_be32(const byte *ptr) {
+  return ((uint32_t) ptr[0] << 24) | ((uint32_t) ptr[1] << 16)
+           | ((uint32_t) ptr[2] << 8) | ptr[3];
+}
+
+// Checks that rows in flash are numbered 1 to row_count
+int check_rows(int32_t row_count) {
+  static byte buf[PAGE_SIZE];
+  struct dblog_read_context rctx;
+  memset(&rctx, '\0', sizeof(rctx));
+  rctx.buf = buf;
+  rctx.read_fn = sim_read_fn_rctx;
+  int res = dblog_read_init(&rctx);
+  if (!res)
+    res = dblog_read_first_row(&rctx);
+  if (res)
+    return res;
+  int32_t id = 1;
+  uint32_t col_type;
+  do {
+    if ((int32_t) read_be32(dblog_read_col_val(&rctx, 0, &col_type)) != id) {
+      printf("Row %d missing\n", id);
+      return 1;
+    }
+    id++;
+  } while (!dblog_read_next_row(&rctx));
+  if (id - 1 != row_count) {
+    printf("%d rows instead of %d\n", id - 1, row_count);
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  int wakes = argc > 1 ? atoi(argv[1]) : 10000;
+  int rows_per_wake = argc > 2 ? atoi(argv[2]) : 5;
+  flash = calloc(FLASH_SIZE, 1);
+  fs_buf = calloc(FLASH_SIZE, 1);
+  fs_dirty = calloc(FLASH_SIZE, 1);
+  if (!flash || !fs_buf || !fs_dirty)
+    return 1;
+  struct dblog_write_context ctx;
+  init_ctx(&ctx);
+  int res = dblog_write_init(&ctx);
+  if (!res)
+    res = dblog_retain(&ctx, &rtc.ret);
+  deep_sleep();
+  int32_t next_id = 1;
+  int32_t lost_rows = 0;
+  for (int wake = 0; !res && wake < wakes; wake++) {
+    init_ctx(&ctx);
+    if (wake == wakes / 2)
+      memset(&rtc, 0x5A, sizeof(rtc)); // power on
+    if (dblog_restore(&ctx, &rtc.ret)) {
+      res = dblog_resume(&ctx);
+      lost_rows = next_id - 1 - ctx.cur_write_rowid;
+      printf("Retained memory lost at wake %d, resumed at row %u"
+             " losing %d rows\n", wake, ctx.cur_write_rowid, lost_rows);
+      if (!res && lost_rows >= PAGE_SIZE / 12) {
+        printf("More than a page of rows lost\n");
+        res = 1;
+      }
+      next_id = ctx.cur_write_rowid + 1;
+    }
+    for (int i = 0; !res && i < rows_per_wake; i++)
+      res = append_row(&ctx, next_id++);
+    if (!res)
+      res = dblog_retain(&ctx, &rtc.ret);
+    deep_sleep();
+  }
+  printf("%d wakes of %d rows: %d page writes, %.3f per wake\n",
+         wakes, rows_per_wake, page_writes, (double) page_writes / wakes);
+  if (!res) {
+    init_ctx(&ctx);
+    res = dblog_restore(&ctx, &rtc.ret);
+    if (!res)
+      res = dblog_finalize(&ctx);
+  }
+  if (!res)
+    res = check_rows(next_id - 1);
+  printf(res ? "Failed: %d\n" : "Ok\n", res);
+  free(flash);
+  free(fs_buf);
+  free(fs_dirty);
+  return res ? 1 : 0;
+}